@@ -0,0 +1,220 @@
+
+#include "corpus.h"
+#include <string.h>
+
+// ZX Spectrum screen: 6144 bytes of pixels in the usual third/row/line order,
+// then 768 bytes of attributes. Mostly empty paper with some dithered boxes,
+// a few lines of "text" and a status bar.
+static void GenerateScreen(std::vector<unsigned char>& data, int)
+{
+	Random rnd(6912);
+	unsigned char pixels[192][32];
+	unsigned char attrs[24][32];
+	memset(pixels, 0, sizeof(pixels));
+	memset(attrs, 0x38, sizeof(attrs)); // black ink on white paper
+
+	static const unsigned char dither[4][2] = { {0xAA, 0x55}, {0x88, 0x22}, {0xFF, 0xFF}, {0xCC, 0x33} };
+	for (int box = 0; box < 6; box++)
+	{
+		int x0 = rnd.Next(28), y0 = rnd.Next(22);
+		int w = 2 + rnd.Next(8), h = 2 + rnd.Next(6);
+		int pattern = rnd.Next(4);
+		unsigned char attr = (unsigned char)(rnd.Next(8) * 8 + rnd.Next(8) + (rnd.Next(2) ? 0x40 : 0));
+		for (int cy = y0; cy < y0 + h && cy < 24; cy++)
+			for (int cx = x0; cx < x0 + w && cx < 32; cx++)
+			{
+				attrs[cy][cx] = attr;
+				for (int line = 0; line < 8; line++)
+					pixels[cy * 8 + line][cx] = dither[pattern][line & 1];
+			}
+	}
+
+	// text rows: random glyphs from a small font
+	unsigned char font[32][8];
+	for (int g = 0; g < 32; g++)
+		for (int line = 0; line < 8; line++)
+			font[g][line] = (line == 0 || line == 7) ? 0 : (unsigned char)(rnd.Next() & 0x7E);
+	for (int row = 18; row < 22; row++)
+		for (int cx = 1; cx < 31; cx++)
+		{
+			int g = rnd.Next(40);
+			if (g >= 32) continue; // space
+			for (int line = 0; line < 8; line++)
+				pixels[row * 8 + line][cx] = font[g][line];
+		}
+
+	// status bar
+	for (int cx = 0; cx < 32; cx++)
+	{
+		attrs[23][cx] = 0x47;
+		for (int line = 0; line < 8; line++)
+			pixels[23 * 8 + line][cx] = (line == 3 || line == 4) ? 0xFF : 0;
+	}
+
+	data.resize(6912);
+	for (int y = 0; y < 192; y++)
+	{
+		int addr = ((y & 0xC0) << 5) | ((y & 7) << 8) | ((y & 0x38) << 2);
+		memmove(&data[addr], pixels[y], 32);
+	}
+	memmove(&data[6144], attrs, 768);
+}
+
+// Z80-like machine code: common instructions with a skewed distribution,
+// a limited set of call targets and some repeated routines.
+static void GenerateCode(std::vector<unsigned char>& data, int size)
+{
+	static const unsigned char instructions[][4] = {
+		// length, bytes...
+		{1, 0xC9}, {1, 0x7E}, {1, 0x23}, {1, 0x77}, {1, 0xAF}, {1, 0xE5}, {1, 0xE1}, {1, 0xC5},
+		{1, 0xC1}, {1, 0x13}, {1, 0x12}, {1, 0x1A}, {1, 0x79}, {1, 0x47}, {1, 0x2B}, {2, 0xED, 0xB0},
+		{2, 0x3E, 0}, {2, 0x06, 0}, {2, 0x0E, 0}, {2, 0x20, 0}, {2, 0x28, 0}, {2, 0x18, 0}, {2, 0xFE, 0}, {2, 0xE6, 0},
+		{3, 0xCD, 0, 0}, {3, 0x21, 0, 0}, {3, 0x11, 0, 0}, {3, 0x01, 0, 0}, {3, 0x3A, 0, 0}, {3, 0x32, 0, 0}, {3, 0xC3, 0, 0}, {3, 0x22, 0, 0},
+	};
+	const int instrCount = sizeof(instructions) / sizeof(instructions[0]);
+
+	Random rnd(0xC0DE);
+	unsigned short targets[24];
+	for (int i = 0; i < 24; i++)
+		targets[i] = (unsigned short)(0x8000 + rnd.Next(0x4000));
+
+	data.clear();
+	while ((int)data.size() < size)
+	{
+		if (data.size() > 256 && rnd.Next(16) == 0)
+		{
+			// repeated fragment, like an unrolled loop or copy-pasted routine
+			int len = 8 + rnd.Next(40);
+			int from = rnd.Next((int)data.size() - len);
+			for (int i = 0; i < len; i++)
+				data.push_back(data[from + i]);
+			continue;
+		}
+
+		// skewed: low indices are more frequent
+		int k = rnd.Next(instrCount);
+		k = rnd.Next(k + 1);
+		const unsigned char* ins = instructions[k];
+		int len = ins[0];
+		data.push_back(ins[1]);
+		if (len == 2)
+		{
+			bool relativeJump = (ins[1] == 0x18 || ins[1] == 0x20 || ins[1] == 0x28);
+			if (ins[2] != 0)
+				data.push_back(ins[2]); // fixed second opcode byte
+			else if (relativeJump)
+				data.push_back((unsigned char)(0xF0 + rnd.Next(16))); // short loop back
+			else
+				data.push_back((unsigned char)rnd.Next(32));
+		}
+		else if (len == 3)
+		{
+			unsigned short addr = targets[rnd.Next(24)];
+			data.push_back((unsigned char)addr);
+			data.push_back((unsigned char)(addr >> 8));
+		}
+	}
+	data.resize(size);
+}
+
+// English-like text built from a small vocabulary
+static void GenerateText(std::vector<unsigned char>& data, int size)
+{
+	static const char* words[] = {
+		"the", "of", "and", "to", "in", "is", "you", "that", "it", "he", "was", "for", "on", "are",
+		"as", "with", "his", "they", "at", "be", "this", "have", "from", "or", "one", "had", "by",
+		"word", "but", "not", "what", "all", "were", "we", "when", "your", "can", "said", "there",
+		"spectrum", "tape", "loading", "screen", "memory", "sprite", "level", "player", "score",
+	};
+	const int wordCount = sizeof(words) / sizeof(words[0]);
+
+	Random rnd(0x7E47);
+	data.clear();
+	int sentence = 0;
+	while ((int)data.size() < size)
+	{
+		int k = rnd.Next(wordCount);
+		k = rnd.Next(k + 1);
+		const char* w = words[k];
+		bool capital = (sentence == 0);
+		for (const char* c = w; *c; c++, capital = false)
+			data.push_back((unsigned char)(capital ? *c - 'a' + 'A' : *c));
+		sentence++;
+		if (sentence > 4 && rnd.Next(8) == 0)
+		{
+			data.push_back('.');
+			if (rnd.Next(4) == 0) data.push_back('\r');
+			sentence = 0;
+		}
+		data.push_back(' ');
+	}
+	data.resize(size);
+}
+
+// Looks like output of another packer: close to random,
+// with occasional short repeats that no longer pay off
+static void GeneratePacked(std::vector<unsigned char>& data, int size)
+{
+	Random rnd(0xDA7A);
+	data.clear();
+	while ((int)data.size() < size)
+	{
+		if (data.size() > 16 && rnd.Next(12) == 0)
+		{
+			int from = (int)data.size() - 2 - rnd.Next(14);
+			unsigned char a = data[from], b = data[from + 1];
+			data.push_back(a);
+			data.push_back(b);
+		}
+		else
+		{
+			data.push_back((unsigned char)rnd.Next());
+		}
+	}
+	data.resize(size);
+}
+
+static void GenerateZero(std::vector<unsigned char>& data, int size)
+{
+	data.assign(size, 0);
+}
+
+// Short-period patterns: a 7-byte pattern followed by 2-byte dither
+static void GeneratePeriod(std::vector<unsigned char>& data, int size)
+{
+	static const unsigned char pattern[7] = { 0x18, 0x3C, 0x7E, 0xFF, 0x7E, 0x3C, 0x18 };
+	data.resize(size);
+	for (int i = 0; i < size; i++)
+		data[i] = (i < size / 2) ? pattern[i % 7] : ((i & 1) ? 0x55 : 0xAA);
+}
+
+static void GenerateRandom(std::vector<unsigned char>& data, int size)
+{
+	Random rnd(0x5EED);
+	data.resize(size);
+	for (int i = 0; i < size; i++)
+		data[i] = (unsigned char)rnd.Next();
+}
+
+static const CorpusCase corpusCases[] = {
+	{ "screen", true,  GenerateScreen },
+	{ "code",   false, GenerateCode },
+	{ "text",   false, GenerateText },
+	{ "packed", false, GeneratePacked },
+	{ "zero",   false, GenerateZero },
+	{ "period", false, GeneratePeriod },
+	{ "random", false, GenerateRandom },
+	{ NULL, false, NULL }
+};
+
+const CorpusCase* GetCorpusCases()
+{
+	return corpusCases;
+}
+
+const CorpusCase* FindCorpusCase(const char* name)
+{
+	for (const CorpusCase* c = corpusCases; c->Name; c++)
+		if (strcmp(c->Name, name) == 0) return c;
+	return NULL;
+}
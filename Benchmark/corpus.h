@@ -0,0 +1,38 @@
+
+#pragma once
+
+#include <vector>
+
+// xorshift32, good enough for test data and identical on every platform
+class Random
+{
+	unsigned int state;
+
+public:
+	Random(unsigned int seed) : state(seed ? seed : 1) {};
+
+	unsigned int Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	};
+
+	int Next(int n) { return int(Next() % (unsigned)n); };
+};
+
+// Synthetic benchmark inputs. Generation is fully deterministic (fixed seeds),
+// so packed sizes can be compared against a stored baseline byte for byte.
+
+struct CorpusCase
+{
+	const char* Name;
+	bool FixedSize;     // ignores requested size (e.g. ZX screen is always 6912 bytes)
+	void (*Generate)(std::vector<unsigned char>& data, int size);
+};
+
+// Returns NULL-terminated list of all cases
+const CorpusCase* GetCorpusCases();
+
+const CorpusCase* FindCorpusCase(const char* name);
@@ -0,0 +1,1180 @@
+#include <string.h>
+#include <algorithm>
+#include "depackers.h"
+#include "z80.h"
+#include "z80asm.h"
+
+// Both routines keep the output pointer in DE and do arithmetic in A, BC and HL of the
+// main register set. Input pointer and bit reader live in the alternate set, so that
+// GETBIT (next control bit to carry flag) is EXX around a few instructions and
+// leaves A and the main registers alone.
+//
+// Lines between "#if <path>..." and "#else" or "#endif" are kept if a stream takes any
+// of the paths (see getHrust1Paths, getHrust2Paths), so a routine specialized for the
+// stream leaves out code it never runs. Paths are op kinds of OpStats (OpKindNames)
+// and ranges of them. "GETBIT <path>" names the path a bit is read on, untagged
+// GETBIT is the dispatch of every op. Generic routines keep all lines.
+//
+// "#if spec" is taken by the specialized routines only. They inline every GETBIT and
+// run the dispatch and the short paths in the alternate set, where GETBITX is GETBIT
+// without the EXX around it.
+
+// Hrust 1.3. Alternate set: HL' = input, BC' = control word, E' = bits left in it,
+// D' = D register of the format (number of high distance bits).
+// Control words are refilled right after the last bit is taken, as Compressor
+// reserves them before the data bytes that follow.
+static const char* const hrust1Source = R"(
+hrust1:
+	inc hl
+	inc hl
+	ld c,(hl)
+	inc hl
+	ld b,(hl)		; unpacked size
+	inc hl
+	inc hl
+	inc hl
+	push de
+	ex de,hl
+	add hl,bc
+	ld bc,-6
+	add hl,bc
+	ex de,hl
+	ld bc,6
+	ldir			; last 6 bytes are stored in header
+	pop de
+	push hl
+	exx
+	pop hl
+	ld c,(hl)
+	inc hl
+	ld b,(hl)
+	inc hl
+	ld e,16
+#if d_change
+	ld d,2
+#endif
+	ld a,(hl)
+	inc hl
+	exx
+	ld (de),a		; first byte
+	inc de
+main:
+#if spec
+	exx
+	GETBITX
+	jr nc,op0
+	ld a,(hl)		; 1 byte
+	inc hl
+	exx
+	ld (de),a
+	inc de
+	jp main
+op0:				; alternate set from here to count2 and op01
+	GETBITX
+	jp c,op01
+#else
+	GETBIT
+	jr nc,op0
+	exx				; 1 byte
+	ld a,(hl)
+	inc hl
+	exx
+	ld (de),a
+	inc de
+	jp main
+op0:
+	GETBIT
+	jp c,op01
+#endif
+#if ref1_dist8 count2
+#if spec
+	GETBITX
+#else
+	GETBIT
+#endif
+#if ref1_dist8
+#if count2
+	jr c,count2
+#endif
+#if spec
+	ld a,0x1F		; count 1, distance -8..-1
+	GETBITX
+	rla
+	GETBITX
+	rla
+	GETBITX
+	rla
+	exx
+	ld l,a
+	ld h,0xFF
+#else
+	ld hl,0xFF1F	; count 1, distance -8..-1
+	GETBIT ref1_dist8
+	rl l
+	GETBIT ref1_dist8
+	rl l
+	GETBIT ref1_dist8
+	rl l
+#endif
+	add hl,de
+	ld a,(hl)
+	ld (de),a
+	inc de
+	jp main
+#endif
+#if count2
+count2:
+#if spec
+	xor a
+	GETBITX
+	rla
+	GETBITX
+	rla
+	exx
+	ld bc,2
+#else
+	ld bc,2
+	xor a
+	GETBIT count2
+	rla
+	GETBIT count2
+	rla
+#endif
+	cp 2
+#if ref2_byte rir_long d_change
+	jr z,count2_byte
+#endif
+#if ref2_far
+	jr c,count2_far
+#endif
+#if ref2_dist32
+#if spec
+	ld a,7			; distance -32..-1
+	GETBIT ref2_dist32
+	rla
+	GETBIT ref2_dist32
+	rla
+	GETBIT ref2_dist32
+	rla
+	GETBIT ref2_dist32
+	rla
+	GETBIT ref2_dist32
+	rla
+	ld l,a
+#else
+	ld l,7			; distance -32..-1
+	GETBIT ref2_dist32
+	rl l
+	GETBIT ref2_dist32
+	rl l
+	GETBIT ref2_dist32
+	rl l
+	GETBIT ref2_dist32
+	rl l
+	GETBIT ref2_dist32
+	rl l
+#endif
+	ld h,0xFF
+	jp copy
+#endif
+#if ref2_far
+count2_far:
+	ld h,0xFD		; distance -768..-257
+	or a
+	jr z,count2_far0
+	inc h
+count2_far0:
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld l,a
+	jp copy
+#endif
+#if ref2_byte rir_long d_change
+count2_byte:
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+#if rir_long d_change
+	cp 0xE0
+	jr nc,count2_special
+#endif
+#if ref2_byte
+	ld l,a			; distance -256..-33
+	ld h,0xFF
+	jp copy
+#endif
+#if rir_long d_change
+count2_special:
+#if rir_long
+#if d_change
+	cp 0xFE
+	jr z,change_d
+#endif
+	add a,a			; RIR with even distance
+	inc a
+	xor 2
+	sub 15
+	jp rir
+#endif
+#if d_change
+change_d:
+	exx
+	ld a,d
+	and 7
+	inc a
+	ld d,a
+	exx
+	jp main
+#endif
+#endif
+#endif
+#endif
+#endif
+op01:
+#if spec
+	GETBITX
+	exx
+	ld bc,3
+#else
+	ld bc,3
+	GETBIT
+#endif
+	jp nc,long_dist
+#if long_pairs
+	ld b,4			; up to 4 more pairs of count bits
+pair:
+	xor a
+	GETBIT long_pairs
+	rla
+	GETBIT long_pairs
+	rla
+	ld l,a
+	add a,c
+	ld c,a
+	ld a,l
+	cp 3
+	jr nz,pairs_done
+	djnz pair
+	jp long_dist
+pairs_done:
+	or a
+	jr nz,count_done
+	ld a,b
+	cp 4
+	jr z,escape		; 0 in first pair
+count_done:
+	ld b,0
+	jp long_dist
+#else
+	GETBIT escape
+	GETBIT escape	; 0 in first pair, no counts 4..15
+#endif
+escape:
+	GETBIT escape
+#if rir_short
+	jp c,rir_short
+#endif
+	GETBIT escape
+#if literal_run
+	jp c,literals
+#endif
+#if long_count7 long_count15
+	xor a			; 7 bits of count or its high byte
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	GETBIT escape
+	rla
+	cp 15
+	ret z			; end of stream
+	ld c,a
+	ld b,0
+#if long_count15
+	cp 16
+	jp nc,long_dist
+	ld b,a
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld c,a
+#endif
+	jp long_dist
+#else
+	ret				; end of stream
+#endif
+#if rir_short
+rir_short:
+	ld a,0x0F		; RIR with distance -16..-1
+	GETBIT rir_short
+	rla
+	GETBIT rir_short
+	rla
+	GETBIT rir_short
+	rla
+	GETBIT rir_short
+	rla
+	jp rir
+#endif
+#if literal_run
+literals:
+	xor a			; 12..42 bytes
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	add a,a
+	add a,12
+	ld c,a
+	ld b,0
+	exx
+	push hl
+	exx
+	pop hl
+	ldir
+	push hl
+	exx
+	pop hl
+	exx
+	jp main
+#endif
+long_dist:
+#if long rir_long
+	xor a
+	GETBIT long
+	rla
+	GETBIT long
+	rla
+	cp 2
+#if long_dist32
+	jr z,long_dist_short
+#endif
+#if long_dist256 long_dist512 rir_long
+	jr c,long_dist_byte
+#endif
+#if long_far
+#if d_change
+	push bc			; D bits of high byte
+	exx
+	ld a,d
+	exx
+	ld b,a
+	ld a,0xFF
+long_dist_high:
+	GETBIT long_far
+	rla
+	djnz long_dist_high
+	pop bc
+#else
+	ld a,0xFF		; D is always 2
+	GETBIT long_far
+	rla
+	GETBIT long_far
+	rla
+#endif
+	ld h,a
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld l,a
+	jp copy
+#endif
+#if long_dist32
+long_dist_short:
+#if spec
+	ld a,7			; distance -32..-1
+	GETBIT long_dist32
+	rla
+	GETBIT long_dist32
+	rla
+	GETBIT long_dist32
+	rla
+	GETBIT long_dist32
+	rla
+	GETBIT long_dist32
+	rla
+	ld l,a
+#else
+	ld l,7			; distance -32..-1
+	GETBIT long_dist32
+	rl l
+	GETBIT long_dist32
+	rl l
+	GETBIT long_dist32
+	rl l
+	GETBIT long_dist32
+	rl l
+	GETBIT long_dist32
+	rl l
+#endif
+	ld h,0xFF
+	jp copy
+#endif
+#if long_dist256 long_dist512 rir_long
+long_dist_byte:
+#if long_dist256 rir_long
+#if long_dist512
+	or a
+	jr z,long_dist_far
+#endif
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+#if rir_long
+	cp 0xE0
+	jr nc,rir_odd
+#endif
+#if long_dist256
+	ld l,a			; distance -256..-33
+	ld h,0xFF
+	jp copy
+#endif
+#if rir_long
+rir_odd:
+	add a,a			; RIR with odd distance
+	inc a
+	xor 3
+	sub 15
+	jp rir
+#endif
+#endif
+#if long_dist512
+long_dist_far:
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld l,a			; distance -512..-257
+	ld h,0xFE
+	jp copy
+#endif
+#endif
+#endif
+#if rir_short rir_long
+rir:				; A = distance: ref + inserted byte + ref
+	ld l,a
+	ld h,0xFF
+	add hl,de
+	ld a,(hl)
+	ld (de),a
+	inc de
+	inc hl
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld (de),a
+	inc de
+	inc hl
+	ld a,(hl)
+	ld (de),a
+	inc de
+	jp main
+#endif
+copy:				; HL = distance, BC = count
+	add hl,de
+	ldir
+	jp main
+)";
+
+static const char* const hrust1GetBitCall = R"(
+getbit:
+	exx
+	sla c
+	rl b
+	dec e
+	jr nz,getbit_done
+	ld c,(hl)
+	inc hl
+	ld b,(hl)
+	inc hl
+	ld e,16
+getbit_done:
+	exx
+	ret
+)";
+
+static const char* const hrust1GetBitInline = R"(
+	exx
+	sla c
+	rl b
+	dec e
+	jr nz,$+8
+	ld c,(hl)
+	inc hl
+	ld b,(hl)
+	inc hl
+	ld e,16
+	exx
+)";
+
+// Hrust 2.1. Alternate set: HL' = input, C' = control byte with a marker bit below
+// unread bits. Control bytes are read when a bit is needed, as Compressor reserves
+// them when it emits the first bit.
+static const char* const hrust2Source = R"(
+hrust2:
+	inc hl
+	inc hl
+	inc hl
+	ld a,(hl)		; '1', bit 7 is set in stored blocks
+	inc hl
+	ld c,(hl)
+	inc hl
+	ld b,(hl)		; unpacked size
+	inc hl
+	inc hl
+	inc hl
+	rla
+#if stored
+#if packed
+	jr nc,packed
+#endif
+	ld a,b
+	or c
+	ret z
+	ldir
+	ret
+#endif
+#if packed
+packed:
+	push de
+	ex de,hl
+	add hl,bc
+	ld bc,-6
+	add hl,bc
+	ex de,hl
+	ld bc,6
+	ldir			; last 6 bytes are stored in header
+	pop de
+	ldi				; first byte
+	push hl
+	exx
+	pop hl
+	ld c,0x80
+	exx
+main:
+#if spec
+	exx
+	GETBITX
+	jr nc,op0
+	ld a,(hl)		; 1 byte
+	inc hl
+	exx
+	ld (de),a
+	inc de
+	jp main
+op0:				; alternate set from here to count2 and op01
+	GETBITX
+	jr c,op01
+#else
+	GETBIT
+	jr nc,op0
+	exx				; 1 byte
+	ld a,(hl)
+	inc hl
+	exx
+	ld (de),a
+	inc de
+	jp main
+op0:
+	GETBIT
+	jr c,op01
+#endif
+#if ref1_dist8 ref2_dist256
+#if spec
+	GETBITX
+#else
+	GETBIT
+#endif
+#if ref1_dist8
+#if ref2_dist256
+	jr c,count2
+#endif
+#if spec
+	ld a,0x1F		; count 1, distance -8..-1
+	GETBITX
+	rla
+	GETBITX
+	rla
+	GETBITX
+	rla
+	exx
+	ld l,a
+	ld h,0xFF
+#else
+	ld hl,0xFF1F	; count 1, distance -8..-1
+	GETBIT ref1_dist8
+	rl l
+	GETBIT ref1_dist8
+	rl l
+	GETBIT ref1_dist8
+	rl l
+#endif
+	add hl,de
+	ld a,(hl)
+	ld (de),a
+	inc de
+	jp main
+#endif
+#if ref2_dist256
+count2:
+#if spec
+	ld a,(hl)
+	inc hl
+	exx
+#else
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+#endif
+	ld l,a			; distance -256..-1
+	ld h,0xFF
+	add hl,de
+	ldi
+	ldi
+	jp main
+#endif
+#endif
+op01:
+#if spec
+	GETBITX
+	exx
+	ld bc,3
+#else
+	ld bc,3
+	GETBIT
+#endif
+	jp nc,dist
+#if long_pairs
+	ld b,4			; up to 4 more pairs of count bits
+pair:
+	xor a
+	GETBIT long_pairs
+	rla
+	GETBIT long_pairs
+	rla
+	ld l,a
+	add a,c
+	ld c,a
+	ld a,l
+	cp 3
+	jr nz,pairs_done
+	djnz pair
+	jp dist
+pairs_done:
+	or a
+	jr nz,count_done
+	ld a,b
+	cp 4
+	jr z,escape		; 0 in first pair
+count_done:
+	ld b,0
+	jp dist
+#else
+	GETBIT escape
+	GETBIT escape	; 0 in first pair, no counts 4..15
+#endif
+escape:
+	GETBIT escape
+#if literal_run
+	jr nc,literals
+#endif
+#if long_count8 long_count16
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	or a
+	ret z			; end of stream
+	ld c,a
+	ld b,0
+#if long_count16
+	cp 16
+	jr nc,dist
+	ld b,a			; count 256..0xFFF
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld c,a
+#endif
+	jp dist
+#else
+	ret				; end of stream
+#endif
+#if literal_run
+literals:
+	xor a			; 12..42 bytes
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	GETBIT literal_run
+	rla
+	add a,a
+	add a,12
+	ld c,a
+	ld b,0
+	exx
+	push hl
+	exx
+	pop hl
+	ldir
+	push hl
+	exx
+	pop hl
+	exx
+	jp main
+#endif
+dist:
+#if long
+	GETBIT long
+	ld h,0xFF		; high byte -1
+#if long_dist768 long_dist1792 long_dist3840 long_dist7680 long_far
+#if long_dist256
+	jp c,dist_low
+#endif
+	xor a
+	GETBIT long
+	rla
+	GETBIT long
+	rla
+	cp 2
+#if long_dist1792
+	jr z,dist2
+#endif
+#if long_dist3840 long_dist7680 long_far
+	jr c,dist01
+#endif
+#if long_dist768
+	ld h,0xFD		; -3, -2
+	GETBIT long_dist768
+	jp nc,dist_low
+	inc h
+	jp dist_low
+#endif
+#if long_dist1792
+dist2:
+	ld a,0x3E		; -7..-4
+	GETBIT long_dist1792
+	rla
+	GETBIT long_dist1792
+	rla
+	inc a
+	ld h,a
+	jp dist_low
+#endif
+#if long_dist3840 long_dist7680 long_far
+dist01:
+#if long_dist3840
+#if long_dist7680 long_far
+	or a
+	jr z,dist00
+#endif
+	ld a,0x1E		; -15..-8
+	GETBIT long_dist3840
+	rla
+	GETBIT long_dist3840
+	rla
+	GETBIT long_dist3840
+	rla
+	inc a
+	ld h,a
+	jp dist_low
+#endif
+#if long_dist7680 long_far
+dist00:
+#if long_dist7680
+	ld a,0x0E		; -30..-16, or a whole byte
+	GETBIT long_dist7680
+	rla
+	GETBIT long_dist7680
+	rla
+	GETBIT long_dist7680
+	rla
+	GETBIT long_dist7680
+	rla
+#if long_far
+	cp 0xE0
+	jr z,dist_byte
+#endif
+	inc a
+	ld h,a
+	jp dist_low
+#else
+	GETBIT long_far
+	GETBIT long_far
+	GETBIT long_far
+	GETBIT long_far	; 0000: a whole byte
+#endif
+#if long_far
+dist_byte:
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld h,a
+#endif
+#endif
+#endif
+#endif
+#endif
+dist_low:
+	exx
+	ld a,(hl)
+	inc hl
+	exx
+	ld l,a
+	add hl,de
+	ldir
+	jp main
+#endif
+)";
+
+static const char* const hrust2GetBitCall = R"(
+getbit:
+	exx
+	sla c
+	jr nz,getbit_done
+	ld c,(hl)
+	inc hl
+	rl c
+getbit_done:
+	exx
+	ret
+)";
+
+static const char* const hrust2GetBitInline = R"(
+	exx
+	sla c
+	jr nz,$+6
+	ld c,(hl)
+	inc hl
+	rl c
+	exx
+)";
+
+enum GETBIT_MODE
+{
+	GETBIT_CALL,
+	GETBIT_INLINE,
+	GETBIT_SPEC // inline, "#if spec" taken, EXX pairs around A-only code left out
+};
+
+// Line without its comment and the whitespace around
+static std::string getCode(const std::string& line)
+{
+	size_t end = line.find(';');
+	if (end == std::string::npos) end = line.size();
+	size_t begin = line.find_first_not_of(" \t\r");
+	if (begin >= end) return std::string();
+	end = line.find_last_not_of(" \t\r", end - 1) + 1;
+	return line.substr(begin, end - begin);
+}
+
+// True for instructions that leave BC, DE and HL of both sets alone
+static bool usesOnlyA(const std::string& code)
+{
+	if (code == "rla" || code == "xor a" || code == "or a") return true;
+	if (code.compare(0, 5, "ld a,") == 0 || code.compare(0, 3, "cp ") == 0)
+		return code.find_first_of("(bcdehl", code[0] == 'l' ? 5 : 3) == std::string::npos;
+	return false;
+}
+
+// Drops "exx / exx" and turns "exx / X / exx" into X where X only touches A and flags,
+// so consecutive inlined GETBITs stay in the alternate set. Targets of "jr nz,$+n" in
+// GETBIT are the trailing EXX, and the next instruction takes its place.
+static std::string dropExxPairs(const std::string& source)
+{
+	std::vector<std::string> lines;
+	size_t pos = 0;
+	while (pos < source.size())
+	{
+		size_t eol = source.find('\n', pos);
+		if (eol == std::string::npos) eol = source.size();
+		lines.push_back(source.substr(pos, eol - pos));
+		pos = eol + 1;
+	}
+
+	std::string result;
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		if (getCode(lines[i]) == "exx" && i + 1 < lines.size())
+		{
+			if (getCode(lines[i + 1]) == "exx")
+			{
+				i++;
+				continue;
+			}
+			if (i + 2 < lines.size() && usesOnlyA(getCode(lines[i + 1])) && getCode(lines[i + 2]) == "exx")
+			{
+				result += lines[i + 1] + "\n";
+				i += 2;
+				continue;
+			}
+		}
+		result += lines[i] + "\n";
+	}
+	return result;
+}
+
+static bool takes(const Z80Paths* paths, const std::string& path)
+{
+	if (!paths) return true;
+	Z80Paths::const_iterator p = paths->find(path);
+	return p != paths->end() && p->second > 0;
+}
+
+// Keeps lines of 'source' the stream taking 'paths' needs (all if NULL) and replaces
+// GETBIT lines with 'inlineCode' or with a call of 'subroutine', which is then appended
+// at the end.
+static std::string expandSource(const char* source, const Z80Paths* paths,
+	GETBIT_MODE mode, const char* inlineCode, const char* subroutine)
+{
+	std::string inlined = inlineCode + 1;
+	std::string inlinedX = inlined.substr(inlined.find('\n') + 1); // without the EXXs
+	inlinedX.erase(inlinedX.rfind('\n', inlinedX.size() - 2) + 1);
+	std::string result;
+	std::vector<bool> keep(1, true); // of each open #if, and of all outside them
+	bool called = false;
+	std::string s = source;
+	size_t pos = 0;
+	while (pos < s.size())
+	{
+		size_t eol = s.find('\n', pos);
+		if (eol == std::string::npos) eol = s.size();
+		std::string line = s.substr(pos, eol - pos);
+		pos = eol + 1;
+		if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+
+		std::vector<std::string> words;
+		size_t w = 0;
+		while (w < line.size())
+		{
+			size_t e = line.find_first_of(" \t;", w);
+			if (e == std::string::npos) e = line.size();
+			if (e > w) words.push_back(line.substr(w, e - w));
+			if (e < line.size() && line[e] == ';') break;
+			w = e + 1;
+		}
+
+		if (!words.empty() && words[0] == "#if")
+		{
+			bool any = false;
+			for (size_t i = 1; i < words.size(); i++)
+				any = any || (words[i] == "spec" ? mode == GETBIT_SPEC : takes(paths, words[i]));
+			keep.push_back(keep.back() && any);
+			continue;
+		}
+		if (!words.empty() && words[0] == "#else")
+		{
+			bool outer = keep[keep.size() - 2];
+			keep.back() = outer && !keep.back();
+			continue;
+		}
+		if (!words.empty() && words[0] == "#endif")
+		{
+			keep.pop_back();
+			continue;
+		}
+		if (!keep.back())
+			continue;
+
+		if (!words.empty() && words[0] == "GETBITX")
+			result += inlinedX;
+		else if (!words.empty() && words[0] == "GETBIT")
+		{
+			if (mode != GETBIT_CALL)
+				result += inlined;
+			else
+			{
+				result += "\tcall getbit\n";
+				called = true;
+			}
+		}
+		else
+			result += line + "\n";
+	}
+	if (called) result += subroutine;
+	return mode == GETBIT_SPEC ? dropExxPairs(result) : result;
+}
+
+static const PackedOps* findOps(const std::vector<PackedOps>& ops, const char* kind)
+{
+	for (size_t i = 0; i < ops.size(); i++)
+		if (strcmp(ops[i].Kind, kind) == 0) return &ops[i];
+	return NULL;
+}
+
+// Op kinds as paths, and "long" (backrefs of 3 bytes or more) split by count encoding:
+// long_pairs (4..15), 'mid' (16..bigCount-1) and 'big' (bigCount and more)
+static Z80Paths getPaths(const std::vector<PackedOps>& ops, int bigCount, const char* mid, const char* big)
+{
+	Z80Paths paths;
+	int longCount = 0, minCount = 0, maxCount = 0;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		const PackedOps& o = ops[i];
+		paths[o.Kind] = o.Count;
+		if (strncmp(o.Kind, "long_", 5) != 0) continue;
+		minCount = longCount ? std::min(minCount, o.MinCount) : o.MinCount;
+		maxCount = longCount ? std::max(maxCount, o.MaxCount) : o.MaxCount;
+		longCount += o.Count;
+	}
+	paths["long"] = longCount;
+	if (minCount <= 15 && maxCount >= 4) paths["long_pairs"] = longCount;
+	if (minCount < bigCount && maxCount >= 16) paths[mid] = longCount;
+	if (maxCount >= bigCount) paths[big] = longCount;
+	return paths;
+}
+
+static int getPath(const Z80Paths& paths, const char* path)
+{
+	Z80Paths::const_iterator p = paths.find(path);
+	return p != paths.end() ? p->second : 0;
+}
+
+// Hrust 1.3: count 2 at distance -256..-33 and -768..-257 (ref2_byte, ref2_far), RIR at
+// distance -16..-1 and -79..-17 (rir_short, rir_long), counts 16..127 and 128..0xEFF
+static Z80Paths getHrust1Paths(const std::vector<PackedOps>& ops)
+{
+	Z80Paths paths = getPaths(ops, 128, "long_count7", "long_count15");
+	const PackedOps* ref2 = findOps(ops, "ref2_dist768");
+	if (ref2 && ref2->MinDist <= 256) paths["ref2_byte"] = ref2->Count;
+	if (ref2 && ref2->MaxDist > 256) paths["ref2_far"] = ref2->Count;
+	const PackedOps* rir = findOps(ops, "rir");
+	if (rir && rir->MinDist <= 16) paths["rir_short"] = rir->Count;
+	if (rir && rir->MaxDist > 16) paths["rir_long"] = rir->Count;
+	paths["count2"] = getPath(paths, "ref2_dist32") + getPath(paths, "ref2_dist768") +
+		getPath(paths, "rir_long") + getPath(paths, "d_change");
+	paths["escape"] = getPath(paths, "literal_run") + getPath(paths, "rir_short") +
+		getPath(paths, "long_count7") + getPath(paths, "long_count15") + getPath(paths, "end");
+	return paths;
+}
+
+// Hrust 2.1: stored or packed block, counts 16..255 and 256..0xFFF
+static Z80Paths getHrust2Paths(const std::vector<PackedOps>& ops)
+{
+	Z80Paths paths = getPaths(ops, 256, "long_count8", "long_count16");
+	paths[ops.empty() ? "stored" : "packed"] = 1;
+	paths["escape"] = getPath(paths, "literal_run") +
+		getPath(paths, "long_count8") + getPath(paths, "long_count16") + getPath(paths, "end");
+	return paths;
+}
+
+Z80Depacker SpecializeZ80Depacker(const std::string& format, const std::vector<PackedOps>* ops)
+{
+	Z80Depacker d;
+	d.Format = format;
+	d.Name = format + "/spec";
+	d.Specialized = true;
+
+	Z80Paths paths;
+	if (ops)
+	{
+		paths = (format == "hrust1") ? getHrust1Paths(*ops) : getHrust2Paths(*ops);
+		d.Source = "; paths:";
+		for (Z80Paths::const_iterator p = paths.begin(); p != paths.end(); ++p)
+			if (p->second > 0) d.Source += " " + p->first;
+		d.Source += "\n";
+	}
+	const Z80Paths* taken = ops ? &paths : NULL;
+
+	if (format == "hrust1")
+		d.Source += expandSource(hrust1Source, taken, GETBIT_SPEC, hrust1GetBitInline, hrust1GetBitCall);
+	else
+		d.Source += expandSource(hrust2Source, taken, GETBIT_SPEC, hrust2GetBitInline, hrust2GetBitCall);
+	return d;
+}
+
+std::vector<Z80Depacker> GetZ80Depackers()
+{
+	std::vector<Z80Depacker> list;
+	Z80Depacker d;
+	d.Specialized = false;
+
+	d.Format = "hrust1";
+	d.Name = "hrust1/call";
+	d.Source = expandSource(hrust1Source, NULL, GETBIT_CALL, hrust1GetBitInline, hrust1GetBitCall);
+	list.push_back(d);
+	d.Name = "hrust1/inline";
+	d.Source = expandSource(hrust1Source, NULL, GETBIT_INLINE, hrust1GetBitInline, hrust1GetBitCall);
+	list.push_back(d);
+	list.push_back(SpecializeZ80Depacker("hrust1", NULL));
+
+	d.Format = "hrust2";
+	d.Name = "hrust2/call";
+	d.Source = expandSource(hrust2Source, NULL, GETBIT_CALL, hrust2GetBitInline, hrust2GetBitCall);
+	list.push_back(d);
+	d.Name = "hrust2/inline";
+	d.Source = expandSource(hrust2Source, NULL, GETBIT_INLINE, hrust2GetBitInline, hrust2GetBitCall);
+	list.push_back(d);
+	list.push_back(SpecializeZ80Depacker("hrust2", NULL));
+
+	return list;
+}
+
+const char* RunZ80Depacker(Z80& z80, const std::vector<unsigned char>& code, const unsigned char* packed, int packedSize,
+	const unsigned char* data, int dataSize)
+{
+	z80 = Z80();
+	int inputOrg = INPUT_END - packedSize;
+	if (OUTPUT_ORG + dataSize > inputOrg)
+		return "doesn't fit in 64K";
+
+	z80.Memory[RETURN_ADDR] = 0x76; // HALT
+	memcpy(&z80.Memory[CODE_ORG], &code[0], code.size());
+	memcpy(&z80.Memory[inputOrg], packed, packedSize);
+	z80.SP = STACK_TOP - 2;
+	z80.Memory[z80.SP] = byte(RETURN_ADDR);
+	z80.Memory[z80.SP + 1] = byte(RETURN_ADDR >> 8);
+	z80.H = byte(inputOrg >> 8);
+	z80.L = byte(inputOrg);
+	z80.D = byte(OUTPUT_ORG >> 8);
+	z80.E = byte(OUTPUT_ORG);
+	z80.PC = CODE_ORG;
+	// last 6 bytes are copied from header before anything else
+	z80.WatchStreams(inputOrg, packedSize, OUTPUT_ORG, dataSize - 6);
+
+	if (!z80.Run(MAX_TSTATES))
+		return z80.Error;
+	if (dataSize > 0 && memcmp(&z80.Memory[OUTPUT_ORG], data, dataSize) != 0)
+		return "output differs from input";
+	return NULL;
+}
+
+const char* CheckZ80Depacker(const std::string& source, const unsigned char* packed, int packedSize,
+	const unsigned char* data, int dataSize, int* codeSize, long long* tStates)
+{
+	Z80Assembler assembler;
+	if (!assembler.Assemble(source, CODE_ORG))
+		return "routine doesn't assemble";
+	*codeSize = (int)assembler.Code.size();
+
+	Z80* z80 = new Z80(); // 64K of memory
+	const char* error = RunZ80Depacker(*z80, assembler.Code, packed, packedSize, data, dataSize);
+	*tStates = z80->TStates;
+	delete z80;
+	return error;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "packers.h"
+
+class Z80;
+
+// Memory layout of a run. Output goes up from OUTPUT_ORG, packed block ends below the
+// stack, routine sits on top. A HALT at RETURN_ADDR stops emulation when it returns.
+#define RETURN_ADDR 0x0000
+#define OUTPUT_ORG  0x0100
+#define STACK_TOP   0xF800
+#define INPUT_END   (STACK_TOP - 0x100)
+#define CODE_ORG    STACK_TOP
+
+#define MAX_TSTATES 4000000000LL
+
+// Z80 depacker routine for ohz80 and --depacker of the packers. Called with
+// HL = packed block (header included) and DE = destination; returns with RET
+// when the block is unpacked.
+struct Z80Depacker
+{
+	std::string Name;    // "<format>/<variant>"
+	std::string Format;  // Packer::GetName() of the blocks it unpacks
+	std::string Source;  // Z80Assembler source
+	bool Specialized;    // made for each block by SpecializeZ80Depacker(); Source unpacks any block
+};
+
+// Paths through a depacker routine that ops of a block take, with the number of ops taking each
+typedef std::map<std::string, int> Z80Paths;
+
+// All routines: for each format, with the bit reader as a subroutine ("call"),
+// expanded in place ("inline"), and the generic form of "spec"
+std::vector<Z80Depacker> GetZ80Depackers();
+
+// Routine of 'format' ("<format>/spec") for a block with 'ops' (Packer::GetOps()):
+// code of paths its ops don't take is left out, the bit reader is expanded in place
+// everywhere, and the dispatch, 1 byte and short backrefs run in the alternate set.
+// With NULL 'ops', the routine unpacks any block.
+Z80Depacker SpecializeZ80Depacker(const std::string& format, const std::vector<PackedOps>* ops);
+
+// Runs 'code' (assembled at CODE_ORG) on 'packed' in 'z80' and checks the result against
+// 'data'. Returns NULL if the output is correct, else what went wrong. T-states and peak
+// overlap of the run are left in 'z80'.
+const char* RunZ80Depacker(Z80& z80, const std::vector<unsigned char>& code, const unsigned char* packed, int packedSize,
+	const unsigned char* data, int dataSize);
+
+// Assembles 'source' and runs it on 'packed' (see RunZ80Depacker), for packers that
+// write the routine along with their output (--depacker). 'codeSize' and 'tStates'
+// are set if it assembles and the run ends.
+const char* CheckZ80Depacker(const std::string& source, const unsigned char* packed, int packedSize,
+	const unsigned char* data, int dataSize, int* codeSize, long long* tStates);
@@ -0,0 +1,71 @@
+
+// Hrust 1.3 packer compiled into namespace Hrust1.
+// Every header the packer sources include must be included here first, outside
+// the namespace, so that #pragma once skips it inside.
+
+#include "packers.h"
+#include <vector>
+#include "../OptimalHrust1Packer/platform.h"
+#include "../OptimalHrust1Packer/progressReport.h"
+#include "../OptimalHrust1Packer/timing.h"
+#include <thread>
+#include <condition_variable>
+
+namespace Hrust1
+{
+#include "../OptimalHrust1Packer/compress.h"
+#include "../OptimalHrust1Packer/compress.cpp"
+}
+
+class Hrust1Packer : public Packer
+{
+	std::vector<unsigned char> output;
+	std::vector<PackedOps> ops;
+
+public:
+
+	virtual const char* GetName() { return "hrust1"; };
+
+	virtual int Pack(const unsigned char* input, int inputSize)
+	{
+		if (inputSize > Hrust1::MAX_INPUT_SIZE) return -1;
+
+		// fresh instance every time, so each run starts with cold memory like oh1c does,
+		// and nothing stays allocated between runs
+		Hrust1::Compressor* compressor = new Hrust1::Compressor();
+		memmove(compressor->Input, input, inputSize);
+		Hrust1::OpStats stats;
+		compressor->Stats = &stats;
+		compressor->InputSize = inputSize;
+		compressor->TryCompress();
+
+		ops.clear();
+		for (int k = 0; k < Hrust1::OP_KIND_COUNT; k++)
+		{
+			if (stats.Count[k] == 0 || k == Hrust1::OP_HEADER || k == Hrust1::OP_PADDING) continue;
+			PackedOps o = { Hrust1::OpKindNames[k], stats.Count[k], stats.MinCount[k], stats.MaxCount[k], stats.MinDist[k], stats.MaxDist[k] };
+			ops.push_back(o);
+		}
+
+		int result = -1;
+		output.clear();
+		if (compressor->Result == Hrust1::COMPRESS_RESULT::OK)
+		{
+			output.assign(compressor->Output, compressor->Output + compressor->OutputSize);
+			result = compressor->OutputSize;
+		}
+		delete compressor;
+		return result;
+	};
+
+	virtual const unsigned char* GetOutput() { return output.empty() ? NULL : &output[0]; };
+
+	virtual const std::vector<PackedOps>& GetOps() { return ops; };
+
+	virtual size_t GetFootprint() { return sizeof(Hrust1::Compressor); };
+};
+
+Packer* CreateHrust1Packer()
+{
+	return new Hrust1Packer();
+}
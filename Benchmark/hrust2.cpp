@@ -0,0 +1,67 @@
+
+// Hrust 2.1 packer compiled into namespace Hrust2.
+// Every header the packer sources include must be included here first, outside
+// the namespace, so that #pragma once skips it inside.
+// profile.cpp, progressReport.cpp and timing.cpp are identical in both packers and are linked once, from Hrust 1.
+
+#include "packers.h"
+#include <vector>
+#include "../OptimalHrust2Packer/platform.h"
+#include "../OptimalHrust2Packer/progressReport.h"
+#include "../OptimalHrust2Packer/timing.h"
+#include <thread>
+#include <condition_variable>
+
+namespace Hrust2
+{
+#include "../OptimalHrust2Packer/compress.h"
+#include "../OptimalHrust2Packer/compress.cpp"
+}
+
+class Hrust2Packer : public Packer
+{
+	std::vector<unsigned char> output;
+	std::vector<PackedOps> ops;
+
+public:
+
+	virtual const char* GetName() { return "hrust2"; };
+
+	virtual int Pack(const unsigned char* input, int inputSize)
+	{
+		if (inputSize > Hrust2::MAX_INPUT_SIZE) return -1;
+
+		// fresh instance every time, so each run starts with cold memory like oh2c does,
+		// and nothing stays allocated between runs
+		Hrust2::Compressor* compressor = new Hrust2::Compressor();
+		memmove(compressor->Input, input, inputSize);
+		Hrust2::OpStats stats;
+		compressor->Stats = &stats;
+		compressor->InputSize = inputSize;
+		compressor->CompressAuto();
+
+		ops.clear();
+		for (int k = 0; k < Hrust2::OP_KIND_COUNT; k++)
+		{
+			if (stats.Count[k] == 0 || k == Hrust2::OP_HEADER || k == Hrust2::OP_PADDING) continue;
+			PackedOps o = { Hrust2::OpKindNames[k], stats.Count[k], stats.MinCount[k], stats.MaxCount[k], stats.MinDist[k], stats.MaxDist[k] };
+			ops.push_back(o);
+		}
+
+		output.assign(compressor->Output, compressor->Output + compressor->OutputSize);
+		int result = compressor->OutputSize;
+		delete compressor;
+		return result;
+	};
+
+	virtual const unsigned char* GetOutput() { return output.empty() ? NULL : &output[0]; };
+
+	virtual const std::vector<PackedOps>& GetOps() { return ops; };
+
+	virtual size_t GetFootprint() { return sizeof(Hrust2::Compressor); };
+};
+
+Packer* CreateHrust2Packer()
+{
+	return new Hrust2Packer();
+}
@@ -0,0 +1,124 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "kernels.h"
+
+void ReportKernel(const char* format, const char* kernel, const char* param, int size, double secondsPerCall, long long opsPerCall,
+	long long bytesPerCall)
+{
+	double nsPerOp = secondsPerCall * 1e9 / opsPerCall;
+	printf("%-7s %-16s %-22s %6d  %12.1f %12.2f", format, kernel, param, size, secondsPerCall * 1e6, nsPerOp);
+	if (bytesPerCall > 0)
+		printf(" %10.1f", bytesPerCall / secondsPerCall / 1e6);
+	printf("\n");
+	fflush(stdout);
+}
+
+void PrintUsage()
+{
+	printf("Usage:\n");
+	printf("ohkernels [options]\n");
+	printf("  --format=hrust1|hrust2|all   packers to run (default all)\n");
+	printf("  --kernels=name,...           kernels to run (default all):\n");
+	printf("                               GetEncodedLen fill_matchLen solvePosition\n");
+	printf("                               Compress_Emit emitBit emitByte\n");
+	printf("                               Decompress StreamDecompress\n");
+	printf("  --sizes=n,...                input sizes in bytes (default 1024,4096,16384)\n");
+	printf("  --time=s                     minimal time per measurement (default 0.2)\n");
+	printf("  --window=n                   StreamDecompress window size (default 65536)\n");
+	printf("  --chunks=n,...               StreamDecompress chunk sizes (default 256)\n");
+	printf("\n");
+}
+
+static std::vector<std::string> splitList(const char* s)
+{
+	std::vector<std::string> list;
+	std::string item;
+	for (; ; s++)
+	{
+		if (*s == ',' || *s == 0)
+		{
+			if (!item.empty()) list.push_back(item);
+			item.clear();
+			if (*s == 0) break;
+		}
+		else
+			item += *s;
+	}
+	return list;
+}
+
+int main(int argc, const char* argv[])
+{
+	printf("\n");
+	printf("Optimal Hrust compressors: kernel microbenchmarks\n");
+	printf("\n");
+
+	KernelOptions options;
+	options.MinSeconds = 0.2;
+	options.WindowSize = 0x10000;
+	bool hrust1 = true, hrust2 = true;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strncmp(arg, "--format=", 9) == 0)
+		{
+			hrust1 = strcmp(arg + 9, "hrust2") != 0;
+			hrust2 = strcmp(arg + 9, "hrust1") != 0;
+		}
+		else if (strncmp(arg, "--kernels=", 10) == 0)
+			options.Kernels = splitList(arg + 10);
+		else if (strncmp(arg, "--sizes=", 8) == 0)
+		{
+			std::vector<std::string> list = splitList(arg + 8);
+			for (size_t k = 0; k < list.size(); k++) options.Sizes.push_back(atoi(list[k].c_str()));
+		}
+		else if (strncmp(arg, "--time=", 7) == 0)
+			options.MinSeconds = atof(arg + 7);
+		else if (strncmp(arg, "--window=", 9) == 0 && atoi(arg + 9) > 0)
+			options.WindowSize = atoi(arg + 9);
+		else if (strncmp(arg, "--chunks=", 9) == 0)
+		{
+			std::vector<std::string> list = splitList(arg + 9);
+			for (size_t k = 0; k < list.size(); k++)
+			{
+				int chunk = atoi(list[k].c_str());
+				if (chunk <= 0)
+				{
+					PrintUsage();
+					return 1;
+				}
+				options.ChunkSizes.push_back(chunk);
+			}
+		}
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (options.Sizes.empty())
+	{
+		options.Sizes.push_back(1024);
+		options.Sizes.push_back(4096);
+		options.Sizes.push_back(16384);
+	}
+	if (options.ChunkSizes.empty())
+		options.ChunkSizes.push_back(256);
+
+	printf("%-7s %-16s %-22s %6s  %12s %12s %10s\n", "format", "kernel", "input", "size", "us/call", "ns/op", "MB/s");
+
+	int failures = 0;
+	if (hrust1) failures += RunHrust1Kernels(options);
+	if (hrust2) failures += RunHrust2Kernels(options);
+
+	if (failures > 0)
+	{
+		printf("\n%d check(s) failed\n\n", failures);
+		return 2;
+	}
+	printf("\n");
+	return 0;
+}
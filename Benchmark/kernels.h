@@ -0,0 +1,56 @@
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the packers' hot loops (ohkernels).
+// KernelBench is a friend of OptimalCompressor and Compressor in both packers,
+// so kernels are timed on a real, fully preprocessed compressor state.
+
+struct KernelOptions
+{
+	std::vector<int> Sizes;          // input sizes
+	std::vector<std::string> Kernels; // empty means all
+	double MinSeconds;               // minimal time spent on each measurement
+	int WindowSize;                  // StreamDecompressor window
+	std::vector<int> ChunkSizes;     // StreamDecompressor::Read() sizes
+
+	bool IsSelected(const char* kernel) const
+	{
+		if (Kernels.empty()) return true;
+		for (size_t i = 0; i < Kernels.size(); i++)
+			if (Kernels[i] == kernel) return true;
+		return false;
+	};
+};
+
+// Calls body() repeatedly, at least once and until minSeconds is spent.
+// Returns seconds per call.
+template <typename F>
+double TimeKernel(F body, double minSeconds)
+{
+	typedef std::chrono::steady_clock Clock;
+	long long calls = 0;
+	Clock::time_point t0 = Clock::now();
+	std::chrono::duration<double> elapsed;
+	do
+	{
+		body();
+		calls++;
+		elapsed = Clock::now() - t0;
+	}
+	while (elapsed.count() < minSeconds);
+	return elapsed.count() / calls;
+}
+
+// Prints one result line. 'opsPerCall' converts time per call into time per op
+// (e.g. bits emitted), 'param' describes the input. Throughput in MB/s is shown
+// for kernels that produce data, 'bytesPerCall' bytes each call.
+void ReportKernel(const char* format, const char* kernel, const char* param, int size, double secondsPerCall, long long opsPerCall,
+	long long bytesPerCall = 0);
+
+// Return the number of failed checks (depacked data that differs from the input)
+int RunHrust1Kernels(const KernelOptions& options);
+int RunHrust2Kernels(const KernelOptions& options);
@@ -0,0 +1,230 @@
+
+// Hrust 1.3 kernels. The packer is compiled into namespace Hrust1 the same way
+// as in hrust1.cpp; see there for the include order requirements.
+
+#include <stdio.h>
+#include "kernels.h"
+#include "corpus.h"
+#include "../OptimalHrust1Packer/platform.h"
+#include "../OptimalHrust1Packer/progressReport.h"
+#include "../OptimalHrust1Packer/timing.h"
+#include <thread>
+#include <condition_variable>
+
+namespace Hrust1
+{
+#include "../OptimalHrust1Packer/compress.h"
+#include "../OptimalHrust1Packer/compress.cpp"
+#include "../OptimalHrust1Packer/decompress.h"
+#include "../OptimalHrust1Packer/decompress.cpp"
+
+class KernelBench
+{
+	Compressor* compressor;
+	const KernelOptions& options;
+	int failures;
+
+	const char* checkStream(StreamDecompressor& stream, const byte* packed, int packedSize, const std::vector<unsigned char>& data,
+		int chunkSize);
+
+public:
+	KernelBench(const KernelOptions& options) : options(options), failures(0)
+	{
+		compressor = new Compressor();
+	};
+
+	~KernelBench() { delete compressor; };
+
+	void RunGetEncodedLen();
+	void RunForInput(const char* kind, int size);
+
+	int GetFailures() const { return failures; };
+};
+}
+
+using namespace Hrust1;
+
+static volatile int sink; // keeps results of pure kernels alive
+
+// All kinds of backrefs the DP evaluates: RIR, count 1, 2 and long counts
+// with all distance classes and D values, from a fixed seed
+void KernelBench::RunGetEncodedLen()
+{
+	if (!options.IsSelected("GetEncodedLen")) return;
+
+	Random rnd(0xE1);
+	std::vector<Backref> refs(4096);
+	for (size_t i = 0; i < refs.size(); i++)
+	{
+		int kind = rnd.Next(8);
+		if (kind == 0)
+			refs[i] = Backref(true, 3, -1 - rnd.Next(79), 2);
+		else if (kind == 1)
+			refs[i] = Backref(false, 1, -1 - rnd.Next(8), 2);
+		else if (kind == 2)
+			refs[i] = Backref(false, 2, -1 - rnd.Next(768), 2);
+		else
+		{
+			int count = 3 + ((kind & 1) ? rnd.Next(13) : rnd.Next(0xEFF - 3));
+			refs[i] = Backref(false, count, -1 - rnd.Next(0xFFFF), 1 + rnd.Next(8));
+		}
+	}
+
+	double t = TimeKernel([&]() {
+		int sum = 0;
+		for (size_t i = 0; i < refs.size(); i++)
+			sum += refs[i].GetEncodedLen();
+		sink = sum;
+	}, options.MinSeconds);
+	ReportKernel("hrust1", "GetEncodedLen", "mixed", (int)refs.size(), t, (long long)refs.size());
+}
+
+// Unpacks 'packed' in 'chunkSize' pieces and compares them with 'data'.
+// Returns NULL when all of it comes out unchanged, or what went wrong.
+const char* KernelBench::checkStream(StreamDecompressor& stream, const byte* packed, int packedSize,
+	const std::vector<unsigned char>& data, int chunkSize)
+{
+	std::vector<byte> chunk(chunkSize);
+	if (stream.Start(packed, packedSize) != DECOMPRESSED_OK) return "bad header";
+	int pos = 0;
+	for (; ; )
+	{
+		int n = stream.Read(&chunk[0], chunkSize);
+		if (n > (int)data.size() - pos || memcmp(&chunk[0], &data[pos], n) != 0) return "output differs from input";
+		pos += n;
+		if (n < chunkSize) break;
+	}
+	if (stream.GetResult() == DECOMPRESS_WINDOW_TOO_SMALL) return "window too small";
+	if (stream.GetResult() != DECOMPRESSED_OK) return "corrupt stream";
+	if (pos != (int)data.size() || !stream.IsFinished()) return "output is short";
+	return NULL;
+}
+
+void KernelBench::RunForInput(const char* kind, int size)
+{
+	std::vector<unsigned char> data;
+	FindCorpusCase(kind)->Generate(data, size);
+	if (size < 7 || size > MAX_INPUT_SIZE) return;
+
+	// full preprocess once, so that DP tables hold a valid solution; backrefs stay
+	// within StreamDecompressor window
+	memmove(compressor->Input, &data[0], size);
+	compressor->InputSize = size;
+	compressor->Constraints.MaxDist = options.WindowSize < size ? options.WindowSize : 0;
+	compressor->Compress_Preprocess();
+
+	OptimalCompressor& oc = compressor->optimalCompressor;
+	int n = oc.inputSize;
+	int positions[3] = { n - n / 8, n / 2, n / 8 };
+	const char* positionNames[3] = { "end", "middle", "start" };
+
+	char param[64];
+	for (int k = 0; k < 3; k++)
+	{
+		int pos = positions[k] < 1 ? 1 : positions[k];
+		sprintf(param, "%s, pos %s", kind, positionNames[k]);
+
+		if (options.IsSelected("fill_matchLen"))
+		{
+			double t = TimeKernel([&]() { oc.fill_matchLen(pos, oc.matchLen); }, options.MinSeconds);
+			ReportKernel("hrust1", "fill_matchLen", param, size, t, 1);
+		}
+
+		// solving a position again gives the same result, so it can be repeated
+		if (options.IsSelected("solvePosition"))
+		{
+			double t = TimeKernel([&]() { oc.solvePosition(pos); }, options.MinSeconds);
+			ReportKernel("hrust1", "solvePosition", param, size, t, 1);
+		}
+	}
+
+	if (options.IsSelected("Compress_Emit"))
+	{
+		double t = TimeKernel([&]() { compressor->Compress_Emit(); }, options.MinSeconds);
+		ReportKernel("hrust1", "Compress_Emit", kind, size, t, compressor->OutputSize);
+	}
+
+	// raw bit flow: same bit pattern as data bits, no op decoding
+	if (options.IsSelected("emitBit"))
+	{
+		int bits = min(size * 8, 0x40000);
+		double t = TimeKernel([&]() {
+			compressor->outputPtr = compressor->Output;
+			compressor->controlBitsCnt = 0;
+			compressor->controlWordPtr = (WORD*)compressor->outputPtr;
+			compressor->outputPtr += 2;
+			for (int i = 0; i < bits; i++)
+				compressor->emitBit(data[i >> 3] >> (i & 7));
+		}, options.MinSeconds);
+		sprintf(param, "%s, per bit", kind);
+		ReportKernel("hrust1", "emitBit", param, size, t, bits);
+	}
+
+	if (options.IsSelected("emitByte"))
+	{
+		double t = TimeKernel([&]() {
+			compressor->outputPtr = compressor->Output;
+			for (int i = 0; i < size; i++)
+				compressor->emitByte(data[i]);
+		}, options.MinSeconds);
+		sprintf(param, "%s, per byte", kind);
+		ReportKernel("hrust1", "emitByte", param, size, t, size);
+	}
+
+	// depacking the emitted block, in one go and through a window in chunks as a tool
+	// feeding an emulator would do it; streamed output is checked against the input
+	if (options.IsSelected("Decompress") || options.IsSelected("StreamDecompress"))
+	{
+		compressor->Compress_Emit();
+		*(WORD*)&compressor->Output[4] = (WORD)compressor->OutputSize; // as TryCompress() does
+		const byte* packed = compressor->Output;
+		int packedSize = compressor->OutputSize;
+
+		if (options.IsSelected("Decompress"))
+		{
+			std::vector<byte> output(MAX_UNPACKED_SIZE);
+			Decompressor decompressor;
+			int outputSize;
+			double t = TimeKernel([&]() { decompressor.Decompress(packed, packedSize, &output[0], &outputSize); }, options.MinSeconds);
+			sprintf(param, "%s, per byte", kind);
+			ReportKernel("hrust1", "Decompress", param, size, t, size, size);
+		}
+
+		if (options.IsSelected("StreamDecompress"))
+		{
+			std::vector<byte> window(options.WindowSize);
+			StreamDecompressor stream(&window[0], (int)window.size());
+			for (size_t c = 0; c < options.ChunkSizes.size(); c++)
+			{
+				int chunkSize = options.ChunkSizes[c];
+				sprintf(param, "%s, %d-byte chunks", kind, chunkSize);
+				const char* error = checkStream(stream, packed, packedSize, data, chunkSize);
+				if (error)
+				{
+					printf("%-7s %-16s %-22s %6d  %s\n", "hrust1", "StreamDecompress", param, size, error);
+					failures++;
+					continue;
+				}
+
+				std::vector<byte> chunk(chunkSize);
+				double t = TimeKernel([&]() {
+					stream.Start(packed, packedSize);
+					while (stream.Read(&chunk[0], chunkSize) == chunkSize) {}
+				}, options.MinSeconds);
+				ReportKernel("hrust1", "StreamDecompress", param, size, t, size, size);
+			}
+		}
+	}
+}
+
+int RunHrust1Kernels(const KernelOptions& options)
+{
+	KernelBench bench(options);
+	bench.RunGetEncodedLen();
+	for (size_t i = 0; i < options.Sizes.size(); i++)
+	{
+		bench.RunForInput("text", options.Sizes[i]);
+		bench.RunForInput("zero", options.Sizes[i]);
+	}
+	return bench.GetFailures();
+}
@@ -0,0 +1,289 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "packers.h"
+#include "corpus.h"
+#include "report.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+////////////////////////////////////////////////////////////
+///////////          Peak memory            ////////////////
+////////////////////////////////////////////////////////////
+
+// Returns freed heap to the OS, so that the next run's peak doesn't include
+// memory retained by the allocator after the previous one.
+static void trimHeap()
+{
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
+
+// Resets peak resident memory counter, if the OS allows it.
+// Returns false if peak can only grow (then results show process-wide peak).
+static bool resetPeakMemory()
+{
+#ifdef __linux__
+	FILE* f = fopen("/proc/self/clear_refs", "w");
+	if (!f) return false;
+	bool ok = fputs("5", f) >= 0;
+	return (fclose(f) == 0) && ok;
+#else
+	return false;
+#endif
+}
+
+static long long getPeakMemoryKB()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return (long long)(pmc.PeakWorkingSetSize / 1024);
+#elif defined(__linux__)
+	// VmHWM honours clear_refs reset, ru_maxrss doesn't
+	FILE* f = fopen("/proc/self/status", "r");
+	if (f)
+	{
+		char line[256];
+		long long kb = -1;
+		while (fgets(line, sizeof(line), f))
+			if (strncmp(line, "VmHWM:", 6) == 0) kb = atoll(line + 6);
+		fclose(f);
+		if (kb >= 0) return kb;
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+#else
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss / 1024; // bytes on macOS
+#endif
+}
+
+////////////////////////////////////////////////////////////
+///////////             Main                ////////////////
+////////////////////////////////////////////////////////////
+
+void PrintUsage()
+{
+	printf("Usage:\n");
+	printf("ohbench [options]\n");
+	printf("  --format=hrust1|hrust2|all   packers to run (default all)\n");
+	printf("  --cases=name,...             corpus cases (default all):\n");
+	printf("                              ");
+	for (const CorpusCase* c = GetCorpusCases(); c->Name; c++) printf(" %s", c->Name);
+	printf("\n");
+	printf("  --sizes=n,...                input sizes in bytes (default 1024,4096)\n");
+	printf("  --repeat=n                   runs per case, best time is taken (default 1)\n");
+	printf("  --json=file                  write results as JSON\n");
+	printf("  --baseline=file              compare with results saved by --json\n");
+	printf("  --tolerance=x                allowed throughput drop vs baseline (default 0.10)\n");
+	printf("\n");
+}
+
+static bool hasOption(const char* arg, const char* name, const char** value)
+{
+	size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+	*value = arg + len + 1;
+	return true;
+}
+
+static bool inList(const std::vector<std::string>& list, const char* s)
+{
+	if (list.empty()) return true;
+	for (size_t i = 0; i < list.size(); i++)
+		if (list[i] == s) return true;
+	return false;
+}
+
+static std::vector<std::string> splitList(const char* s)
+{
+	std::vector<std::string> list;
+	std::string item;
+	for (; ; s++)
+	{
+		if (*s == ',' || *s == 0)
+		{
+			if (!item.empty()) list.push_back(item);
+			item.clear();
+			if (*s == 0) break;
+		}
+		else
+			item += *s;
+	}
+	return list;
+}
+
+int main(int argc, const char* argv[])
+{
+	printf("\n");
+	printf("Optimal Hrust compressors benchmark\n");
+	printf("\n");
+
+	std::vector<std::string> formats, cases;
+	std::vector<int> sizes;
+	int repeat = 1;
+	const char* jsonPath = NULL;
+	const char* baselinePath = NULL;
+	double tolerance = 0.10;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* value;
+		if (hasOption(argv[i], "--format", &value))
+		{
+			if (strcmp(value, "all") != 0) formats = splitList(value);
+		}
+		else if (hasOption(argv[i], "--cases", &value))
+			cases = splitList(value);
+		else if (hasOption(argv[i], "--sizes", &value))
+		{
+			std::vector<std::string> list = splitList(value);
+			for (size_t k = 0; k < list.size(); k++) sizes.push_back(atoi(list[k].c_str()));
+		}
+		else if (hasOption(argv[i], "--repeat", &value))
+			repeat = atoi(value);
+		else if (hasOption(argv[i], "--json", &value))
+			jsonPath = value;
+		else if (hasOption(argv[i], "--baseline", &value))
+			baselinePath = value;
+		else if (hasOption(argv[i], "--tolerance", &value))
+			tolerance = atof(value);
+		else
+		{
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (sizes.empty())
+	{
+		sizes.push_back(1024);
+		sizes.push_back(4096);
+	}
+	if (repeat < 1) repeat = 1;
+
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		if (!FindCorpusCase(cases[i].c_str()))
+		{
+			printf("Unknown corpus case: %s\n", cases[i].c_str());
+			return 1;
+		}
+	}
+
+	std::vector<Packer*> packers;
+	packers.push_back(CreateHrust1Packer());
+	packers.push_back(CreateHrust2Packer());
+
+	// Packers release all memory after each run, so with resettable peak
+	// every result shows resident memory of just that run (plus the process itself)
+	bool peakResettable = resetPeakMemory();
+	if (!peakResettable)
+		printf("note: peak memory is process-wide on this OS\n\n");
+
+	printf("%-7s %-7s %6s  %8s %7s  %9s %9s %10s %9s\n",
+		"format", "case", "size", "packed", "ratio", "wall, s", "cpu, s", "KB/s", "peak, KB");
+
+	std::vector<BenchResult> results;
+	std::vector<unsigned char> data;
+	for (size_t p = 0; p < packers.size(); p++)
+	{
+		Packer* packer = packers[p];
+		if (!inList(formats, packer->GetName())) continue;
+
+		for (const CorpusCase* c = GetCorpusCases(); c->Name; c++)
+		{
+			if (!inList(cases, c->Name)) continue;
+
+			for (size_t s = 0; s < sizes.size(); s++)
+			{
+				if (c->FixedSize && s > 0) break;
+				c->Generate(data, sizes[s]);
+
+				BenchResult r;
+				r.Format = packer->GetName();
+				r.Case = c->Name;
+				r.Size = (int)data.size();
+				for (int k = 0; k < repeat; k++)
+				{
+					trimHeap();
+					resetPeakMemory();
+					clock_t c0 = clock();
+					std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+					r.PackedSize = packer->Pack(&data[0], (int)data.size());
+					std::chrono::duration<double> wall = std::chrono::steady_clock::now() - t0;
+					double cpu = (double)(clock() - c0) / CLOCKS_PER_SEC;
+					if (k == 0 || wall.count() < r.Seconds)
+					{
+						r.Seconds = wall.count();
+						r.CpuSeconds = cpu;
+					}
+					long long peak = getPeakMemoryKB();
+					if (peak > r.PeakMemoryKB) r.PeakMemoryKB = peak;
+				}
+
+				printf("%-7s %-7s %6d  %8d %7.3f  %9.4f %9.4f %10.1f %9lld\n",
+					r.Format.c_str(), r.Case.c_str(), r.Size, r.PackedSize, r.GetRatio(),
+					r.Seconds, r.CpuSeconds, r.GetThroughput(), r.PeakMemoryKB);
+				fflush(stdout);
+				results.push_back(r);
+			}
+		}
+	}
+
+	for (size_t p = 0; p < packers.size(); p++)
+		delete packers[p];
+
+	int result = 0;
+
+	if (jsonPath)
+	{
+		if (!SaveResults(jsonPath, results))
+		{
+			printf("Error writing %s\n", jsonPath);
+			result = 5;
+		}
+	}
+
+	if (baselinePath)
+	{
+		std::vector<BenchResult> baseline;
+		if (!LoadResults(baselinePath, baseline))
+		{
+			printf("Error reading baseline %s\n", baselinePath);
+			result = 5;
+		}
+		else
+		{
+			int regressions = CompareWithBaseline(results, baseline, tolerance);
+			if (regressions > 0)
+			{
+				printf("\n%d regression(s) against baseline\n", regressions);
+				result = 2;
+			}
+			else
+			{
+				printf("\nNo regressions\n");
+			}
+		}
+	}
+
+	printf("\n");
+	return result;
+}
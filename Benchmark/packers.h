@@ -0,0 +1,43 @@
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// Ops of one kind in a packed stream, from OpStats of the packer
+struct PackedOps
+{
+	const char* Kind; // OpKindNames entry of the packer
+	int Count;
+	int MinCount, MaxCount; // bytes produced by one op
+	int MinDist, MaxDist;   // positive, 0 for literals
+};
+
+// Common interface to both packers.
+// Hrust 1 and Hrust 2 sources define classes with the same names, so each
+// packer is compiled into its own namespace (see hrust1.cpp, hrust2.cpp)
+// and is only reachable through this interface.
+class Packer
+{
+public:
+	virtual ~Packer() {};
+
+	virtual const char* GetName() = 0;
+
+	// Packs input exactly as the command line packer would.
+	// Returns packed size in bytes, or -1 if input can't be packed by this format.
+	virtual int Pack(const unsigned char* input, int inputSize) = 0;
+
+	// Result of the last Pack() call
+	virtual const unsigned char* GetOutput() = 0;
+
+	// Kinds of ops in the result of the last Pack() call, those with none left out.
+	// Empty if it is a stored block.
+	virtual const std::vector<PackedOps>& GetOps() = 0;
+
+	// Working memory used by one compression, bytes
+	virtual size_t GetFootprint() = 0;
+};
+
+Packer* CreateHrust1Packer();
+Packer* CreateHrust2Packer();
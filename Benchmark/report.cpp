@@ -0,0 +1,145 @@
+
+#include "report.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool SaveResults(const char* path, const std::vector<BenchResult>& results)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+
+	fprintf(f, "{\n  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		fprintf(f,
+			"    {\"format\": \"%s\", \"case\": \"%s\", \"size\": %d, \"packed\": %d, \"ratio\": %.4f, "
+			"\"seconds\": %.6f, \"cpu_seconds\": %.6f, \"throughput_kb_s\": %.3f, \"peak_memory_kb\": %lld}%s\n",
+			r.Format.c_str(), r.Case.c_str(), r.Size, r.PackedSize, r.GetRatio(),
+			r.Seconds, r.CpuSeconds, r.GetThroughput(), r.PeakMemoryKB,
+			(i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+
+	bool ok = (ferror(f) == 0);
+	fclose(f);
+	return ok;
+}
+
+// Minimal reader for the format written above: every flat {...} object
+// after "results" is one result; unknown keys are ignored.
+static void parseResultObject(const char* p, const char* end, BenchResult& r)
+{
+	while (p < end)
+	{
+		const char* keyStart = strchr(p, '"');
+		if (!keyStart || keyStart >= end) break;
+		keyStart++;
+		const char* keyEnd = strchr(keyStart, '"');
+		if (!keyEnd || keyEnd >= end) break;
+		std::string key(keyStart, keyEnd);
+
+		p = keyEnd + 1;
+		while (p < end && (*p == ':' || *p == ' ' || *p == '\t')) p++;
+		if (p >= end) break;
+
+		std::string value;
+		if (*p == '"')
+		{
+			const char* valueEnd = strchr(p + 1, '"');
+			if (!valueEnd || valueEnd >= end) break;
+			value.assign(p + 1, valueEnd);
+			p = valueEnd + 1;
+		}
+		else
+		{
+			const char* valueEnd = p;
+			while (valueEnd < end && *valueEnd != ',' && *valueEnd != '}') valueEnd++;
+			value.assign(p, valueEnd);
+			p = valueEnd;
+		}
+
+		if (key == "format") r.Format = value;
+		else if (key == "case") r.Case = value;
+		else if (key == "size") r.Size = atoi(value.c_str());
+		else if (key == "packed") r.PackedSize = atoi(value.c_str());
+		else if (key == "seconds") r.Seconds = atof(value.c_str());
+		else if (key == "cpu_seconds") r.CpuSeconds = atof(value.c_str());
+		else if (key == "peak_memory_kb") r.PeakMemoryKB = atoll(value.c_str());
+	}
+}
+
+bool LoadResults(const char* path, std::vector<BenchResult>& results)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	std::string text;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, n);
+	fclose(f);
+
+	const char* p = strstr(text.c_str(), "\"results\"");
+	if (!p) return false;
+	p = strchr(p, '[');
+	if (!p) return false;
+
+	while ((p = strchr(p, '{')) != NULL)
+	{
+		const char* end = strchr(p, '}');
+		if (!end) return false;
+		BenchResult r;
+		parseResultObject(p + 1, end, r);
+		results.push_back(r);
+		p = end + 1;
+	}
+	return true;
+}
+
+static const BenchResult* findResult(const std::vector<BenchResult>& list, const BenchResult& r)
+{
+	for (size_t i = 0; i < list.size(); i++)
+		if (list[i].Format == r.Format && list[i].Case == r.Case && list[i].Size == r.Size)
+			return &list[i];
+	return NULL;
+}
+
+int CompareWithBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline, double tolerance)
+{
+	int regressions = 0;
+
+	printf("\n%-7s %-7s %6s  %8s %8s  %10s %10s %7s\n",
+		"format", "case", "size", "packed", "base", "KB/s", "base KB/s", "change");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		const BenchResult* b = findResult(baseline, r);
+		if (!b)
+		{
+			printf("%-7s %-7s %6d  %8d %8s  %10.1f %10s %7s\n",
+				r.Format.c_str(), r.Case.c_str(), r.Size, r.PackedSize, "-", r.GetThroughput(), "-", "new");
+			continue;
+		}
+
+		double change = (b->GetThroughput() > 0) ? r.GetThroughput() / b->GetThroughput() - 1 : 0;
+		const char* verdict = "";
+		if (r.PackedSize != b->PackedSize)
+		{
+			verdict = "  SIZE CHANGED";
+			regressions++;
+		}
+		else if (change < -tolerance)
+		{
+			verdict = "  SLOWER";
+			regressions++;
+		}
+
+		printf("%-7s %-7s %6d  %8d %8d  %10.1f %10.1f %+6.1f%%%s\n",
+			r.Format.c_str(), r.Case.c_str(), r.Size, r.PackedSize, b->PackedSize,
+			r.GetThroughput(), b->GetThroughput(), change * 100, verdict);
+	}
+
+	return regressions;
+}
@@ -0,0 +1,30 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct BenchResult
+{
+	std::string Format;     // "hrust1", "hrust2"
+	std::string Case;       // corpus case name
+	int Size;               // input size, bytes
+	int PackedSize;         // -1 if format can't pack this input
+	double Seconds;         // best wall time of all repeats
+	double CpuSeconds;      // CPU time of the same run
+	long long PeakMemoryKB; // peak resident memory during compression, 0 if unknown
+
+	BenchResult() : Size(0), PackedSize(0), Seconds(0), CpuSeconds(0), PeakMemoryKB(0) {};
+
+	double GetRatio() const { return Size ? (double)PackedSize / Size : 0; };
+	double GetThroughput() const { return Seconds > 0 ? Size / 1024.0 / Seconds : 0; }; // KB/s
+};
+
+// Results are stored as {"results": [{...}, ...]} with one flat object per result
+bool SaveResults(const char* path, const std::vector<BenchResult>& results);
+bool LoadResults(const char* path, std::vector<BenchResult>& results);
+
+// Prints comparison table and returns number of regressions.
+// Any packed size change is a regression (the packers are optimal, so size must be stable);
+// throughput is a regression if it dropped by more than 'tolerance' (0.1 = 10%).
+int CompareWithBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline, double tolerance);
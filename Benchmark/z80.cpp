@@ -0,0 +1,606 @@
+
+#include <string.h>
+#include "z80.h"
+
+#define FLAG_C  0x01
+#define FLAG_N  0x02
+#define FLAG_PV 0x04
+#define FLAG_H  0x10
+#define FLAG_Z  0x40
+#define FLAG_S  0x80
+
+static byte flagsSZ(byte v)
+{
+	return (v & FLAG_S) | (v == 0 ? FLAG_Z : 0);
+}
+
+static byte flagsSZP(byte v)
+{
+	int bits = v;
+	bits ^= bits >> 4;
+	bits ^= bits >> 2;
+	bits ^= bits >> 1;
+	return flagsSZ(v) | ((bits & 1) ? 0 : FLAG_PV);
+}
+
+Z80::Z80()
+{
+	memset(this, 0, sizeof(*this));
+	inStart = inEnd = outStart = outEnd = -1;
+}
+
+void Z80::WatchStreams(int inStart, int inSize, int outStart, int outSize)
+{
+	this->inStart = inStart;
+	this->inEnd = inStart + inSize;
+	this->outStart = outStart;
+	this->outEnd = outStart + outSize;
+	inFrontier = inStart;
+	PeakOverlap = 0;
+}
+
+inline byte Z80::read(WORD addr)
+{
+	if (addr >= inFrontier && addr < inEnd)
+		inFrontier = addr + 1;
+	return Memory[addr];
+}
+
+inline void Z80::write(WORD addr, byte value)
+{
+	if (addr >= outStart && addr < outEnd)
+	{
+		int overlap = (addr + 1 - outStart) - (inFrontier - inStart);
+		if (overlap > PeakOverlap) PeakOverlap = overlap;
+	}
+	Memory[addr] = value;
+}
+
+inline byte Z80::fetch()
+{
+	return Memory[PC++];
+}
+
+inline WORD Z80::fetchWord()
+{
+	WORD lo = fetch();
+	return WORD(lo | fetch() << 8);
+}
+
+inline byte& Z80::reg(int r)
+{
+	switch (r)
+	{
+	case 0: return B;
+	case 1: return C;
+	case 2: return D;
+	case 3: return E;
+	case 4: return H;
+	case 5: return L;
+	default: return A;
+	}
+}
+
+inline byte Z80::getR(int r)
+{
+	return (r == 6) ? read(getHL()) : reg(r);
+}
+
+inline void Z80::setR(int r, byte value)
+{
+	if (r == 6)
+		write(getHL(), value);
+	else
+		reg(r) = value;
+}
+
+inline WORD Z80::getRP(int p)
+{
+	switch (p)
+	{
+	case 0: return WORD(B << 8 | C);
+	case 1: return WORD(D << 8 | E);
+	case 2: return WORD(H << 8 | L);
+	default: return SP;
+	}
+}
+
+inline void Z80::setRP(int p, WORD value)
+{
+	switch (p)
+	{
+	case 0: B = byte(value >> 8); C = byte(value); break;
+	case 1: D = byte(value >> 8); E = byte(value); break;
+	case 2: H = byte(value >> 8); L = byte(value); break;
+	default: SP = value; break;
+	}
+}
+
+inline bool Z80::condition(int cc)
+{
+	static const byte masks[4] = { FLAG_Z, FLAG_C, FLAG_PV, FLAG_S };
+	bool set = (F & masks[cc >> 1]) != 0;
+	return (cc & 1) ? set : !set;
+}
+
+inline void Z80::push(WORD value)
+{
+	write(--SP, byte(value >> 8));
+	write(--SP, byte(value));
+}
+
+inline WORD Z80::pop()
+{
+	WORD lo = read(SP++);
+	return WORD(lo | read(SP++) << 8);
+}
+
+// ADD ADC SUB SBC AND XOR OR CP
+void Z80::alu(int op, byte value)
+{
+	int carry = (op == 1 || op == 3) ? (F & FLAG_C) : 0;
+	int r;
+	switch (op)
+	{
+	case 0:
+	case 1:
+		r = A + value + carry;
+		F = flagsSZ(byte(r)) | ((A ^ value ^ r) & FLAG_H) |
+			(((A ^ ~value) & (A ^ r) & 0x80) ? FLAG_PV : 0) | ((r & 0x100) ? FLAG_C : 0);
+		A = byte(r);
+		break;
+	case 2:
+	case 3:
+	case 7:
+		r = A - value - carry;
+		F = flagsSZ(byte(r)) | ((A ^ value ^ r) & FLAG_H) | FLAG_N |
+			(((A ^ value) & (A ^ r) & 0x80) ? FLAG_PV : 0) | ((r & 0x100) ? FLAG_C : 0);
+		if (op != 7) A = byte(r);
+		break;
+	case 4:
+		A &= value;
+		F = flagsSZP(A) | FLAG_H;
+		break;
+	case 5:
+		A ^= value;
+		F = flagsSZP(A);
+		break;
+	case 6:
+		A |= value;
+		F = flagsSZP(A);
+		break;
+	}
+}
+
+byte Z80::inc8(byte value)
+{
+	byte r = byte(value + 1);
+	F = (F & FLAG_C) | flagsSZ(r) | ((r & 0x0F) == 0 ? FLAG_H : 0) | (r == 0x80 ? FLAG_PV : 0);
+	return r;
+}
+
+byte Z80::dec8(byte value)
+{
+	byte r = byte(value - 1);
+	F = (F & FLAG_C) | flagsSZ(r) | FLAG_N | ((r & 0x0F) == 0x0F ? FLAG_H : 0) | (r == 0x7F ? FLAG_PV : 0);
+	return r;
+}
+
+// RLC RRC RL RR SLA SRA SLL SRL
+byte Z80::rotate(int op, byte value)
+{
+	int carry;
+	byte r;
+	switch (op)
+	{
+	case 0: carry = value >> 7; r = byte(value << 1 | carry); break;
+	case 1: carry = value & 1; r = byte(value >> 1 | carry << 7); break;
+	case 2: carry = value >> 7; r = byte(value << 1 | (F & FLAG_C)); break;
+	case 3: carry = value & 1; r = byte(value >> 1 | (F & FLAG_C) << 7); break;
+	case 4: carry = value >> 7; r = byte(value << 1); break;
+	case 5: carry = value & 1; r = byte((value >> 1) | (value & 0x80)); break;
+	case 6: carry = value >> 7; r = byte(value << 1 | 1); break;
+	default: carry = value & 1; r = byte(value >> 1); break;
+	}
+	F = flagsSZP(r) | (carry ? FLAG_C : 0);
+	return r;
+}
+
+void Z80::executeCB()
+{
+	byte op = fetch();
+	int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+	byte v = getR(z);
+	if (x == 0)
+	{
+		setR(z, rotate(y, v));
+		TStates += (z == 6) ? 15 : 8;
+	}
+	else if (x == 1)
+	{
+		// BIT
+		bool zero = (v & (1 << y)) == 0;
+		F = (F & FLAG_C) | FLAG_H | (zero ? FLAG_Z | FLAG_PV : 0) | ((y == 7 && !zero) ? FLAG_S : 0);
+		TStates += (z == 6) ? 12 : 8;
+	}
+	else
+	{
+		// RES, SET
+		setR(z, (x == 2) ? byte(v & ~(1 << y)) : byte(v | (1 << y)));
+		TStates += (z == 6) ? 15 : 8;
+	}
+}
+
+bool Z80::executeED()
+{
+	byte op = fetch();
+	int y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+	if (op >= 0x40 && op < 0x80)
+	{
+		if (z == 2)
+		{
+			// SBC HL,rp / ADC HL,rp
+			int hl = getHL(), v = getRP(p), carry = F & FLAG_C;
+			int r = q ? hl + v + carry : hl - v - carry;
+			bool overflow = q ? (((hl ^ ~v) & (hl ^ r) & 0x8000) != 0) : (((hl ^ v) & (hl ^ r) & 0x8000) != 0);
+			F = (byte(r >> 8) & FLAG_S) | ((r & 0xFFFF) == 0 ? FLAG_Z : 0) | (((hl ^ v ^ r) >> 8) & FLAG_H) |
+				(overflow ? FLAG_PV : 0) | (q ? 0 : FLAG_N) | ((r & 0x10000) ? FLAG_C : 0);
+			setRP(2, WORD(r));
+			TStates += 15;
+			return true;
+		}
+		if (z == 3)
+		{
+			// LD (nn),rp / LD rp,(nn)
+			WORD addr = fetchWord();
+			if (q)
+				setRP(p, WORD(read(addr) | read(WORD(addr + 1)) << 8));
+			else
+			{
+				WORD v = getRP(p);
+				write(addr, byte(v));
+				write(WORD(addr + 1), byte(v >> 8));
+			}
+			TStates += 20;
+			return true;
+		}
+		if (z == 4)
+		{
+			// NEG
+			byte v = A;
+			A = 0;
+			alu(2, v);
+			TStates += 8;
+			return true;
+		}
+		return false;
+	}
+
+	// LDI LDD LDIR LDDR
+	if (op == 0xA0 || op == 0xA8 || op == 0xB0 || op == 0xB8)
+	{
+		int step = (op & 0x08) ? -1 : 1;
+		WORD hl = getHL(), de = getRP(1), bc = WORD(getRP(0) - 1);
+		write(de, read(hl));
+		setRP(2, WORD(hl + step));
+		setRP(1, WORD(de + step));
+		setRP(0, bc);
+		F = (F & (FLAG_S | FLAG_Z | FLAG_C)) | (bc != 0 ? FLAG_PV : 0);
+		if ((op & 0x10) && bc != 0)
+		{
+			PC -= 2; // repeat
+			TStates += 21;
+		}
+		else
+			TStates += 16;
+		return true;
+	}
+	return false;
+}
+
+bool Z80::Run(long long maxTStates)
+{
+	Error = NULL;
+	Halted = false;
+	while (!Halted)
+	{
+		if (TStates > maxTStates)
+		{
+			Error = "time limit exceeded";
+			return false;
+		}
+
+		byte op = fetch();
+		int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+		if (x == 1)
+		{
+			if (op == 0x76)
+			{
+				Halted = true;
+				TStates += 4;
+			}
+			else
+			{
+				setR(y, getR(z));
+				TStates += (y == 6 || z == 6) ? 7 : 4;
+			}
+			continue;
+		}
+		if (x == 2)
+		{
+			alu(y, getR(z));
+			TStates += (z == 6) ? 7 : 4;
+			continue;
+		}
+
+		if (x == 0)
+		{
+			switch (z)
+			{
+			case 0:
+				if (y == 0)
+				{
+					TStates += 4; // NOP
+				}
+				else if (y == 1)
+				{
+					byte t;
+					t = A; A = A_; A_ = t;
+					t = F; F = F_; F_ = t;
+					TStates += 4;
+				}
+				else
+				{
+					signed char d = (signed char)fetch();
+					bool jump;
+					if (y == 2)
+					{
+						B--;
+						jump = (B != 0);
+						TStates += jump ? 13 : 8;
+					}
+					else
+					{
+						jump = (y == 3) || condition(y - 4);
+						TStates += jump ? 12 : 7;
+					}
+					if (jump) PC = WORD(PC + d);
+				}
+				break;
+			case 1:
+				if (q == 0)
+				{
+					setRP(p, fetchWord());
+					TStates += 10;
+				}
+				else
+				{
+					int hl = getHL(), v = getRP(p), r = hl + v;
+					F = (F & (FLAG_S | FLAG_Z | FLAG_PV)) | (((hl ^ v ^ r) >> 8) & FLAG_H) | ((r & 0x10000) ? FLAG_C : 0);
+					setRP(2, WORD(r));
+					TStates += 11;
+				}
+				break;
+			case 2:
+				if (p < 2)
+				{
+					WORD addr = getRP(p);
+					if (q) A = read(addr); else write(addr, A);
+					TStates += 7;
+				}
+				else
+				{
+					WORD addr = fetchWord();
+					if (p == 2)
+					{
+						if (q)
+						{
+							L = read(addr);
+							H = read(WORD(addr + 1));
+						}
+						else
+						{
+							write(addr, L);
+							write(WORD(addr + 1), H);
+						}
+						TStates += 16;
+					}
+					else
+					{
+						if (q) A = read(addr); else write(addr, A);
+						TStates += 13;
+					}
+				}
+				break;
+			case 3:
+				setRP(p, WORD(getRP(p) + (q ? -1 : 1)));
+				TStates += 6;
+				break;
+			case 4:
+				setR(y, inc8(getR(y)));
+				TStates += (y == 6) ? 11 : 4;
+				break;
+			case 5:
+				setR(y, dec8(getR(y)));
+				TStates += (y == 6) ? 11 : 4;
+				break;
+			case 6:
+				setR(y, fetch());
+				TStates += (y == 6) ? 10 : 7;
+				break;
+			case 7:
+				if (y < 4)
+				{
+					// RLCA RRCA RLA RRA
+					byte keep = F & (FLAG_S | FLAG_Z | FLAG_PV);
+					A = rotate(y, A);
+					F = keep | (F & FLAG_C);
+				}
+				else if (y == 5)
+				{
+					A = byte(~A);
+					F |= FLAG_H | FLAG_N;
+				}
+				else if (y == 6)
+				{
+					F = (F & (FLAG_S | FLAG_Z | FLAG_PV)) | FLAG_C;
+				}
+				else if (y == 7)
+				{
+					F = (F & (FLAG_S | FLAG_Z | FLAG_PV)) | ((F & FLAG_C) ? FLAG_H : FLAG_C);
+				}
+				else
+				{
+					Error = "DAA is not supported";
+					return false;
+				}
+				TStates += 4;
+				break;
+			}
+			continue;
+		}
+
+		// x == 3
+		switch (z)
+		{
+		case 0:
+			if (condition(y))
+			{
+				PC = pop();
+				TStates += 11;
+			}
+			else
+				TStates += 5;
+			break;
+		case 1:
+			if (q == 0)
+			{
+				WORD v = pop();
+				if (p == 3) { A = byte(v >> 8); F = byte(v); }
+				else setRP(p, v);
+				TStates += 10;
+			}
+			else if (p == 0)
+			{
+				PC = pop();
+				TStates += 10;
+			}
+			else if (p == 1)
+			{
+				byte t;
+				t = B; B = B_; B_ = t;
+				t = C; C = C_; C_ = t;
+				t = D; D = D_; D_ = t;
+				t = E; E = E_; E_ = t;
+				t = H; H = H_; H_ = t;
+				t = L; L = L_; L_ = t;
+				TStates += 4;
+			}
+			else if (p == 2)
+			{
+				PC = getHL();
+				TStates += 4;
+			}
+			else
+			{
+				SP = getHL();
+				TStates += 6;
+			}
+			break;
+		case 2:
+		{
+			WORD addr = fetchWord();
+			if (condition(y)) PC = addr;
+			TStates += 10;
+			break;
+		}
+		case 3:
+			if (y == 0)
+			{
+				PC = fetchWord();
+				TStates += 10;
+			}
+			else if (y == 1)
+			{
+				executeCB();
+			}
+			else if (y == 4)
+			{
+				byte lo = read(SP), hi = read(WORD(SP + 1));
+				write(SP, L);
+				write(WORD(SP + 1), H);
+				L = lo;
+				H = hi;
+				TStates += 19;
+			}
+			else if (y == 5)
+			{
+				byte t;
+				t = D; D = H; H = t;
+				t = E; E = L; L = t;
+				TStates += 4;
+			}
+			else if (y >= 6)
+			{
+				TStates += 4; // DI, EI
+			}
+			else
+			{
+				Error = "I/O instructions are not supported";
+				return false;
+			}
+			break;
+		case 4:
+		{
+			WORD addr = fetchWord();
+			if (condition(y))
+			{
+				push(PC);
+				PC = addr;
+				TStates += 17;
+			}
+			else
+				TStates += 10;
+			break;
+		}
+		case 5:
+			if (q == 0)
+			{
+				push((p == 3) ? WORD(A << 8 | F) : getRP(p));
+				TStates += 11;
+			}
+			else if (p == 0)
+			{
+				WORD addr = fetchWord();
+				push(PC);
+				PC = addr;
+				TStates += 17;
+			}
+			else if (p == 2)
+			{
+				if (!executeED())
+				{
+					Error = "unsupported ED instruction";
+					return false;
+				}
+			}
+			else
+			{
+				Error = "IX/IY instructions are not supported";
+				return false;
+			}
+			break;
+		case 6:
+			alu(y, fetch());
+			TStates += 7;
+			break;
+		case 7:
+			push(PC);
+			PC = WORD(y * 8);
+			TStates += 11;
+			break;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,61 @@
+
+#pragma once
+
+// Z80 core for timing depacker routines: unprefixed, CB and ED instructions with
+// exact T-states of uncontended memory. IX/IY (DD/FD), interrupts and I/O are not
+// emulated; a routine using them stops with an error.
+
+#include "../OptimalHrust1Packer/platform.h"
+
+class Z80
+{
+public:
+
+	byte Memory[0x10000];
+
+	byte A, F, B, C, D, E, H, L;
+	byte A_, F_, B_, C_, D_, E_, H_, L_; // alternate set
+	WORD SP, PC;
+
+	long long TStates;
+	bool Halted;
+	const char* Error; // why Run() stopped early, NULL if it didn't
+
+	// Stream pointers overlap. Reads from [inStart, inStart + inSize) move the input
+	// frontier (highest address read + 1); every write to [outStart, outStart + outSize)
+	// measures how far output is ahead of input, both counted from their starts.
+	int PeakOverlap;
+
+	Z80();
+	void WatchStreams(int inStart, int inSize, int outStart, int outSize);
+
+	// Executes until HALT. Returns false on unsupported opcode or when TStates exceeds 'maxTStates'.
+	bool Run(long long maxTStates);
+
+private:
+
+	int inStart, inEnd, outStart, outEnd;
+	int inFrontier;
+
+	byte read(WORD addr);
+	void write(WORD addr, byte value);
+	byte fetch();
+	WORD fetchWord();
+
+	byte& reg(int r);    // B C D E H L - A by 3-bit code; 6 is (HL), handled by getR/setR
+	byte getR(int r);
+	void setR(int r, byte value);
+	WORD getRP(int p);   // BC DE HL SP
+	void setRP(int p, WORD value);
+	WORD getHL() { return WORD(H << 8 | L); }
+	bool condition(int cc);
+	void push(WORD value);
+	WORD pop();
+
+	void alu(int op, byte value);
+	byte inc8(byte value);
+	byte dec8(byte value);
+	byte rotate(int op, byte value); // CB rotates and shifts
+	void executeCB();
+	bool executeED();
+};
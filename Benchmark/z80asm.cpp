@@ -0,0 +1,350 @@
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "z80asm.h"
+
+static std::string trim(const std::string& s)
+{
+	size_t b = 0, e = s.size();
+	while (b < e && isspace((unsigned char)s[b])) b++;
+	while (e > b && isspace((unsigned char)s[e - 1])) e--;
+	return s.substr(b, e - b);
+}
+
+static std::string lower(const std::string& s)
+{
+	std::string r = s;
+	for (size_t i = 0; i < r.size(); i++) r[i] = (char)tolower((unsigned char)r[i]);
+	return r;
+}
+
+static int findName(const std::string& s, const char* const* names, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (s == names[i]) return i;
+	return -1;
+}
+
+static const char* const r8Names[8] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+static const char* const rpNames[4] = { "bc", "de", "hl", "sp" };
+static const char* const rp2Names[4] = { "bc", "de", "hl", "af" };
+static const char* const ccNames[8] = { "nz", "z", "nc", "c", "po", "pe", "p", "m" };
+static const char* const aluNames[8] = { "add", "adc", "sub", "sbc", "and", "xor", "or", "cp" };
+static const char* const rotNames[8] = { "rlc", "rrc", "rl", "rr", "sla", "sra", "sll", "srl" };
+static const char* const bitNames[3] = { "bit", "res", "set" };
+
+static int r8(const std::string& s) { return findName(s, r8Names, 8); }
+static int rp(const std::string& s) { return findName(s, rpNames, 4); }
+static int rp2(const std::string& s) { return findName(s, rp2Names, 4); }
+static int cc(const std::string& s) { return findName(s, ccNames, 8); }
+
+static bool isIndirect(const std::string& s)
+{
+	return s.size() >= 3 && s[0] == '(' && s[s.size() - 1] == ')';
+}
+
+static std::string inner(const std::string& s)
+{
+	return trim(s.substr(1, s.size() - 2));
+}
+
+// Immediate operand: anything that isn't a register or indirection
+static bool isImm(const std::string& s)
+{
+	return !s.empty() && r8(s) < 0 && rp(s) < 0 && s != "af" && s != "af'" && !isIndirect(s);
+}
+
+static bool parseNumber(const std::string& t, int& value)
+{
+	const char* s = t.c_str();
+	char* end;
+	if (t[0] == '#') value = (int)strtol(s + 1, &end, 16);
+	else if (t.size() > 2 && t[0] == '0' && t[1] == 'x') value = (int)strtol(s + 2, &end, 16);
+	else if (isdigit((unsigned char)t[0]) && t[t.size() - 1] == 'h')
+	{
+		value = (int)strtol(s, &end, 16);
+		return end == s + t.size() - 1;
+	}
+	else if (isdigit((unsigned char)t[0])) value = (int)strtol(s, &end, 10);
+	else return false;
+	return *end == 0;
+}
+
+bool Z80Assembler::evaluate(const std::string& expr, int instrAddr, int& value, std::string& error) const
+{
+	value = 0;
+	int sign = 1;
+	std::string term;
+	for (size_t i = 0; i <= expr.size(); i++)
+	{
+		char c = (i < expr.size()) ? expr[i] : 0;
+		if ((c == '+' || c == '-') && trim(term).empty())
+		{
+			// unary sign
+			if (c == '-') sign = -sign;
+			continue;
+		}
+		if (c != '+' && c != '-' && c != 0)
+		{
+			term += c;
+			continue;
+		}
+
+		term = trim(term);
+		int v;
+		if (term.empty())
+		{
+			error = "bad expression '" + expr + "'";
+			return false;
+		}
+		if (term == "$")
+			v = instrAddr;
+		else if (!parseNumber(term, v))
+		{
+			std::map<std::string, int>::const_iterator it = labels.find(term);
+			if (it == labels.end())
+			{
+				error = "undefined label '" + term + "'";
+				return false;
+			}
+			v = it->second;
+		}
+		value += sign * v;
+		sign = (c == '-') ? -1 : 1;
+		term.clear();
+	}
+	return true;
+}
+
+bool Z80Assembler::fail(const std::string& message)
+{
+	if (Error.empty())
+	{
+		char buf[32];
+		sprintf(buf, "line %d: ", line);
+		Error = buf + message;
+	}
+	return false;
+}
+
+void Z80Assembler::emitExpr(const std::string& expr, int kind, int instrAddr)
+{
+	Fixup f;
+	f.Offset = (int)Code.size();
+	f.Kind = kind;
+	f.InstrAddr = instrAddr;
+	f.Line = line;
+	f.Expr = expr;
+	fixups.push_back(f);
+	emit(0);
+	if (kind == 2) emit(0);
+}
+
+bool Z80Assembler::instruction(const std::string& m, const std::vector<std::string>& ops)
+{
+	int n = (int)ops.size();
+	int addr = origin + (int)Code.size();
+	std::string o0 = (n > 0) ? ops[0] : "", o1 = (n > 1) ? ops[1] : "";
+
+	struct Simple { const char* Name; int Prefix; int Op; };
+	static const Simple simple[] = {
+		{ "nop", 0, 0x00 }, { "halt", 0, 0x76 }, { "di", 0, 0xF3 }, { "ei", 0, 0xFB }, { "exx", 0, 0xD9 },
+		{ "rla", 0, 0x17 }, { "rra", 0, 0x1F }, { "rlca", 0, 0x07 }, { "rrca", 0, 0x0F },
+		{ "cpl", 0, 0x2F }, { "scf", 0, 0x37 }, { "ccf", 0, 0x3F },
+		{ "neg", 0xED, 0x44 }, { "ldi", 0xED, 0xA0 }, { "ldd", 0xED, 0xA8 }, { "ldir", 0xED, 0xB0 }, { "lddr", 0xED, 0xB8 },
+	};
+	for (size_t i = 0; i < sizeof(simple) / sizeof(simple[0]); i++)
+	{
+		if (m == simple[i].Name && n == 0)
+		{
+			if (simple[i].Prefix) emit(simple[i].Prefix);
+			emit(simple[i].Op);
+			return true;
+		}
+	}
+
+	if (m == "db" || m == "dw")
+	{
+		for (int i = 0; i < n; i++) emitExpr(ops[i], (m == "db") ? 1 : 2, addr);
+		return n > 0 || fail("no data");
+	}
+
+	if (m == "ret")
+	{
+		if (n == 0) { emit(0xC9); return true; }
+		if (n == 1 && cc(o0) >= 0) { emit(0xC0 | cc(o0) << 3); return true; }
+	}
+	else if (m == "ex")
+	{
+		if (n == 2 && o0 == "de" && o1 == "hl") { emit(0xEB); return true; }
+		if (n == 2 && o0 == "af" && o1 == "af'") { emit(0x08); return true; }
+		if (n == 2 && o0 == "(sp)" && o1 == "hl") { emit(0xE3); return true; }
+	}
+	else if (m == "push" || m == "pop")
+	{
+		if (n == 1 && rp2(o0) >= 0) { emit(((m == "push") ? 0xC5 : 0xC1) | rp2(o0) << 4); return true; }
+	}
+	else if (m == "inc" || m == "dec")
+	{
+		bool inc = (m == "inc");
+		if (n == 1 && r8(o0) >= 0) { emit((inc ? 0x04 : 0x05) | r8(o0) << 3); return true; }
+		if (n == 1 && rp(o0) >= 0) { emit((inc ? 0x03 : 0x0B) | rp(o0) << 4); return true; }
+	}
+	else if (findName(m, aluNames, 8) >= 0)
+	{
+		int op = findName(m, aluNames, 8);
+		if (n == 2 && o0 == "hl" && rp(o1) >= 0)
+		{
+			if (op == 0) { emit(0x09 | rp(o1) << 4); return true; }
+			if (op == 1) { emit(0xED); emit(0x4A | rp(o1) << 4); return true; }
+			if (op == 3) { emit(0xED); emit(0x42 | rp(o1) << 4); return true; }
+		}
+		else
+		{
+			std::string src = (n == 2 && o0 == "a") ? o1 : (n == 1) ? o0 : "";
+			if (r8(src) >= 0) { emit(0x80 | op << 3 | r8(src)); return true; }
+			if (isImm(src)) { emit(0xC6 | op << 3); emitExpr(src, 1, addr); return true; }
+		}
+	}
+	else if (findName(m, rotNames, 8) >= 0)
+	{
+		if (n == 1 && r8(o0) >= 0) { emit(0xCB); emit(findName(m, rotNames, 8) << 3 | r8(o0)); return true; }
+	}
+	else if (findName(m, bitNames, 3) >= 0)
+	{
+		int b;
+		std::string error;
+		if (n == 2 && r8(o1) >= 0 && evaluate(o0, addr, b, error) && b >= 0 && b < 8)
+		{
+			emit(0xCB);
+			emit((findName(m, bitNames, 3) + 1) << 6 | b << 3 | r8(o1));
+			return true;
+		}
+	}
+	else if (m == "jr" || m == "djnz")
+	{
+		if (m == "djnz" && n == 1) { emit(0x10); emitExpr(o0, 0, addr); return true; }
+		if (m == "jr" && n == 1) { emit(0x18); emitExpr(o0, 0, addr); return true; }
+		if (m == "jr" && n == 2 && cc(o0) >= 0 && cc(o0) < 4) { emit(0x20 | cc(o0) << 3); emitExpr(o1, 0, addr); return true; }
+	}
+	else if (m == "jp" || m == "call")
+	{
+		bool jp = (m == "jp");
+		if (jp && n == 1 && o0 == "(hl)") { emit(0xE9); return true; }
+		if (n == 1 && isImm(o0)) { emit(jp ? 0xC3 : 0xCD); emitExpr(o0, 2, addr); return true; }
+		if (n == 2 && cc(o0) >= 0) { emit((jp ? 0xC2 : 0xC4) | cc(o0) << 3); emitExpr(o1, 2, addr); return true; }
+	}
+	else if (m == "rst")
+	{
+		int v;
+		std::string error;
+		if (n == 1 && evaluate(o0, addr, v, error) && (v & ~0x38) == 0) { emit(0xC7 | v); return true; }
+	}
+	else if (m == "ld" && n == 2)
+	{
+		int d8 = r8(o0), s8 = r8(o1);
+		if (d8 >= 0 && s8 >= 0 && !(d8 == 6 && s8 == 6)) { emit(0x40 | d8 << 3 | s8); return true; }
+		if (d8 >= 0 && isImm(o1)) { emit(0x06 | d8 << 3); emitExpr(o1, 1, addr); return true; }
+		if (o0 == "a" && o1 == "(bc)") { emit(0x0A); return true; }
+		if (o0 == "a" && o1 == "(de)") { emit(0x1A); return true; }
+		if (o0 == "(bc)" && o1 == "a") { emit(0x02); return true; }
+		if (o0 == "(de)" && o1 == "a") { emit(0x12); return true; }
+		if (o0 == "sp" && o1 == "hl") { emit(0xF9); return true; }
+		bool mem0 = isIndirect(o0) && r8(o0) < 0 && o0 != "(bc)" && o0 != "(de)" && o0 != "(sp)";
+		bool mem1 = isIndirect(o1) && r8(o1) < 0 && o1 != "(bc)" && o1 != "(de)" && o1 != "(sp)";
+		if (o0 == "a" && mem1) { emit(0x3A); emitExpr(inner(o1), 2, addr); return true; }
+		if (mem0 && o1 == "a") { emit(0x32); emitExpr(inner(o0), 2, addr); return true; }
+		if (o0 == "hl" && mem1) { emit(0x2A); emitExpr(inner(o1), 2, addr); return true; }
+		if (mem0 && o1 == "hl") { emit(0x22); emitExpr(inner(o0), 2, addr); return true; }
+		if (rp(o0) >= 0 && mem1) { emit(0xED); emit(0x4B | rp(o0) << 4); emitExpr(inner(o1), 2, addr); return true; }
+		if (mem0 && rp(o1) >= 0) { emit(0xED); emit(0x43 | rp(o1) << 4); emitExpr(inner(o0), 2, addr); return true; }
+		if (rp(o0) >= 0 && isImm(o1)) { emit(0x01 | rp(o0) << 4); emitExpr(o1, 2, addr); return true; }
+	}
+
+	return fail("unsupported instruction '" + m + (n ? " " : "") + o0 + (n > 1 ? "," + o1 : "") + "'");
+}
+
+bool Z80Assembler::Assemble(const std::string& source, int origin)
+{
+	this->origin = origin;
+	Code.clear();
+	Error.clear();
+	labels.clear();
+	fixups.clear();
+	line = 0;
+
+	size_t pos = 0;
+	while (pos < source.size())
+	{
+		size_t eol = source.find('\n', pos);
+		if (eol == std::string::npos) eol = source.size();
+		std::string text = source.substr(pos, eol - pos);
+		pos = eol + 1;
+		line++;
+
+		size_t comment = text.find(';');
+		if (comment != std::string::npos) text = text.substr(0, comment);
+		text = lower(trim(text));
+
+		size_t colon = text.find(':');
+		if (colon != std::string::npos)
+		{
+			std::string name = trim(text.substr(0, colon));
+			if (name.empty() || labels.count(name)) return fail("bad or duplicate label '" + name + "'");
+			labels[name] = origin + (int)Code.size();
+			text = trim(text.substr(colon + 1));
+		}
+		if (text.empty()) continue;
+
+		size_t space = text.find_first_of(" \t");
+		std::string mnemonic = text.substr(0, space);
+		std::vector<std::string> ops;
+		if (space != std::string::npos)
+		{
+			std::string rest = text.substr(space + 1);
+			size_t start = 0;
+			while (true)
+			{
+				size_t comma = rest.find(',', start);
+				ops.push_back(trim(rest.substr(start, comma - start)));
+				if (comma == std::string::npos) break;
+				start = comma + 1;
+			}
+		}
+		if (!instruction(mnemonic, ops)) return false;
+	}
+
+	for (size_t i = 0; i < fixups.size(); i++)
+	{
+		const Fixup& f = fixups[i];
+		line = f.Line;
+		int v;
+		std::string error;
+		if (!evaluate(f.Expr, f.InstrAddr, v, error)) return fail(error);
+		if (f.Kind == 0)
+		{
+			int d = v - (origin + f.Offset + 1);
+			if (d < -128 || d > 127) return fail("relative jump out of range");
+			Code[f.Offset] = (unsigned char)d;
+		}
+		else if (f.Kind == 1)
+		{
+			if (v < -128 || v > 255) return fail("byte value out of range");
+			Code[f.Offset] = (unsigned char)v;
+		}
+		else
+		{
+			if (v < -32768 || v > 0xFFFF) return fail("word value out of range");
+			Code[f.Offset] = (unsigned char)v;
+			Code[f.Offset + 1] = (unsigned char)(v >> 8);
+		}
+	}
+	return true;
+}
+
+int Z80Assembler::GetLabel(const std::string& name) const
+{
+	std::map<std::string, int>::const_iterator it = labels.find(lower(name));
+	return (it == labels.end()) ? -1 : it->second;
+}
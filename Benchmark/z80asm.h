@@ -0,0 +1,47 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Minimal Z80 assembler for the depacker routines run by ohz80.
+// One instruction per line, optional "label:" before it and ';' comments.
+// Operands are registers, (hl) (bc) (de) (sp) (nn), and expressions of numbers
+// (decimal, 0x.., #.., ..h), labels and $ joined with + and -.
+// Supports the instructions the Z80 core runs, without IX/IY and I/O.
+class Z80Assembler
+{
+public:
+
+	std::vector<unsigned char> Code;
+	std::string Error; // first error with line number, if Assemble() failed
+
+	// Assembles 'source' to run at address 'origin'
+	bool Assemble(const std::string& source, int origin);
+
+	// Address of label, -1 if it is not defined
+	int GetLabel(const std::string& name) const;
+
+private:
+
+	struct Fixup
+	{
+		int Offset;      // in Code
+		int Kind;        // 1 = byte, 2 = word, 0 = relative jump
+		int InstrAddr;   // value of $
+		int Line;
+		std::string Expr;
+	};
+
+	int origin;
+	int line;
+	std::map<std::string, int> labels;
+	std::vector<Fixup> fixups;
+
+	bool fail(const std::string& message);
+	bool instruction(const std::string& mnemonic, const std::vector<std::string>& ops);
+	void emit(int b) { Code.push_back((unsigned char)b); }
+	void emitExpr(const std::string& expr, int kind, int instrAddr);
+	bool evaluate(const std::string& expr, int instrAddr, int& value, std::string& error) const;
+};
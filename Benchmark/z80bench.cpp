@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "packers.h"
+#include "corpus.h"
+#include "z80.h"
+#include "z80asm.h"
+#include "depackers.h"
+
+#define CPU_HZ 3500000.0 // ZX Spectrum 128
+
+// Input packed by one format and unpacked by one depacker
+struct Z80Run
+{
+	std::string Input;
+	const Z80Depacker* Depacker;
+	int CodeSize;
+	int Size;
+	int PackedSize;
+	long long TStates;
+	int PeakOverlap;
+	const char* Error; // NULL if output is correct
+
+	Z80Run() : Depacker(NULL), CodeSize(0), Size(0), PackedSize(0), TStates(0), PeakOverlap(0), Error(NULL) {};
+};
+
+struct Z80Input
+{
+	std::string Name;
+	std::vector<unsigned char> Data;
+};
+
+const char* saveAsmDir = NULL; // --save-asm
+
+void PrintUsage()
+{
+	printf("Usage:\n");
+	printf("ohz80 [options] [file...]\n");
+	printf("  --format=hrust1|hrust2|all   packers to run (default all)\n");
+	printf("  --depackers=name,...         depacker routines (default all):\n");
+	printf("                              ");
+	std::vector<Z80Depacker> depackers = GetZ80Depackers();
+	for (size_t i = 0; i < depackers.size(); i++) printf(" %s", depackers[i].Name.c_str());
+	printf("\n");
+	printf("  --cases=name,...             corpus cases (default all, none if files are given)\n");
+	printf("  --sizes=n,...                corpus input sizes in bytes (default 1024,4096,16384)\n");
+	printf("  --jobs=n                     worker threads (default: number of CPUs)\n");
+	printf("  --save-asm=dir               save the routine made by <format>/spec for each input\n");
+	printf("                               to dir/<input>.<format>.asm\n");
+	printf("\n");
+}
+
+static bool hasOption(const char* arg, const char* name, const char** value)
+{
+	size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0 || arg[len] != '=') return false;
+	*value = arg + len + 1;
+	return true;
+}
+
+static bool inList(const std::vector<std::string>& list, const char* s)
+{
+	if (list.empty()) return true;
+	for (size_t i = 0; i < list.size(); i++)
+		if (list[i] == s) return true;
+	return false;
+}
+
+static std::vector<std::string> splitList(const char* s)
+{
+	std::vector<std::string> list;
+	std::string item;
+	for (; ; s++)
+	{
+		if (*s == ',' || *s == 0)
+		{
+			if (!item.empty()) list.push_back(item);
+			item.clear();
+			if (*s == 0) break;
+		}
+		else
+			item += *s;
+	}
+	return list;
+}
+
+// Runs 'code' on 'packed' and checks the result against 'data'
+static void runDepacker(Z80& z80, const std::vector<unsigned char>& code, const unsigned char* packed, int packedSize,
+	const std::vector<unsigned char>& data, Z80Run& run)
+{
+	run.Error = RunZ80Depacker(z80, code, packed, packedSize, data.empty() ? NULL : &data[0], (int)data.size());
+	run.TStates = z80.TStates;
+	run.PeakOverlap = z80.PeakOverlap;
+}
+
+// Writes source of a specialized routine to saveAsmDir
+static bool saveAsm(const Z80Depacker& depacker, const std::string& inputName)
+{
+	std::string name = inputName;
+	for (size_t i = 0; i < name.size(); i++)
+		if (name[i] == '/' || name[i] == '\\' || name[i] == ':') name[i] = '_';
+	std::string path = std::string(saveAsmDir) + "/" + name + "." + depacker.Format + ".asm";
+	FILE* f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	bool ok = fwrite(depacker.Source.data(), 1, depacker.Source.size(), f) == depacker.Source.size();
+	return fclose(f) == 0 && ok;
+}
+
+// Packs inputs on 'workerCount' threads and runs every depacker of the format on each result.
+// Specialized depackers are made and assembled for each packed block.
+static void runAll(const std::vector<Z80Input>& inputs, const std::vector<std::string>& formats,
+	const std::vector<const Z80Depacker*>& depackers, const std::vector<std::vector<unsigned char> >& codes,
+	int workerCount, std::vector<Z80Run>& runs)
+{
+	// one job per input and format
+	std::vector<std::string> allFormats;
+	allFormats.push_back("hrust1");
+	allFormats.push_back("hrust2");
+	std::vector<std::pair<int, std::string> > jobs;
+	for (size_t i = 0; i < inputs.size(); i++)
+		for (size_t f = 0; f < allFormats.size(); f++)
+			if (inList(formats, allFormats[f].c_str()))
+				jobs.push_back(std::make_pair((int)i, allFormats[f]));
+
+	std::vector<std::vector<Z80Run> > results(jobs.size());
+	std::atomic<int> nextJob(0);
+	std::vector<std::thread> workers;
+	for (int w = 0; w < workerCount; w++)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			Packer* packers[2] = { CreateHrust1Packer(), CreateHrust2Packer() };
+			Z80* z80 = new Z80();
+			for (int j; (j = nextJob++) < (int)jobs.size(); )
+			{
+				const Z80Input& input = inputs[jobs[j].first];
+				Packer* packer = (jobs[j].second == "hrust1") ? packers[0] : packers[1];
+				int packedSize = packer->Pack(&input.Data[0], (int)input.Data.size());
+				for (size_t d = 0; d < depackers.size(); d++)
+				{
+					if (depackers[d]->Format != jobs[j].second) continue;
+					Z80Run run;
+					run.Input = input.Name;
+					run.Depacker = depackers[d];
+					run.CodeSize = (int)codes[d].size();
+					run.Size = (int)input.Data.size();
+					run.PackedSize = packedSize;
+					if (packedSize < 0)
+						run.Error = "can't be packed";
+					else if (depackers[d]->Specialized)
+					{
+						Z80Depacker spec = SpecializeZ80Depacker(jobs[j].second, &packer->GetOps());
+						Z80Assembler assembler;
+						if (!assembler.Assemble(spec.Source, CODE_ORG))
+							run.Error = "specialized routine doesn't assemble";
+						else if (saveAsmDir && !saveAsm(spec, input.Name))
+							run.Error = "error writing .asm file";
+						else
+						{
+							run.CodeSize = (int)assembler.Code.size();
+							runDepacker(*z80, assembler.Code, packer->GetOutput(), packedSize, input.Data, run);
+						}
+					}
+					else
+						runDepacker(*z80, codes[d], packer->GetOutput(), packedSize, input.Data, run);
+					results[j].push_back(run);
+				}
+			}
+			delete z80;
+			delete packers[0];
+			delete packers[1];
+		}));
+	}
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+
+	for (size_t j = 0; j < results.size(); j++)
+		runs.insert(runs.end(), results[j].begin(), results[j].end());
+}
+
+int main(int argc, const char* argv[])
+{
+	printf("\n");
+	printf("Optimal Hrust compressors: Z80 depacker timing\n");
+	printf("\n");
+
+	std::vector<std::string> formats, depackerNames, cases;
+	std::vector<int> sizes;
+	std::vector<const char*> files;
+	int workerCount = (int)std::thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* value;
+		if (hasOption(argv[i], "--format", &value))
+		{
+			if (strcmp(value, "all") != 0) formats.push_back(value);
+		}
+		else if (hasOption(argv[i], "--depackers", &value))
+			depackerNames = splitList(value);
+		else if (hasOption(argv[i], "--cases", &value))
+			cases = splitList(value);
+		else if (hasOption(argv[i], "--sizes", &value))
+		{
+			std::vector<std::string> list = splitList(value);
+			for (size_t k = 0; k < list.size(); k++) sizes.push_back(atoi(list[k].c_str()));
+		}
+		else if (hasOption(argv[i], "--jobs", &value))
+			workerCount = atoi(value);
+		else if (hasOption(argv[i], "--save-asm", &value) && *value)
+			saveAsmDir = value;
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+	if (workerCount < 1) workerCount = 1;
+	if (sizes.empty())
+	{
+		sizes.push_back(1024);
+		sizes.push_back(4096);
+		sizes.push_back(16384);
+	}
+
+	// Depackers
+
+	std::vector<Z80Depacker> allDepackers = GetZ80Depackers();
+	std::vector<const Z80Depacker*> depackers;
+	std::vector<std::vector<unsigned char> > codes;
+	for (size_t i = 0; i < allDepackers.size(); i++)
+	{
+		const Z80Depacker& d = allDepackers[i];
+		if (!inList(depackerNames, d.Name.c_str()) || !inList(formats, d.Format.c_str())) continue;
+		Z80Assembler assembler;
+		if (!assembler.Assemble(d.Source, CODE_ORG))
+		{
+			printf("%s: %s\n", d.Name.c_str(), assembler.Error.c_str());
+			return 5;
+		}
+		depackers.push_back(&d);
+		codes.push_back(assembler.Code);
+	}
+	if (depackers.empty())
+	{
+		printf("No depackers selected\n");
+		return 1;
+	}
+
+	// Inputs
+
+	std::vector<Z80Input> inputs;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		Z80Input input;
+		input.Name = files[i];
+		FILE* f = fopen(files[i], "rb");
+		if (!f)
+		{
+			printf("Error opening %s\n", files[i]);
+			return 5;
+		}
+		input.Data.resize(0x10000);
+		input.Data.resize(fread(&input.Data[0], 1, input.Data.size(), f));
+		fclose(f);
+		if (input.Data.empty())
+		{
+			printf("%s is empty\n", files[i]);
+			return 5;
+		}
+		inputs.push_back(input);
+	}
+	if (files.empty() || !cases.empty())
+	{
+		for (const CorpusCase* c = GetCorpusCases(); c->Name; c++)
+		{
+			if (!inList(cases, c->Name)) continue;
+			for (size_t s = 0; s < sizes.size(); s++)
+			{
+				if (c->FixedSize && s > 0) break;
+				Z80Input input;
+				c->Generate(input.Data, sizes[s]);
+				char name[64];
+				sprintf(name, "%s/%d", c->Name, (int)input.Data.size());
+				input.Name = name;
+				inputs.push_back(input);
+			}
+		}
+	}
+
+	std::vector<Z80Run> runs;
+	runAll(inputs, formats, depackers, codes, workerCount, runs);
+
+	// Results, then totals of each depacker over inputs all depackers could run
+
+	printf("%-14s %-22s %6s %6s %6s %12s %8s %9s %8s\n", "depacker", "input", "size", "packed", "code", "T-states", "T/byte", "ms", "overlap");
+	int failures = 0;
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		const Z80Run& r = runs[i];
+		if (r.Error)
+		{
+			printf("%-14s %-22s %6d %6d  %s\n", r.Depacker->Name.c_str(), r.Input.c_str(), r.Size, r.PackedSize, r.Error);
+			if (strcmp(r.Error, "doesn't fit in 64K") != 0 && strcmp(r.Error, "can't be packed") != 0)
+				failures++;
+			continue;
+		}
+		printf("%-14s %-22s %6d %6d %6d %12lld %8.1f %9.2f %8d\n", r.Depacker->Name.c_str(), r.Input.c_str(), r.Size, r.PackedSize,
+			r.CodeSize, r.TStates, (double)r.TStates / r.Size, r.TStates / CPU_HZ * 1e3, r.PeakOverlap);
+	}
+
+	// code size of specialized routines is the average over inputs
+	printf("\n%-14s %6s %14s %8s\n", "depacker", "code", "total T", "T/byte");
+	for (size_t d = 0; d < depackers.size(); d++)
+	{
+		long long tStates = 0, bytes = 0, codeSize = 0, count = 0;
+		for (size_t i = 0; i < runs.size(); i++)
+		{
+			if (runs[i].Depacker != depackers[d] || runs[i].Error) continue;
+			tStates += runs[i].TStates;
+			bytes += runs[i].Size;
+			codeSize += runs[i].CodeSize;
+			count++;
+		}
+		printf("%-14s %6d %14lld %8.1f\n", depackers[d]->Name.c_str(), count ? int(codeSize / count) : (int)codes[d].size(), tStates,
+			bytes ? (double)tStates / bytes : 0.0);
+	}
+
+	// specialized routine of a block must not be slower than the generic inline one
+	int slower = 0;
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		const Z80Run& spec = runs[i];
+		if (!spec.Depacker->Specialized || spec.Error) continue;
+		for (size_t k = 0; k < runs.size(); k++)
+		{
+			const Z80Run& r = runs[k];
+			if (r.Depacker->Name != r.Depacker->Format + "/inline" || r.Depacker->Format != spec.Depacker->Format ||
+				r.Input != spec.Input || r.Error || r.TStates >= spec.TStates) continue;
+			if (!slower++) printf("\n");
+			printf("%s slower than %s on %s: %lld T-states vs %lld\n", spec.Depacker->Name.c_str(), r.Depacker->Name.c_str(),
+				spec.Input.c_str(), spec.TStates, r.TStates);
+		}
+	}
+
+	if (failures > 0 || slower > 0)
+	{
+		if (failures > 0) printf("\n%d run(s) failed\n", failures);
+		if (slower > 0) printf("\n%d specialized run(s) slower than inline\n", slower);
+		printf("\n");
+		return 2;
+	}
+	printf("\n");
+	return 0;
+}
@@ -6,11 +6,92 @@ Published under the MIT License
 
 
 #include "compress.h"
-#include <Windows.h>
+#include "platform.h"
+#include <thread>
+#include <condition_variable>
 
 // D register defines current compression window size.
 // Expanding it takes special 13-bit literal.
 #define CHANGE_D_LEN (5 + 8)
+#define CHANGE_D_ONES (2 + 7) // 00110, 0xFE
+
+// Depacking time model of OBJECTIVE_DEPACK_TIME: T-states of every control bit (with the
+// jumps of dispatch), data byte read from input and byte produced (LDIR). Fitted to
+// the inline depacker of Benchmark/depackers.cpp, within 10% on usual data.
+#define DEPACK_BIT_T 65
+#define DEPACK_BYTE_T 25
+#define DEPACK_COPY_T 21
+
+static int getDepackTime(int controlBits, int dataBytes, int produced)
+{
+	return controlBits * DEPACK_BIT_T + dataBytes * DEPACK_BYTE_T + produced * DEPACK_COPY_T;
+}
+
+// Run fast path (see OptimalCompressor::runPeriod). Periods up to 8 mean distances
+// down to -8, where encoded length of a backref depends only on count class.
+#define RUN_MAX_PERIOD 8
+#define RUN_DIRECT_CNT 15 // counts evaluated one by one, longer ones use runWindows
+static const int runWindowCnt[2][2] = { { 16, 127 }, { 128, 0xEFF } };
+
+const char* const OpKindNames[OP_KIND_COUNT] =
+{
+	"header",
+	"literal",
+	"literal_run",
+	"ref1_dist8",
+	"ref2_dist32",
+	"ref2_dist768",
+	"long_dist32",
+	"long_dist256",
+	"long_dist512",
+	"long_far",
+	"rir",
+	"d_change",
+	"end",
+	"padding"
+};
+
+ParseConstraints::ParseConstraints()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+static int countOnes(int value)
+{
+	int n = 0;
+	for (; value; value &= value - 1)
+		n++;
+	return n;
+}
+
+int GetTapeLoadTime(const byte* data, int size)
+{
+	int time = size * 8;
+	for (int i = 0; i < size; i++)
+		time += countOnes(data[i]);
+	return time;
+}
+
+OpStats::OpStats()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void OpStats::AddOp(OP_KIND kind, int count, int dist)
+{
+	if (Count[kind]++ == 0)
+	{
+		MinCount[kind] = MaxCount[kind] = count;
+		MinDist[kind] = MaxDist[kind] = dist;
+	}
+	else
+	{
+		if (count < MinCount[kind]) MinCount[kind] = count;
+		if (count > MaxCount[kind]) MaxCount[kind] = count;
+		if (dist < MinDist[kind]) MinDist[kind] = dist;
+		if (dist > MaxDist[kind]) MaxDist[kind] = dist;
+	}
+}
 
 Compressor::Compressor()
 {
@@ -27,8 +108,31 @@ void Compressor::TryCompress()
 	}
 	else
 	{
+		if (Parse && CheckParse(NULL, NULL) < 0)
+		{
+			OutputSize = 0;
+			Result = COMPRESS_RESULT::INVALID_PARSE;
+			return;
+		}
+
+		PhaseTimer preprocessTimer(Timing, PHASE_DP);
 		Compress_Preprocess();
+		preprocessTimer.Stop();
+		if (Timing)
+			Timing->SplitMatchFromDp();
+
+		if (compressedSizePrecalc < 0)
+		{
+			// stopped by CancellationToken
+			OutputSize = 0;
+			Result = COMPRESS_RESULT::CANCELLED;
+			return;
+		}
+
+		PhaseTimer emitTimer(Timing, PHASE_EMIT);
 		Compress_Emit();
+		emitTimer.Stop();
+
 		if (OutputSize > 0xFFFF)
 		{
 			//   
@@ -52,9 +156,20 @@ void Compressor::Compress_Preprocess()
 		throw;
 	}
 
-	optimalCompressor.ProgressReport = &this->ProgressReport;
-	optimalCompressor.Init(Input, InputSize - 6); // last 6 bytes are never compressed
-	int packedBitsCount = optimalCompressor.Preprocess();
+	int packedBitsCount;
+	if (Parse)
+	{
+		packedBitsCount = CheckParse(NULL, NULL); // already checked by TryCompress
+	}
+	else
+	{
+		packedBitsCount = Solve(Constraints);
+		if (packedBitsCount < 0)
+		{
+			compressedSizePrecalc = -1; // cancelled
+			return;
+		}
+	}
 
 	packedBitsCount += 7 + 7; // end of stream literal
 
@@ -65,9 +180,122 @@ void Compressor::Compress_Preprocess()
 	// NOTE: calculated result may be 1 byte less than it should because of unused bits in last bitflow word
 };
 
+int Compressor::Solve(const ParseConstraints& constraints)
+{
+	optimalCompressor.ProgressReport = &this->ProgressReport;
+	optimalCompressor.Timing = Timing;
+	optimalCompressor.MatchThreads = MatchThreads;
+	optimalCompressor.Constraints = constraints;
+	optimalCompressor.Objective = Objective;
+	optimalCompressor.BitTime = BitTime;
+	optimalCompressor.Init(Input, InputSize - 6); // last 6 bytes are never compressed
+	return optimalCompressor.Preprocess();
+}
+
+int Compressor::CheckParse(const char** error, int* badOp)
+{
+	const char* e = NULL;
+	int endpos = InputSize - 6;
+	int pos = 1;
+	int D = 2;
+	int bits = 8; // first byte simply copied
+	int i;
+	for (i = 0; i < ParseSize && !e; i++)
+	{
+		Backref op = Parse[i];
+		int cnt = op.Count < 0 ? -op.Count : op.IsRIR ? 3 : op.Count;
+		if (op.Count == 0)
+			e = "count is 0";
+		else if (pos + cnt > endpos)
+			e = "op goes past the end of input (last 6 bytes are stored)";
+		else if (op.Count == -1)
+			bits += 1 + 8;
+		else if (op.Count < -1)
+		{
+			if (cnt < 12 || cnt > 42 || cnt % 2 != 0)
+				e = "literal run must be 12..42 bytes, even";
+			else
+				bits += 7 + 4 + cnt * 8;
+		}
+		else if (op.Dist >= 0 || pos + op.Dist < 0)
+			e = "distance points outside of input";
+		else if (op.IsRIR)
+		{
+			if (op.Count != 3 || op.Dist < -79)
+				e = "RIR distance must be -79..-1";
+			else if (Input[pos + op.Dist] != Input[pos] || Input[pos + op.Dist + 2] != Input[pos + 2])
+				e = "RIR doesn't match input";
+			else
+				bits += op.GetEncodedLen();
+		}
+		else
+		{
+			bool badD = op.Count >= 3 && (op.D < 2 || op.D > 8);
+			int len = (badD || op.Count > 0xEFF) ? -1 : op.GetEncodedLen();
+			if (badD)
+				e = "D must be 2..8";
+			else if (len < 0 || len >= 0x0FFFFFFF)
+				e = op.Count > 2 ? "count above 0xEFF or distance beyond D" : "distance too far for count";
+			else if (memcmp(Input + pos, Input + pos + op.Dist, cnt) != 0)
+				e = "backref doesn't match input";
+			else
+			{
+				if (op.Count >= 3)
+				{
+					bits += ((op.D - D) & 7) * CHANGE_D_LEN; // D changes emitted before the op
+					D = op.D;
+				}
+				bits += len;
+			}
+		}
+		pos += cnt;
+	}
+
+	if (!e && pos != endpos)
+	{
+		e = "ops end before the end of input";
+		i++;
+	}
+	if (e)
+	{
+		if (error) *error = e;
+		if (badOp) *badOp = i - 1;
+		return -1;
+	}
+	return bits;
+}
+
+int Compressor::GetParse(Backref* ops)
+{
+	if (Parse)
+	{
+		memmove(ops, Parse, ParseSize * sizeof(Backref));
+		return ParseSize;
+	}
+
+	int count = 0;
+	int D = 2;
+	for (int pos = 1; pos < InputSize - 6; )
+	{
+		Backref op = optimalCompressor.GetOptimalOp(pos, D);
+		ops[count++] = op;
+		if (op.Count < 0)
+			pos -= op.Count;
+		else if (op.IsRIR)
+			pos += 3;
+		else
+		{
+			pos += op.Count;
+			if (op.Count >= 3) D = op.D;
+		}
+	}
+	return count;
+}
+
 void Compressor::emitByte(int byte_) 
 {
 	*outputPtr++ = (byte)byte_;
+	if (Stats) Stats->DataBytes[opKind]++;
 };
 
 void Compressor::emitBit(int bit) 
@@ -76,6 +304,7 @@ void Compressor::emitBit(int bit)
 
 	*controlWordPtr = (*controlWordPtr) * 2 + (bit & 1);
 	controlBitsCnt++;
+	if (Stats) Stats->ControlBits[opKind]++;
 
 	if (controlBitsCnt == 16)
 	{
@@ -96,6 +325,7 @@ void Compressor::finalizeBitFlow()
 	}
 	else
 	{
+		if (Stats) Stats->ControlBits[OP_PADDING] = 16 - controlBitsCnt;
 		for( ; controlBitsCnt != 16; controlBitsCnt++)
 			*controlWordPtr <<= 1;
 	}
@@ -180,14 +410,42 @@ void Compressor::emitLongDist(int dist, int D)
     }
 };
 
+// Bits emitted so far, not counting unused bits of the reserved control word
+int Compressor::getEmittedBits()
+{
+	return int(outputPtr - Output) * 8 - (16 - controlBitsCnt);
+}
+
+// Spreads 'bits' of an op evenly over 'cnt' bytes it produces from 'pos'
+void Compressor::setByteCosts(int pos, int cnt, int bits)
+{
+	for (int i = 0; i < cnt; i++)
+		ByteCosts[pos + i] = float(bits) / cnt;
+}
+
+OP_KIND Compressor::getOpKind(const Backref& op)
+{
+	if (op.Count == -1) return OP_LITERAL;
+	if (op.Count < -1) return OP_LITERAL_RUN;
+	if (op.IsRIR) return OP_RIR;
+	if (op.Count == 1) return OP_REF1;
+	if (op.Count == 2) return (op.Dist >= -32) ? OP_REF2_NEAR : OP_REF2_FAR;
+	if (op.Dist >= -32) return OP_LONG_32;
+	if (op.Dist >= -256) return OP_LONG_256;
+	if (op.Dist >= -512) return OP_LONG_512;
+	return OP_LONG_FAR;
+}
+
 // Builds final compressed block using precalculations 
 // made by Compress_Preprocess routine
 void Compressor::Compress_Emit() {
 
 	outputPtr = Output;
+	if (Stats) *Stats = OpStats();
 	
 	// Header
 
+	opKind = OP_HEADER;
 	emitByte('H');
 	emitByte('R');
 	emitByte(InputSize >> 0);
@@ -212,16 +470,30 @@ void Compressor::Compress_Emit() {
 	int endpos = InputSize - 6; // omit last 6 bytes
     int pos = 0;
 
+	opKind = OP_LITERAL;
 	emitByte(Input[pos++]);	// first byte is simply copied
+	DepackTime = 0;
+	if (Stats) Stats->AddOp(OP_LITERAL, 1, 0);
+	if (ByteCosts)
+	{
+		// first and last 6 bytes are stored as is
+		setByteCosts(0, 1, 8);
+		setByteCosts(endpos, 6, 6 * 8);
+	}
 
     // value of D register that controls maximum reference distance
 	int D = 2;
+	int parseIndex = 0;
 
     while (pos != endpos)
     {
         if (pos > endpos) throw; // something is wrong
 	
-		Backref cmd = optimalCompressor.GetOptimalOp(pos, D);
+		Backref cmd = Parse ? Parse[parseIndex++] : optimalCompressor.GetOptimalOp(pos, D);
+		int opPos = pos;
+		int opBits = getEmittedBits();
+		opKind = getOpKind(cmd);
+		if (Stats) Stats->AddOp(opKind, cmd.Count < 0 ? -cmd.Count : cmd.IsRIR ? 3 : cmd.Count, cmd.Count < 0 ? 0 : -cmd.Dist);
 
         if (cmd.Count == 0)
         {
@@ -295,15 +567,19 @@ void Compressor::Compress_Emit() {
 						while (D != cmd.D)
 						{
 							D = (D & 7) + 1;
+							opKind = OP_D_CHANGE;
+							if (Stats) Stats->Count[OP_D_CHANGE]++;
 							emitBit(0);
 							emitBit(0);
 							emitBit(1);
 							emitBit(1);
 							emitBit(0);
 							emitByte(0xFE);
+							DepackTime += getDepackTime(5, 1, 0);
 						}
 					};
                     
+					opKind = getOpKind(cmd);
 					emitBit(0);
                     emitLargeCnt(cmd.Count);
                     emitLongDist(cmd.Dist, D);
@@ -361,10 +637,20 @@ void Compressor::Compress_Emit() {
 				pos += cmd.Count;
 			}
 		}
+
+		if (cmd.Count == -1)
+			DepackTime += getDepackTime(1, 1, 1);
+		else if (cmd.Count < -1)
+			DepackTime += getDepackTime(7 + 4, 0, -cmd.Count);
+		else
+			DepackTime += cmd.GetDepackTime();
+		if (ByteCosts) setByteCosts(opPos, pos - opPos, getEmittedBits() - opBits);
 	}
 
     // end of stream marker
 
+	opKind = OP_END;
+	if (Stats) Stats->Count[OP_END]++;
     emitBit(0);
     emitBit(1);
     emitBit(1);
@@ -389,6 +675,129 @@ void Compressor::Compress_Emit() {
 }
 
 
+////////////////////////////////////////////////////////////
+///////////         MatchPipeline           ////////////////
+////////////////////////////////////////////////////////////
+
+// Worker threads find matches for positions from the end towards the start, ahead of DP,
+// into a ring of MatchSteps. A worker waits while its slot holds a position DP hasn't used yet.
+class MatchPipeline
+{
+	OptimalCompressor* owner;
+	int ringSize;
+	MatchSteps* ring;
+	int* ringPos;      // position each slot is filled for, 0 if none
+	int nextPos;       // next position to hand out to a worker
+	int releasedPos;   // DP is done with this and all higher positions
+	bool stop;
+	std::mutex lock;
+	std::condition_variable slotReleased;
+	std::condition_variable slotFilled;
+	std::vector<std::thread> workers;
+	WorkCounters* workCounters; // of the DP thread; NULL if not profiled
+	WorkCounters workerCounters; // sum of all workers, added to workCounters when they are done
+
+	void Work();
+
+public:
+	MatchPipeline(OptimalCompressor* owner, int threads);
+	~MatchPipeline(); // stops and joins workers
+
+	// Matches of 'pos', waits until they are found. Positions must be requested in DP order.
+	const MatchSteps& Get(int pos);
+
+	// DP is done with matches of 'pos', its slot can be reused
+	void Release(int pos);
+};
+
+MatchPipeline::MatchPipeline(OptimalCompressor* owner, int threads)
+	: owner(owner), stop(false), workCounters(NULL)
+{
+	ringSize = threads * 4;
+	ring = new MatchSteps[ringSize];
+	ringPos = new int[ringSize];
+	for (int i = 0; i < ringSize; i++)
+		ringPos[i] = 0;
+	nextPos = owner->inputSize - 1;
+	releasedPos = owner->inputSize;
+#ifdef OHC_PROFILE
+	workCounters = CurrentWorkCounters;
+#endif
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&MatchPipeline::Work, this));
+}
+
+MatchPipeline::~MatchPipeline()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	slotReleased.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+#ifdef OHC_PROFILE
+	if (workCounters)
+		for (int i = 0; i < WORK_COUNTER_COUNT; i++)
+			workCounters->Values[i] += workerCounters.Values[i];
+#endif
+	delete[] ringPos;
+	delete[] ring;
+}
+
+void MatchPipeline::Work()
+{
+	int* matchLen = new int[MAX_INPUT_SIZE];
+#ifdef OHC_PROFILE
+	WorkCounters counters;
+	CurrentWorkCounters = workCounters ? &counters : NULL;
+#endif
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stop && nextPos >= 1)
+	{
+		int pos = nextPos--;
+		// the slot was used by pos + ringSize
+		while (!stop && releasedPos > pos + ringSize)
+			slotReleased.wait(guard);
+		if (stop)
+			break;
+
+		guard.unlock();
+		MatchSteps& steps = ring[pos % ringSize];
+		owner->findMatches(pos, matchLen, steps);
+		guard.lock();
+
+		ringPos[pos % ringSize] = pos;
+		slotFilled.notify_all();
+	}
+
+#ifdef OHC_PROFILE
+	for (int i = 0; i < WORK_COUNTER_COUNT; i++)
+		workerCounters.Values[i] += counters.Values[i];
+#endif
+	guard.unlock();
+	delete[] matchLen;
+}
+
+const MatchSteps& MatchPipeline::Get(int pos)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (ringPos[pos % ringSize] != pos)
+		slotFilled.wait(guard);
+	return ring[pos % ringSize];
+}
+
+void MatchPipeline::Release(int pos)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		releasedPos = pos;
+	}
+	slotReleased.notify_all();
+}
+
+
 ////////////////////////////////////////////////////////////
 ///////////       OptimalCompressor         ////////////////
 ////////////////////////////////////////////////////////////
@@ -410,124 +819,490 @@ Backref OptimalCompressor::GetOptimalOp(int pos, int D)
 
 int OptimalCompressor::Preprocess()
 {
+	small = (inputSize <= SMALL_INPUT_SIZE);
+	maxD = small ? 2 : Constraints.MaxD ? Constraints.MaxD : 8;
+	maxDist = Constraints.MaxDist ? Constraints.MaxDist : MAX_INPUT_SIZE;
+	maxCount = Constraints.MaxCount ? min(Constraints.MaxCount, 0xEFF) : 0xEFF;
+	tape = (Objective == OBJECTIVE_TAPE_TIME);
+	depack = (Objective == OBJECTIVE_DEPACK_TIME);
+	changeDCost = CHANGE_D_LEN + (tape ? CHANGE_D_ONES : 0);
+	if (depack)
+		changeDCost = CHANGE_D_LEN * BitTime + getDepackTime(5, 1, 0);
+	copyCost = depack ? DEPACK_COPY_T : 0;
+
 	memmove(input + inputSize, input, inputSize);
 	inputOffset = inputSize;
+	fill_runPeriod();
+	runWindowsPos = 0;
 
 	// solve optimization problem using Dynamic Programming.
 	// DP base params are position in input file and the value of D register.
 
 	for(int D = 1; D <= 8; D++)
 		cost[inputSize][D - 1] = 0;
-	
-    for (int pos = inputSize - 1; pos >= 1; pos--)
-    {
-		if ((pos & 0x1FF) == 0)
+
+	if (ProgressReport)
+		ProgressReport->Start(inputSize);
+
+	if (small)
+	{
+		if (!solveSmall())
+			return -1;
+	}
+	else
+	{
+		MatchPipeline* pipeline = (MatchThreads > 1) ? new MatchPipeline(this, MatchThreads) : NULL;
+
+		for (int pos = inputSize - 1; pos >= 1; pos--)
 		{
 			if (ProgressReport)
-				ProgressReport->Report(inputSize, inputSize - pos);
+			{
+				if (ProgressReport->IsCancelled())
+				{
+					delete pipeline;
+					return -1;
+				}
+				if ((pos & 0x1FF) == 0)
+					ProgressReport->Report(pos);
+			}
+
+			if (pipeline)
+			{
+				PhaseTimer matchTimer(Timing, PHASE_MATCH); // time spent waiting for matches
+				const MatchSteps& steps = pipeline->Get(pos);
+				matchTimer.Stop();
+				solvePosition(pos, steps);
+				pipeline->Release(pos);
+			}
+			else
+				solvePosition(pos);
 		}
 
-        int* result = cost[pos];
-		Backref* resultOp = solution[pos];
+		delete pipeline;
+	}
 
-		// try all possible values of D register
-        for (byte D = 2 - 1; D <= 8 - 1; D++)
-        {
-            // try copy 1 byte
+	// return compressed size in bits
+
+	if (Objective != OBJECTIVE_SIZE)
+		return getSolutionBits();
+	int start_D = 2;
+	return
+		8 + // first byte simply copied
+		cost[1][start_D - 1];
+};
 
-            result[D] = 1 + 8 + cost[pos + 1][D];
-            resultOp[D] = Backref(false, -1, 0, D+1);
+// DP loop of Preprocess() for small inputs. input[q..] matches input[pos..] for one byte
+// more than input[q + 1..] matches input[pos + 1..] if input[q] == input[pos], none otherwise,
+// so every position updates the row of match lengths in one pass instead of Z-function.
+// Match finding is too short here to time apart from DP, so it is all PHASE_DP.
+// Returns false if cancelled.
+bool OptimalCompressor::solveSmall()
+{
+	WORD len[SMALL_INPUT_SIZE + 1]; // len[q]: how many bytes from q match bytes from pos, q < pos
+	for (int q = 0; q <= inputSize; q++)
+		len[q] = 0;
 
-            // try copy 12, 14..42 bytes
+	for (int pos = inputSize - 1; pos >= 1; pos--)
+	{
+		if (ProgressReport)
+		{
+			if (ProgressReport->IsCancelled())
+				return false;
+			if ((pos & 0x1FF) == 0)
+				ProgressReport->Report(pos);
+		}
 
-            for (int i = 0; i < 16; i++)
-            {
-                int cnt = i * 2 + 12;
-                if (pos + cnt > inputSize) {
-					break;
-				}
-                int t = 7 + 4 + cnt * 8 + cost[pos + cnt][D];
-				if (t < result[D]) { 
-					result[D] = t; resultOp[D] = Backref(false, -cnt, 0, D+1); 
-				}
-            }
+		byte c = input[pos];
+		for (int q = 0; q < pos; q++)
+			len[q] = (input[q] == c) ? len[q + 1] + 1 : 0;
+		PROFILE_COUNT(WORK_Z_COMPARES, pos);
+
+		// as fill_matchLen_periodic
+		int period = runPeriod[pos];
+		for (int k = 1; k < period; k++)
+			if (len[pos - k] > RUN_DIRECT_CNT)
+				period = 0;
+		collectMatches(pos, period, len, inputSize - pos, matchSteps);
+
+		solveKernel<true>(pos, matchSteps);
+	}
+	return true;
+}
+
+// Compressed size in bits of the optimal parse, when cost is not size
+int OptimalCompressor::getSolutionBits()
+{
+	int bits = 8; // first byte simply copied
+	int D = 2;
+	for (int pos = 1; pos < inputSize; )
+	{
+		Backref op = solution[pos][D - 1];
+		if (op.Count < 0)
+		{
+			int cnt = -op.Count;
+			bits += (cnt == 1) ? 1 + 8 : 7 + 4 + cnt * 8;
+			pos += cnt;
+		}
+		else if (op.IsRIR)
+		{
+			bits += op.GetEncodedLen();
+			pos += 3;
+		}
+		else
+		{
+			if (op.Count >= 3)
+			{
+				bits += ((op.D - D) & 7) * CHANGE_D_LEN;
+				D = op.D;
+			}
+			bits += op.GetEncodedLen();
+			pos += op.Count;
+		}
+	}
+	return bits;
+}
 
-            // try RIR
+// Cost of backref or RIR under Objective, without the literal byte of RIR
+inline int OptimalCompressor::getBackrefCost(Backref& br)
+{
+	int len = br.GetEncodedLen();
+	if (tape)
+		return len + br.GetEncodedOnes();
+	if (depack && len < 0x0FFFFFFF) // not impossible
+		return len * BitTime + br.GetDepackTime();
+	return len;
+}
 
-            for (int copyPos = pos - 1; copyPos >= 0; copyPos--)
+// Costs of copying 1 byte and 12, 14..42 bytes (runCost, 16 entries) at 'pos', the same for any D.
+// Runs beyond input end are left out.
+void OptimalCompressor::getLiteralCosts(int pos, int* literalCost, int* runCost)
+{
+	*literalCost = 1 + 8;
+	if (depack)
+		*literalCost = (1 + 8) * BitTime + getDepackTime(1, 1, 1);
+	int ones = 0;
+	if (tape)
+	{
+		*literalCost += 1 + countOnes(input[pos]);
+		for (int i = 0; i < 12 - 2 && pos + i < inputSize; i++)
+			ones += countOnes(input[pos + i]);
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		int cnt = i * 2 + 12;
+		if (pos + cnt > inputSize)
+			break;
+		runCost[i] = 7 + 4 + cnt * 8;
+		if (depack)
+			runCost[i] = runCost[i] * BitTime + getDepackTime(7 + 4, 0, cnt); // bytes are copied by LDIR
+		if (tape)
+		{
+			ones += countOnes(input[pos + cnt - 2]) + countOnes(input[pos + cnt - 1]);
+			runCost[i] += 3 + countOnes(i) + ones; // 0110001, count
+		}
+	}
+}
+
+// Finds matches and optimal ops for position 'pos' (for every value of D register).
+// All positions after 'pos' must be solved already.
+void OptimalCompressor::solvePosition(int pos)
+{
+	PhaseTimer matchTimer(Timing, PHASE_MATCH);
+	findMatches(pos, matchLen, matchSteps);
+	matchTimer.Stop();
+
+	solvePosition(pos, matchSteps);
+};
+
+// Finds backref candidates for position 'pos'. Depends only on input, so it can
+// run on any thread, ahead of DP. 'matchLen' is scratch space.
+void OptimalCompressor::findMatches(int pos, int* matchLen, MatchSteps& steps)
+{
+	int period = runPeriod[pos];
+	if (period && !fill_matchLen_periodic(pos, period, matchLen))
+		period = 0;
+	if (!period)
+		fill_matchLen(pos, matchLen);
+	collectMatches(pos, period, matchLen, 0, steps);
+};
+
+// Turns match lengths at each distance (matchLen[inputSize - distance - base]) into backref
+// candidates. With 'period', lengths are needed up to that distance only.
+template <typename Index>
+void OptimalCompressor::collectMatches(int pos, int period, const Index* matchLen, int base, MatchSteps& steps)
+{
+	steps.Period = period;
+
+	// backref loop takes the nearest distance for every count
+	int maxCnt = min(min(period ? RUN_DIRECT_CNT : 0xEFF, maxCount), inputSize - pos);
+	int minDist = -min(pos, maxDist);
+	int cnt = 0;
+	steps.Count = 0;
+	for (int dist = -1; dist >= minDist && cnt < maxCnt; dist--)
+	{
+		int matchCnt = matchLen[dist + inputSize - base];
+		if (matchCnt > cnt)
+		{
+			cnt = min(matchCnt, maxCnt);
+			steps.Dist[steps.Count] = (WORD)-dist;
+			steps.Cnt[steps.Count] = (WORD)cnt;
+			steps.Count++;
+		}
+	}
+};
+
+// Finds optimal ops for position 'pos' (for every value of D register) given its matches.
+// All positions after 'pos' must be solved already.
+void OptimalCompressor::solvePosition(int pos, const MatchSteps& steps)
+{
+	if (small)
+		solveKernel<true>(pos, steps);
+	else
+		solveKernel<false>(pos, steps);
+}
+
+// solvePosition() for inputs of any size, or for small ones with D loops of one pass
+template <bool SMALL>
+void OptimalCompressor::solveKernel(int pos, const MatchSteps& steps)
+{
+    int* result = cost[pos];
+	Backref* resultOp = solution[pos];
+	PROFILE_COUNT(WORK_POSITIONS, 1);
+	const int lastD = SMALL ? 2 - 1 : maxD - 1;
+	const bool cycleD = !SMALL && (maxD == 8); // otherwise D only grows
+	int literalCost, runCost[16];
+	getLiteralCosts(pos, &literalCost, runCost);
+
+	// try all possible values of D register
+    for (byte D = 2 - 1; D <= lastD; D++)
+    {
+        // try copy 1 byte
+
+        result[D] = literalCost + cost[pos + 1][D];
+        resultOp[D] = Backref(false, -1, 0, D+1);
+
+        // try copy 12, 14..42 bytes
+
+        for (int i = 0; i < 16 && !Constraints.NoLiteralRuns; i++)
+        {
+            int cnt = i * 2 + 12;
+            if (pos + cnt > inputSize) {
+				break;
+			}
+            int t = runCost[i] + cost[pos + cnt][D];
+			PROFILE_COUNT(WORK_LITERAL_CANDIDATES, 1);
+			if (t < result[D]) { 
+				result[D] = t; resultOp[D] = Backref(false, -cnt, 0, D+1); 
+			}
+        }
+
+        // try RIR
+
+        for (int copyPos = pos - 1; copyPos >= 0 && !Constraints.NoRIR; copyPos--)
+        {
+            int dist = copyPos - pos;
+            if (dist < -79 || dist < -maxDist) {
+				break;
+			}
+            int hl = copyPos;
+            int de = pos;
+            if (de + 3 > inputSize) {
+				break;
+			}
+            if (input[hl] == input[de] && input[hl + 2] == input[de + 2])
             {
-                int dist = copyPos - pos;
-                if (dist < -79) {
-					break;
-				}
-                int hl = copyPos;
-                int de = pos;
-                if (de + 3 > inputSize) {
-					break;
+                Backref br(true, 3, dist, 0);
+				PROFILE_COUNT(WORK_RIR_CANDIDATES, 1);
+                int t = getBackrefCost(br) + cost[pos + 3][D];
+				if (tape)
+					t += countOnes(input[de + 1]);
+                if (t < result[D]) { 
+					result[D] = t; resultOp[D] = br; 
 				}
-                if (input[hl] == input[de] && input[hl + 2] == input[de + 2])
-                {
-                    Backref br(true, 3, dist, 0);
-                    int t = br.GetEncodedLen() + cost[pos + 3][D];
-                    if (t < result[D]) { 
-						result[D] = t; resultOp[D] = br; 
-					}
-                    break;
-                }
+                break;
             }
         }
+    }
 
-        // try backreferences
+    // try backreferences
 
+    {
+        int cnt = 0;
+        int nextPos = pos;
+        for (int i = 0; i < steps.Count; i++)
         {
-			fill_matchLen(pos);
-            int cnt = 0;
-            int nextPos = pos;
-            for (int dist = -1; dist >= -pos; dist--)
+            int dist = -steps.Dist[i];
+            int matchCnt = steps.Cnt[i]; // already limited by input end and backref cnt limit
+
+            while (cnt + 1 <= matchCnt)
             {
-                int matchCnt = matchLen[dist + inputSize];
+                cnt++;
+                nextPos++;
 
-                while (cnt + 1 <= matchCnt)
+                for (int new_D = 2 - 1; new_D <= lastD; new_D++)
                 {
-                    if (nextPos >= inputSize) {
-						goto break_dist_loop;
-					}
-                    if (cnt >= 0xEFF) { // backref cnt limit
-						goto break_dist_loop;
-					}
-                    cnt++;
-                    nextPos++;
-
-                    for (int new_D = 2 - 1; new_D <= 8 - 1; new_D++)
+                    Backref br(false, cnt, dist, new_D + 1);
+                    int t2 = getBackrefCost(br) + cost[nextPos][new_D];
+					int maxOldD = cycleD ? lastD : new_D;
+					PROFILE_COUNT(WORK_BACKREF_CANDIDATES, 1);
+					PROFILE_COUNT(WORK_D_RELAXATIONS, maxOldD);
+                    for (int D = 2 - 1; D <= maxOldD; D++)
                     {
-                        Backref br(false, cnt, dist, new_D + 1);
-                        int t2 = br.GetEncodedLen() + cost[nextPos][new_D];
-                        //for (int D = 2 - 1; D <= new_D; D++) // this loop version disables D cycling
-                        for (int D = 2 - 1; D <= 8 - 1; D++)
-                        {
-							int D_change_cost = ((new_D - D) & 7) * CHANGE_D_LEN;
-                            int t = D_change_cost + t2;
-                            if (t < result[D]) { 
-								result[D] = t; resultOp[D] = br; 
-							}
-                        }
-					}
+						int D_change_cost = ((new_D - D) & 7) * changeDCost;
+                        int t = D_change_cost + t2;
+                        if (t < result[D]) { 
+							result[D] = t; resultOp[D] = br; 
+						}
+                    }
 				}
-            }
-			break_dist_loop: ;
+			}
         }
+
+		if (steps.Period)
+			solveRunBackrefs(pos, steps.Period);
     }
+};
 
-	// return compressed size in bits
+// For every position finds the smallest period of data starting there, which lasts
+// at least as far as the longest possible backref reaches.
+void OptimalCompressor::fill_runPeriod()
+{
+	int run[RUN_MAX_PERIOD + 1]; // run[p]: how many bytes from pos repeat ones at pos-p
+	for (int p = 1; p <= RUN_MAX_PERIOD; p++)
+		run[p] = 0;
 
-	int start_D = 2;
-	return
-		8 + // first byte simply copied
-		cost[1][start_D - 1];
-};
+	for (int pos = inputSize - 1; pos >= 1; pos--)
+	{
+		int maxCnt = min(maxCount, inputSize - pos);
+		runPeriod[pos] = 0;
+		for (int p = RUN_MAX_PERIOD; p >= 1; p--)
+		{
+			run[p] = (p <= pos && input[pos] == input[pos - p]) ? run[p] + 1 : 0;
+			if (run[p] >= maxCnt && p <= maxDist)
+				runPeriod[pos] = (byte)p;
+		}
+	}
+}
+
+// fill_matchLen for position with runPeriod. Only distances -1..-period are filled,
+// because backref loop reaches its count limit at -period.
+// Returns false if a shorter distance has match longer than RUN_DIRECT_CNT,
+// then the position must be solved the usual way.
+bool OptimalCompressor::fill_matchLen_periodic(int pos, int period, int* matchLen)
+{
+	for (int k = 1; k < period; k++)
+	{
+		// data differs from period k before the farthest backref end (runPeriod guarantees it)
+		int len = 0;
+		while (input[pos - k + len] == input[pos + len])
+		{
+			len++;
+			PROFILE_COUNT(WORK_Z_COMPARES, 1);
+			if (len > RUN_DIRECT_CNT)
+				return false;
+		}
+		PROFILE_COUNT(WORK_Z_COMPARES, 1);
+		matchLen[inputSize - k] = len;
+	}
+	matchLen[inputSize - period] = inputSize; // longer than any backref
+	return true;
+}
+
+// Moves runWindows to cover counts from runWindowCnt at position 'pos'.
+// Consecutive positions slide windows by one, otherwise they are rebuilt.
+void OptimalCompressor::slideRunWindows(int pos)
+{
+	bool rebuild = (runWindowsPos != pos + 1);
+	runWindowsPos = pos;
+
+	for (int w = 0; w < 2; w++)
+	{
+		int lo = pos + runWindowCnt[w][0];
+		int hi = min(pos + min(runWindowCnt[w][1], maxCount), inputSize); // empty if lo > hi
+		for (int D = 2 - 1; D <= maxD - 1; D++)
+		{
+			RunWindow& win = runWindows[w][D];
+			int from = lo;
+			if (rebuild)
+			{
+				win.Head = win.Tail = 0;
+				from = hi;
+			}
+			// newly added positions are the lowest; worse or equal costs behind them are dropped.
+			// Near the end lo may be past hi, then nothing is added.
+			for (int q = min(from, hi); q >= lo; q--)
+			{
+				int key = cost[q][D] + copyCost * q;
+				while (win.Tail != win.Head)
+				{
+					int last = win.Pos[(win.Tail - 1) & 0xFFF];
+					if (cost[last][D] + copyCost * last < key)
+						break;
+					win.Tail--;
+				}
+				win.Pos[win.Tail++ & 0xFFF] = (WORD)q;
+			}
+			while (win.Tail != win.Head && win.Pos[win.Head & 0xFFF] > hi)
+				win.Head++;
+		}
+	}
+}
+
+// Backrefs longer than RUN_DIRECT_CNT at position with runPeriod, all at distance -period.
+// Gives the same ops as the backref loop: for every D the first best candidate
+// in loop order (by count, then by new D) wins, and only if strictly better.
+// Under OBJECTIVE_TAPE_TIME 1 bits of the count make candidates of a window differ
+// by a few bits more than cost after them, so the window minimum may be that far from best.
+void OptimalCompressor::solveRunBackrefs(int pos, int period)
+{
+	int* result = cost[pos];
+	Backref* resultOp = solution[pos];
+
+	slideRunWindows(pos);
+	int lastD = maxD - 1;
+	bool cycleD = (maxD == 8);
+
+	for (int w = 0; w < 2; w++)
+	{
+		int t2[8];
+		int cnt[8];
+		bool empty = false;
+		for (int new_D = 2 - 1; new_D <= lastD; new_D++)
+		{
+			RunWindow& win = runWindows[w][new_D];
+			if (win.Tail == win.Head) {
+				empty = true;
+				break;
+			}
+			int q = win.Pos[win.Head & 0xFFF];
+			cnt[new_D] = q - pos;
+			Backref br(false, cnt[new_D], -period, new_D + 1);
+			t2[new_D] = getBackrefCost(br) + cost[q][new_D];
+			PROFILE_COUNT(WORK_BACKREF_CANDIDATES, 1);
+		}
+		if (empty)
+			break; // window is beyond input end, and so is the next one
+
+		for (int D = 2 - 1; D <= lastD; D++)
+		{
+			int best = -1, bestT = 0;
+			for (int new_D = cycleD ? 2 - 1 : D; new_D <= lastD; new_D++)
+			{
+				int t = ((new_D - D) & 7) * changeDCost + t2[new_D];
+				if (best < 0 || t < bestT || (t == bestT && cnt[new_D] < cnt[best])) {
+					best = new_D; bestT = t;
+				}
+			}
+			PROFILE_COUNT(WORK_D_RELAXATIONS, lastD - (cycleD ? 0 : D - 1));
+			if (bestT < result[D]) {
+				result[D] = bestT; resultOp[D] = Backref(false, cnt[best], -period, best + 1);
+			}
+		}
+	}
+}
 
 // Finds longest match for every possible reference distance
-void OptimalCompressor::fill_matchLen(int pos)
+void OptimalCompressor::fill_matchLen(int pos, int* matchLen)
 {
     if (pos >= inputSize) throw;
 
@@ -551,7 +1326,9 @@ void OptimalCompressor::fill_matchLen(int pos)
         while (i + zi < n && s[i + zi] == s[zi])
         {
             zi++;
+			PROFILE_COUNT(WORK_Z_COMPARES, 1);
         }
+		PROFILE_COUNT(WORK_Z_COMPARES, (i + zi < n) ? 1 : 0); // the failed one
 
         if (i + zi - 1 > r)
         {
@@ -571,20 +1348,22 @@ int Backref::GetEncodedLen()
     //if (Dist >= 0) throw;
 
 	#define infinity 0x0FFFFFFF
-	#define impossible infinity
+	#define impossible (PROFILE_COUNT(WORK_ENCODED_IMPOSSIBLE, 1), infinity)
 
     if (IsRIR)
     {
+		PROFILE_COUNT(WORK_ENCODED_RIR, 1);
         if (Dist >= -16) return 6 + 4 + 8;
         if (Dist >= -79) return 5 + 8 + 8; // alternative: 3+2+8+8
         throw; // should never happen
     }
     else
     {
-        if (Count == 1) return (Dist >= -8) ? 6 : impossible;
+        if (Count == 1) return PROFILE_COUNT(WORK_ENCODED_COUNT1, 1), (Dist >= -8) ? 6 : impossible;
 
         if (Count == 2)
         {
+			PROFILE_COUNT(WORK_ENCODED_COUNT2, 1);
             if (Dist >= -32) return (5 + 5);
             //if (Dist >= -256) return (5 + 8);
             if (Dist >= -768) return (5 + 8);
@@ -597,6 +1376,7 @@ int Backref::GetEncodedLen()
             Count < 16 ? encodedCntLen[Count] :
             Count < 128 ? 7 + 7 :
             7 + 7 + 8;
+		PROFILE_COUNT(Count < 16 ? WORK_ENCODED_SHORT_COUNT : Count < 128 ? WORK_ENCODED_MEDIUM_COUNT : WORK_ENCODED_LONG_COUNT, 1);
 
         int distBits;
         if (Dist >= -32) distBits = 2 + 5;
@@ -618,3 +1398,51 @@ int Backref::GetEncodedLen()
 	#undef impossible
 };
 
+// Follows Compressor::Compress_Emit()
+int Backref::GetEncodedOnes()
+{
+    if (IsRIR)
+    {
+        if (Dist >= -16) return 3 + countOnes(Dist & 15); // 0 11001
+        int t = (((Dist + 16 - 1) ^ ((Dist & 1) ? 3 : 2)) - 1) >> 1;
+        return 2 + countOnes(t & 0xFF); // 0 0110 or 0 1001, byte
+    }
+
+    if (Count == 1) return countOnes(Dist & 7); // 000
+    if (Count == 2)
+    {
+        if (Dist >= -32) return 3 + countOnes(Dist & 31); // 001 11
+        if (Dist >= -512) return 2 + countOnes(Dist & 0xFF); // 001 10 or 001 01
+        return 1 + countOnes(Dist & 0xFF); // 001 00
+    }
+
+    int cntOnes;
+    if (Count == 3) cntOnes = 1; // 0 10
+    else if (Count < 16)
+    {
+        cntOnes = 0;
+        for (int cnt = Count; cnt >= 0; cnt -= 3)
+            cntOnes += countOnes(min(cnt, 3));
+    }
+    else if (Count < 128) cntOnes = 2 + countOnes(Count); // 0 110000
+    else cntOnes = 2 + countOnes((Count >> 8) & 0x7F) + countOnes(Count & 0xFF);
+
+    int distOnes;
+    if (Dist >= -32) distOnes = 1 + countOnes(Dist & 31); // 10
+    else if (Dist >= -256) distOnes = 1 + countOnes(Dist & 0xFF); // 01
+    else if (Dist >= -512) distOnes = countOnes(Dist & 0xFF); // 00
+    else distOnes = 2 + countOnes((Dist >> 8) & ((1 << D) - 1)) + countOnes(Dist & 0xFF); // 11
+
+    return cntOnes + distOnes;
+};
+
+int Backref::GetDepackTime()
+{
+    int bytes; // data bytes of the encoding
+    if (IsRIR) bytes = (Dist >= -16) ? 1 : 2;
+    else if (Count == 1) bytes = 0;
+    else if (Count == 2) bytes = (Dist >= -32) ? 0 : 1;
+    else bytes = (Count >= 128 ? 1 : 0) + (Dist >= -32 ? 0 : 1);
+    return getDepackTime(GetEncodedLen() - bytes * 8, bytes, IsRIR ? 3 : Count);
+};
+
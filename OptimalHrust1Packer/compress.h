@@ -1,16 +1,23 @@
 
 #pragma once
 
-#include <Windows.h>
+#include "platform.h"
 #include "progressReport.h"
+#include "timing.h"
 
 const int MAX_INPUT_SIZE = 0xFFFF;
 
+// DP input size (without the last 6 bytes) up to which every distance is within -1024,
+// where long_far with D = 2 reaches. Smaller inputs get their own DP and match kernels.
+const int SMALL_INPUT_SIZE = 1024 + 1;
+
 enum COMPRESS_RESULT
 {
 	OK,
 	IMPOSSIBLE_TOO_SMALL,  // can't compress files smaller than 7 bytes
-	IMPOSSIBLE_TOO_BAD     // compressed size is above 0xFFFF, can't make header
+	IMPOSSIBLE_TOO_BAD,    // compressed size is above 0xFFFF, can't make header
+	CANCELLED,             // stopped via ProgressReport.Cancellation
+	INVALID_PARSE          // Compressor::Parse doesn't fit input or format, see CheckParse()
 };
 
 // sizeof(Backref) = 8
@@ -27,8 +34,52 @@ struct Backref
 		: IsRIR(isRIR), Dist(dist), Count(short(count)), D(byte(D)) {};
 
 	int GetEncodedLen();
+	int GetEncodedOnes(); // 1 bits among GetEncodedLen() ones, except the literal byte of RIR
+	int GetDepackTime();  // estimated T-states the Z80 depacker takes on it
 };
 
+// What the DP minimizes
+enum PARSE_OBJECTIVE
+{
+	OBJECTIVE_SIZE,     // compressed size in bits
+	OBJECTIVE_TAPE_TIME, // ROM tape loader time: a 1 bit takes twice as long as a 0 bit
+	OBJECTIVE_DEPACK_TIME // estimated Z80 depacking time in T-states plus BitTime for every bit of size
+};
+
+// ROM tape loader reads a 0 bit as two 855 T-state pulses and a 1 bit as two twice as long ones
+const int TAPE_ZERO_BIT_TSTATES = 2 * 855;
+const double ZX_CPU_CLOCK = 3500000;
+
+// Time the ROM loader takes to read 'size' bytes, in 0 bits (a 1 bit counts as two).
+// Pilot tone, flag and checksum bytes are not counted.
+int GetTapeLoadTime(const byte* data, int size);
+
+// Limits on ops the DP may choose, so that a smaller or faster depacker (one without
+// some paths) can unpack the result. The parse is optimal among those that keep them.
+// Zero-initialized means no limits.
+struct ParseConstraints
+{
+	bool NoRIR;
+	bool NoLiteralRuns; // 12..42 bytes
+	int MaxD;           // largest value of D register, 2..8. Below 8 D only grows, as cycling goes through 8.
+	int MaxDist;        // longest backref or RIR distance
+	int MaxCount;       // longest backref
+
+	ParseConstraints();
+};
+
+// Backref candidates of one position, found by match finding. Backref loop takes
+// counts from previous step's Cnt + 1 up to Cnt at distance -Dist of each step.
+struct MatchSteps
+{
+	int Period; // runPeriod, if longer backrefs are left to run fast path
+	int Count;
+	WORD Dist[0xEFF];
+	WORD Cnt[0xEFF];
+};
+
+class MatchPipeline;
+
 class OptimalCompressor
 {
 private:
@@ -37,27 +88,118 @@ private:
 	int inputOffset;
 	byte input[MAX_INPUT_SIZE * 2];
 
+	// Constraints with format limits in place of zeros, set by Preprocess()
+	int maxD;
+	int maxDist;
+	int maxCount;
+
+	// Cost model of Objective, set by Preprocess()
+	bool tape;        // OBJECTIVE_TAPE_TIME: 1 bits count twice
+	bool depack;      // OBJECTIVE_DEPACK_TIME: bits count BitTime times, plus depacking time
+	int changeDCost;  // of one D change
+	int copyCost;     // of every byte depacked by backrefs, so that windows of the run fast path compare the rest
+	int getBackrefCost(Backref& br);
+	void getLiteralCosts(int pos, int* literalCost, int* runCost);
+	int getSolutionBits();
+
 	int cost[MAX_INPUT_SIZE + 1][8];
 	Backref solution[MAX_INPUT_SIZE + 1][8];
 
 	int matchLen[MAX_INPUT_SIZE];
-	void fill_matchLen(int pos);
+	MatchSteps matchSteps;
+	void fill_matchLen(int pos, int* matchLen);
+	void findMatches(int pos, int* matchLen, MatchSteps& steps);
+	template <typename Index> void collectMatches(int pos, int period, const Index* matchLen, int base, MatchSteps& steps);
+	void solvePosition(int pos);
+	void solvePosition(int pos, const MatchSteps& steps);
+	friend class MatchPipeline;
+
+	// Small inputs (up to SMALL_INPUT_SIZE): D = 2 reaches every distance at the lowest
+	// cost, so no D change is ever useful and DP solves D = 2 only (maxD is 2). Match
+	// lengths of each position follow from those of the next one in a WORD row on stack.
+	bool small;
+	bool solveSmall();
+	template <bool SMALL> void solveKernel(int pos, const MatchSteps& steps);
+
+	// Run fast path. In zero-filled and short-period regions every position has matches
+	// up to the count limit, all longer than 15 at the same distance. Backrefs with counts
+	// 16..127 and 128..0xEFF are then solved with sliding window minimums of cost.
+	byte runPeriod[MAX_INPUT_SIZE]; // smallest period (1..RUN_MAX_PERIOD) of data from pos to the farthest backref end, 0 if none
+	struct RunWindow
+	{
+		WORD Pos[0x1000]; // circular, from Head (highest pos) to Tail; cost (plus copyCost) strictly decreases towards Head
+		int Head, Tail;
+	};
+	RunWindow runWindows[2][8];
+	int runWindowsPos; // position runWindows are set for
+	void fill_runPeriod();
+	bool fill_matchLen_periodic(int pos, int period, int* matchLen);
+	void slideRunWindows(int pos);
+	void solveRunBackrefs(int pos, int period);
+
+	friend class KernelBench; // Benchmark/kernels*.cpp
 
 public:
 
-	ProgressReport* ProgressReport;
+	::ProgressReport* ProgressReport;
+	PhaseTimes* Timing; // accumulates match finding time if not NULL
+	int MatchThreads;   // if above 1, matches are found ahead of DP on this many threads
+	ParseConstraints Constraints;
+	PARSE_OBJECTIVE Objective;
+	int BitTime;
 
 	OptimalCompressor() {};
 	void Init(byte* input, int inputSize);
-	int Preprocess(); // returns compressed size in bits
+	int Preprocess(); // returns compressed size in bits of the parse optimal under Objective, or -1 if cancelled
 	Backref GetOptimalOp(int pos, int dd);
 };
 
+// Kinds of ops in a compressed stream, for --stats
+enum OP_KIND
+{
+	OP_HEADER,      // header and last 6 bytes
+	OP_LITERAL,
+	OP_LITERAL_RUN, // 12..42 bytes
+	OP_REF1,
+	OP_REF2_NEAR,
+	OP_REF2_FAR,
+	OP_LONG_32,     // count 3..0xEFF
+	OP_LONG_256,
+	OP_LONG_512,
+	OP_LONG_FAR,    // high distance bits as set by D
+	OP_RIR,
+	OP_D_CHANGE,
+	OP_END,
+	OP_PADDING,     // unused bits of the last control word
+	OP_KIND_COUNT
+};
+
+extern const char* const OpKindNames[OP_KIND_COUNT];
+
+// What each kind of op takes in the output of Compress_Emit()
+struct OpStats
+{
+	int Count[OP_KIND_COUNT];
+	int ControlBits[OP_KIND_COUNT];
+	int DataBytes[OP_KIND_COUNT];
+
+	// Smallest and largest number of bytes produced by one op and distance (positive)
+	// of each kind, 0 if there are none. Tell which depacker paths a stream needs.
+	int MinCount[OP_KIND_COUNT];
+	int MaxCount[OP_KIND_COUNT];
+	int MinDist[OP_KIND_COUNT];
+	int MaxDist[OP_KIND_COUNT];
+
+	OpStats();
+	void AddOp(OP_KIND kind, int count, int dist);
+};
+
 class Compressor
 {
 private:
 
 	OptimalCompressor optimalCompressor;
+	friend class KernelBench;
 
 	byte* outputPtr;
 	void emitByte(int byte);
@@ -67,6 +209,11 @@ private:
 	void emitBit(int bit);
 	void finalizeBitFlow();
 
+	OP_KIND opKind; // of bits and bytes being emitted, for Stats
+	int getEmittedBits();
+	void setByteCosts(int pos, int cnt, int bits);
+	static OP_KIND getOpKind(const Backref& op);
+
 	void emitLargeCnt(int cnt);
 	void emitLongDist(int dist, int dd);
 
@@ -79,15 +226,41 @@ public:
 	byte Output[maxOutputSize];
 	int OutputSize;
 	COMPRESS_RESULT Result;
+	int DepackTime; // estimated T-states the Z80 depacker takes on ops of Output (see Backref::GetDepackTime)
 
 	Compressor();
-	void Compressor::TryCompress();
+	void TryCompress();
+
+	::ProgressReport ProgressReport;
+	PhaseTimes* Timing; // receives time of match finding, DP and emit if not NULL
+	int MatchThreads;   // threads finding matches ahead of DP; output doesn't depend on it
+	ParseConstraints Constraints; // limits on ops the DP chooses, none by default
+	PARSE_OBJECTIVE Objective;    // what the DP minimizes, size by default
+	int BitTime;                  // OBJECTIVE_DEPACK_TIME: T-states of depacking one bit of size is worth
+	OpStats* Stats;     // filled by Compress_Emit if not NULL
+	float* ByteCosts;   // InputSize entries, receive bits spent on each input byte by Compress_Emit if not NULL
+
+	// Ops to emit instead of solving DP, for positions 1..InputSize-6 (the first and last
+	// 6 bytes are stored), if not NULL. Lets a parse be saved and emitted again later.
+	const Backref* Parse;
+	int ParseSize;
+
+	// Checks Parse against Input and format limits. Returns its compressed size in bits
+	// (as OptimalCompressor::Preprocess), or -1 with the reason and op index in *error, *badOp.
+	int CheckParse(const char** error, int* badOp);
+
+	// Copies ops emitted by the last TryCompress() to ops (MAX_INPUT_SIZE entries), returns their number
+	int GetParse(Backref* ops);
 
-	ProgressReport ProgressReport;
+	// Solves DP for Input (at least 7 bytes) under 'constraints' and Objective and returns compressed size in bits
+	// (as OptimalCompressor::Preprocess), or -1 if cancelled. Measures what constraints cost:
+	// TryCompress() solves again with Constraints.
+	int Solve(const ParseConstraints& constraints);
 
 private:
 
 	// approximate (may be 1 byte less) compressed size in bytes. Set by Compress_Preprocess().
+	// Negative if compression was cancelled.
 	int compressedSizePrecalc;
 
 	// Performs actual compression but doesn't output compressed data yet
@@ -0,0 +1,672 @@
+
+#include "decompress.h"
+
+// Control bits come in 16-bit little endian words, most significant bit first.
+// Compressor reserves next word as soon as the current one is full, before any data
+// bytes that follow, so it is read right after the last bit is taken.
+inline void Decompressor::nextControlWord()
+{
+	if (inputEnd - inputPtr < 2)
+	{
+		// end of stream; the empty last word is not stored
+		controlBitsCnt = 0;
+		return;
+	}
+	controlWord = (unsigned(inputPtr[0]) | unsigned(inputPtr[1]) << 8) << 16;
+	controlBitsCnt = 16;
+	inputPtr += 2;
+}
+
+inline int Decompressor::getBit()
+{
+	if (controlBitsCnt == 0)
+	{
+		overrun = true;
+		return 0;
+	}
+	int bit = controlWord >> 31;
+	controlWord <<= 1;
+	if (--controlBitsCnt == 0)
+		nextControlWord();
+	return bit;
+}
+
+inline int Decompressor::getBits(int n)
+{
+	if (n > controlBitsCnt)
+	{
+		// crosses control word boundary
+		if (controlBitsCnt == 0)
+		{
+			overrun = true;
+			return 0;
+		}
+		int k = controlBitsCnt;
+		int hi = getBits(k);
+		return (hi << (n - k)) | getBits(n - k);
+	}
+	int r = controlWord >> (32 - n);
+	controlWord <<= n;
+	controlBitsCnt -= n;
+	if (controlBitsCnt == 0)
+		nextControlWord();
+	return r;
+}
+
+inline int Decompressor::getByte()
+{
+	if (inputPtr == inputEnd)
+	{
+		overrun = true;
+		return 0;
+	}
+	return *inputPtr++;
+}
+
+void CopyBackref(byte* dst, int dist, int cnt)
+{
+	const byte* src = dst + dist;
+	if (cnt <= 3)
+	{
+		// most backrefs are short
+		for (int i = 0; i < cnt; i++) dst[i] = src[i];
+	}
+	else if (-dist >= cnt)
+	{
+		memcpy(dst, src, cnt);
+	}
+	else if (dist == -1)
+	{
+		memset(dst, *src, cnt);
+	}
+	else
+	{
+		// Copied part repeats the period, so each block may be as long as everything
+		// copied so far and never overlaps its source
+		int done = 0;
+		while (done < cnt)
+		{
+			int n = min(-dist + done, cnt - done);
+			memcpy(dst + done, src, n);
+			done += n;
+		}
+	}
+}
+
+DECOMPRESS_RESULT Decompressor::Decompress(const byte* input, int inputSize, byte* output, int* outputSize)
+{
+	*outputSize = 0;
+
+	// Header
+
+	if (inputSize < 6 + 6 + 2 + 1 || input[0] != 'H' || input[1] != 'R')
+		return DECOMPRESS_BAD_HEADER;
+	int unpackedSize = input[2] | input[3] << 8;
+	int packedSize = input[4] | input[5] << 8;
+	if (unpackedSize < 6 + 1 || packedSize < 6 + 6 + 2 + 1 || packedSize > inputSize)
+		return DECOMPRESS_BAD_HEADER;
+
+	// last 6 bytes are stored as is
+	memcpy(&output[unpackedSize - 6], &input[6], 6);
+
+	inputPtr = &input[12];
+	inputEnd = &input[packedSize];
+	overrun = false;
+	nextControlWord();
+
+	byte* outputPtr = output;
+	byte* outputEnd = &output[unpackedSize - 6];
+
+	*outputPtr++ = (byte)getByte(); // first byte is simply copied
+
+	// value of D register that controls maximum reference distance
+	int D = 2;
+
+	while (true)
+	{
+		if (overrun)
+			return DECOMPRESS_CORRUPT;
+
+		if (getBit())
+		{
+			// copy 1 byte
+			if (outputPtr == outputEnd) return DECOMPRESS_CORRUPT;
+			*outputPtr++ = (byte)getByte();
+			continue;
+		}
+
+		int cnt;
+		int dist;
+		bool isRIR = false;
+
+		if (!getBit())
+		{
+			if (!getBit())
+			{
+				cnt = 1;
+				dist = getBits(3) - 8;
+			}
+			else
+			{
+				cnt = 2;
+				int c = getBits(2);
+				if (c == 3)
+				{
+					dist = getBits(5) - 32;
+				}
+				else if (c == 2)
+				{
+					int t = getByte();
+					if (t < 0xE0)
+					{
+						dist = t - 256;
+					}
+					else if (t == 0xFE)
+					{
+						D = (D & 7) + 1;
+						continue;
+					}
+					else
+					{
+						// RIR with even distance
+						isRIR = true;
+						cnt = 3;
+						dist = (((t - 256) * 2 + 1) ^ 2) - 16 + 1;
+					}
+				}
+				else
+				{
+					dist = getByte() - ((c == 1) ? 512 : 768);
+				}
+			}
+		}
+		else
+		{
+			// count 3..0xEFF or one of special codes
+			if (!getBit())
+			{
+				cnt = 3;
+			}
+			else
+			{
+				int t = getBits(2);
+				if (t != 0)
+				{
+					// 4..15
+					cnt = 3 + t;
+					for (int i = 2; i < 5 && t == 3; i++)
+					{
+						t = getBits(2);
+						cnt += t;
+					}
+				}
+				else if (getBit())
+				{
+					// RIR with distance -16..-1
+					isRIR = true;
+					cnt = 3;
+					dist = getBits(4) - 16;
+				}
+				else if (getBit())
+				{
+					// copy 12..42 bytes
+					cnt = getBits(4) * 2 + 12;
+					if (cnt > outputEnd - outputPtr || cnt > inputEnd - inputPtr)
+						return DECOMPRESS_CORRUPT;
+					memcpy(outputPtr, inputPtr, cnt);
+					outputPtr += cnt;
+					inputPtr += cnt;
+					continue;
+				}
+				else
+				{
+					int h = getBits(7);
+					if (h == 15)
+					{
+						break; // end of stream marker
+					}
+					cnt = (h >= 16) ? h : (h << 8 | getByte());
+				}
+			}
+
+			if (!isRIR)
+			{
+				int c = getBits(2);
+				if (c == 2)
+				{
+					dist = getBits(5) - 32;
+				}
+				else if (c == 1)
+				{
+					int t = getByte();
+					if (t < 0xE0)
+					{
+						dist = t - 256;
+					}
+					else
+					{
+						// RIR with odd distance
+						if (cnt != 3) return DECOMPRESS_CORRUPT;
+						isRIR = true;
+						dist = (((t - 256) * 2 + 1) ^ 3) - 16 + 1;
+					}
+				}
+				else if (c == 0)
+				{
+					dist = getByte() - 512;
+				}
+				else
+				{
+					int H = getBits(D) - (1 << D);
+					dist = H * 256 + getByte();
+				}
+			}
+		}
+
+		if (overrun || cnt > outputEnd - outputPtr || -dist > outputPtr - output)
+			return DECOMPRESS_CORRUPT;
+
+		if (isRIR)
+		{
+			// ref + insert + ref
+			outputPtr[0] = outputPtr[dist];
+			outputPtr[1] = (byte)getByte();
+			outputPtr[2] = outputPtr[2 + dist];
+		}
+		else
+		{
+			CopyBackref(outputPtr, dist, cnt);
+		}
+		outputPtr += cnt;
+	}
+
+	if (overrun || outputPtr != outputEnd || inputPtr != inputEnd)
+		return DECOMPRESS_CORRUPT;
+
+	*outputSize = unpackedSize;
+	return DECOMPRESSED_OK;
+}
+
+// StreamDecompressor
+
+// Bit reader is the same as Decompressor's
+inline void StreamDecompressor::nextControlWord()
+{
+	if (inputEnd - inputPtr < 2)
+	{
+		controlBitsCnt = 0;
+		return;
+	}
+	controlWord = (unsigned(inputPtr[0]) | unsigned(inputPtr[1]) << 8) << 16;
+	controlBitsCnt = 16;
+	inputPtr += 2;
+}
+
+inline int StreamDecompressor::getBit()
+{
+	if (controlBitsCnt == 0)
+	{
+		overrun = true;
+		return 0;
+	}
+	int bit = controlWord >> 31;
+	controlWord <<= 1;
+	if (--controlBitsCnt == 0)
+		nextControlWord();
+	return bit;
+}
+
+inline int StreamDecompressor::getBits(int n)
+{
+	if (n > controlBitsCnt)
+	{
+		if (controlBitsCnt == 0)
+		{
+			overrun = true;
+			return 0;
+		}
+		int k = controlBitsCnt;
+		int hi = getBits(k);
+		return (hi << (n - k)) | getBits(n - k);
+	}
+	int r = controlWord >> (32 - n);
+	controlWord <<= n;
+	controlBitsCnt -= n;
+	if (controlBitsCnt == 0)
+		nextControlWord();
+	return r;
+}
+
+inline int StreamDecompressor::getByte()
+{
+	if (inputPtr == inputEnd)
+	{
+		overrun = true;
+		return 0;
+	}
+	return *inputPtr++;
+}
+
+StreamDecompressor::StreamDecompressor(byte* window, int windowSize)
+	: window(window), windowSize(windowSize), unpackedSize(0), finished(false), result(DECOMPRESS_BAD_HEADER)
+{
+}
+
+DECOMPRESS_RESULT StreamDecompressor::Start(const byte* input, int inputSize)
+{
+	unpackedSize = 0;
+	finished = false;
+	result = DECOMPRESS_BAD_HEADER;
+
+	if (inputSize < 6 + 6 + 2 + 1 || input[0] != 'H' || input[1] != 'R')
+		return result;
+	int packedSize = input[4] | input[5] << 8;
+	if ((input[2] | input[3] << 8) < 6 + 1 || packedSize < 6 + 6 + 2 + 1 || packedSize > inputSize)
+		return result;
+	unpackedSize = input[2] | input[3] << 8;
+
+	this->input = input;
+	inputPtr = &input[12];
+	inputEnd = &input[packedSize];
+	overrun = false;
+	nextControlWord();
+
+	windowPos = 0;
+	decodedSize = 0;
+	D = 2;
+	ended = false;
+	stepCnt = stepIdx = 0;
+	setSteps(0, 1); // first byte is simply copied
+
+	result = DECOMPRESSED_OK;
+	return result;
+}
+
+inline void StreamDecompressor::setSteps(int dist, int cnt)
+{
+	steps[0].Dist = dist;
+	steps[0].Cnt = cnt;
+	stepCnt = 1;
+	stepIdx = 0;
+	decodedSize += cnt;
+}
+
+// Same as a pass of Decompressor's loop, except that bytes go to steps
+void StreamDecompressor::decodeOp()
+{
+	if (ended)
+	{
+		finished = true;
+		return;
+	}
+
+	int outputLeft = unpackedSize - 6 - decodedSize;
+
+	while (true)
+	{
+		if (overrun)
+		{
+			result = DECOMPRESS_CORRUPT;
+			return;
+		}
+
+		if (getBit())
+		{
+			// copy 1 byte
+			if (outputLeft == 0 || inputPtr == inputEnd)
+			{
+				result = DECOMPRESS_CORRUPT;
+				return;
+			}
+			setSteps(0, 1);
+			return;
+		}
+
+		int cnt;
+		int dist;
+		bool isRIR = false;
+
+		if (!getBit())
+		{
+			if (!getBit())
+			{
+				cnt = 1;
+				dist = getBits(3) - 8;
+			}
+			else
+			{
+				cnt = 2;
+				int c = getBits(2);
+				if (c == 3)
+				{
+					dist = getBits(5) - 32;
+				}
+				else if (c == 2)
+				{
+					int t = getByte();
+					if (t < 0xE0)
+					{
+						dist = t - 256;
+					}
+					else if (t == 0xFE)
+					{
+						D = (D & 7) + 1;
+						continue;
+					}
+					else
+					{
+						isRIR = true;
+						cnt = 3;
+						dist = (((t - 256) * 2 + 1) ^ 2) - 16 + 1;
+					}
+				}
+				else
+				{
+					dist = getByte() - ((c == 1) ? 512 : 768);
+				}
+			}
+		}
+		else
+		{
+			if (!getBit())
+			{
+				cnt = 3;
+			}
+			else
+			{
+				int t = getBits(2);
+				if (t != 0)
+				{
+					cnt = 3 + t;
+					for (int i = 2; i < 5 && t == 3; i++)
+					{
+						t = getBits(2);
+						cnt += t;
+					}
+				}
+				else if (getBit())
+				{
+					isRIR = true;
+					cnt = 3;
+					dist = getBits(4) - 16;
+				}
+				else if (getBit())
+				{
+					// copy 12..42 bytes
+					cnt = getBits(4) * 2 + 12;
+					if (overrun || cnt > outputLeft || cnt > inputEnd - inputPtr)
+					{
+						result = DECOMPRESS_CORRUPT;
+						return;
+					}
+					setSteps(0, cnt);
+					return;
+				}
+				else
+				{
+					int h = getBits(7);
+					if (h == 15)
+					{
+						// end of stream marker; last 6 bytes come from header
+						if (overrun || outputLeft != 0 || inputPtr != inputEnd)
+						{
+							result = DECOMPRESS_CORRUPT;
+							return;
+						}
+						ended = true;
+						inputPtr = &input[6];
+						inputEnd = &input[12];
+						setSteps(0, 6);
+						return;
+					}
+					cnt = (h >= 16) ? h : (h << 8 | getByte());
+				}
+			}
+
+			if (!isRIR)
+			{
+				int c = getBits(2);
+				if (c == 2)
+				{
+					dist = getBits(5) - 32;
+				}
+				else if (c == 1)
+				{
+					int t = getByte();
+					if (t < 0xE0)
+					{
+						dist = t - 256;
+					}
+					else
+					{
+						if (cnt != 3)
+						{
+							result = DECOMPRESS_CORRUPT;
+							return;
+						}
+						isRIR = true;
+						dist = (((t - 256) * 2 + 1) ^ 3) - 16 + 1;
+					}
+				}
+				else if (c == 0)
+				{
+					dist = getByte() - 512;
+				}
+				else
+				{
+					int H = getBits(D) - (1 << D);
+					dist = H * 256 + getByte();
+				}
+			}
+		}
+
+		if (overrun || cnt > outputLeft || -dist > decodedSize || (isRIR && inputPtr == inputEnd))
+		{
+			result = DECOMPRESS_CORRUPT;
+			return;
+		}
+		if (-dist > windowSize)
+		{
+			result = DECOMPRESS_WINDOW_TOO_SMALL;
+			return;
+		}
+
+		if (isRIR)
+		{
+			// ref + insert + ref
+			setSteps(dist, 1);
+			steps[1].Dist = 0;
+			steps[1].Cnt = 1;
+			steps[2].Dist = dist;
+			steps[2].Cnt = 1;
+			stepCnt = 3;
+			decodedSize += 2;
+		}
+		else
+		{
+			setSteps(dist, cnt);
+		}
+		return;
+	}
+}
+
+// Takes 'cnt' bytes from input to 'output' and window
+inline void StreamDecompressor::putLiterals(byte* output, int cnt)
+{
+	if (cnt <= 3 && windowPos + cnt < windowSize)
+	{
+		// most literals are single bytes
+		for (int i = 0; i < cnt; i++) output[i] = window[windowPos + i] = inputPtr[i];
+		inputPtr += cnt;
+		windowPos += cnt;
+		return;
+	}
+	memcpy(output, inputPtr, cnt);
+	while (cnt > 0)
+	{
+		int n = min(cnt, windowSize - windowPos);
+		memcpy(&window[windowPos], inputPtr, n);
+		inputPtr += n;
+		cnt -= n;
+		windowPos += n;
+		if (windowPos == windowSize) windowPos = 0;
+	}
+}
+
+// Copies 'cnt' bytes from 'dist' back in window to window and 'output'
+inline void StreamDecompressor::putBackref(byte* output, int dist, int cnt)
+{
+	if (cnt <= 3 && windowPos + dist >= 0 && windowPos + cnt < windowSize)
+	{
+		// most backrefs are short
+		byte* dst = &window[windowPos];
+		for (int i = 0; i < cnt; i++) output[i] = dst[i] = dst[i + dist];
+		windowPos += cnt;
+		return;
+	}
+	while (cnt > 0)
+	{
+		int src = windowPos + dist;
+		int n;
+		if (src >= 0)
+		{
+			n = min(cnt, windowSize - windowPos);
+			CopyBackref(&window[windowPos], dist, n);
+		}
+		else
+		{
+			// source wraps: copy up to the end of the ring, all of it is older than this block
+			src += windowSize;
+			n = min(cnt, min(windowSize - src, windowSize - windowPos));
+			memmove(&window[windowPos], &window[src], n);
+		}
+		memcpy(output, &window[windowPos], n);
+		output += n;
+		cnt -= n;
+		windowPos += n;
+		if (windowPos == windowSize) windowPos = 0;
+	}
+}
+
+int StreamDecompressor::Read(byte* output, int size)
+{
+	int done = 0;
+	while (done < size && result == DECOMPRESSED_OK && !finished)
+	{
+		if (stepIdx == stepCnt)
+		{
+			decodeOp();
+			continue;
+		}
+		Step& step = steps[stepIdx];
+		int n = min(step.Cnt, size - done);
+		if (step.Dist == 0)
+			putLiterals(&output[done], n);
+		else
+			putBackref(&output[done], step.Dist, n);
+		done += n;
+		step.Cnt -= n;
+		if (step.Cnt == 0) stepIdx++;
+	}
+	return done;
+}
@@ -0,0 +1,110 @@
+
+#pragma once
+
+#include "platform.h"
+
+const int MAX_UNPACKED_SIZE = 0xFFFF;
+
+enum DECOMPRESS_RESULT
+{
+	DECOMPRESSED_OK,
+	DECOMPRESS_BAD_HEADER, // not a Hrust 1 block, or sizes in header don't fit
+	DECOMPRESS_CORRUPT,    // stream ends early, references data before start or goes past unpacked size
+	DECOMPRESS_WINDOW_TOO_SMALL // backref reaches further back than StreamDecompressor window
+};
+
+// Unpacks Hrust 1.3 block ("HR" header) produced by Compressor.
+// Reads whole control words at once and copies backrefs in blocks, not byte by byte.
+class Decompressor
+{
+private:
+
+	const byte* inputPtr;
+	const byte* inputEnd;
+	bool overrun; // read past inputEnd
+
+	unsigned controlWord; // unused bits, left aligned
+	int controlBitsCnt;
+	void nextControlWord();
+	int getBit();
+	int getBits(int n);
+	int getByte();
+
+public:
+
+	// 'output' must hold MAX_UNPACKED_SIZE bytes; unpacked size is returned in 'outputSize'
+	DECOMPRESS_RESULT Decompress(const byte* input, int inputSize, byte* output, int* outputSize);
+};
+
+// Unpacks Hrust 1.3 block a piece at a time into buffers supplied by the caller, so that
+// the whole output never has to be held at once. Output also goes to 'window', a ring
+// of the last 'windowSize' bytes that backrefs copy from; it must reach as far back as
+// the stream does (MAX_UNPACKED_SIZE or unpacked size is always enough).
+// State is fixed size and nothing is allocated; Read() stops at any byte and the next
+// call continues from there.
+class StreamDecompressor
+{
+private:
+
+	const byte* input;
+	const byte* inputPtr;
+	const byte* inputEnd;
+	bool overrun;
+
+	unsigned controlWord; // unused bits, left aligned
+	int controlBitsCnt;
+	void nextControlWord();
+	int getBit();
+	int getBits(int n);
+	int getByte();
+
+	byte* window;
+	int windowSize;
+	int windowPos; // where the next byte goes
+
+	int unpackedSize;
+	int decodedSize; // including pending steps
+	int D;                // D register, see Decompress()
+	bool ended;     // end marker is read, last 6 bytes are pending
+	bool finished;
+	DECOMPRESS_RESULT result;
+
+	// Op decoded but not output yet: 'Cnt' bytes copied from 'Dist' back, or taken from
+	// input when 'Dist' is 0; ref + insert + ref of RIR takes 3 steps
+	struct Step
+	{
+		int Dist;
+		int Cnt;
+	};
+	Step steps[3];
+	int stepCnt;
+	int stepIdx;
+
+	void setSteps(int dist, int cnt);
+	void decodeOp();
+	void putLiterals(byte* output, int cnt);
+	void putBackref(byte* output, int dist, int cnt);
+
+public:
+
+	StreamDecompressor(byte* window, int windowSize);
+
+	// Checks the header and rewinds to the start of 'input', which must stay in place until the end
+	DECOMPRESS_RESULT Start(const byte* input, int inputSize);
+
+	int GetUnpackedSize() const { return unpackedSize; };
+
+	// Unpacks up to 'size' next bytes to 'output'. Returns the number of bytes written,
+	// less than 'size' only at the end of data or on error.
+	int Read(byte* output, int size);
+
+	// True when all bytes are read and the stream ended where the header says
+	bool IsFinished() const { return finished; };
+
+	// DECOMPRESSED_OK until an error is found
+	DECOMPRESS_RESULT GetResult() const { return result; };
+};
+
+// Copies 'cnt' bytes from 'dst + dist' to 'dst' as if byte by byte, so that overlapping
+// references repeat the last -dist bytes
+void CopyBackref(byte* dst, int dist, int cnt);
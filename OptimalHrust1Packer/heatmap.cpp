@@ -0,0 +1,153 @@
+#include "heatmap.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+bool SaveHeatmap(const char* path, const float* costs, int size, HEATMAP_FORMAT format)
+{
+	std::vector<unsigned char> data;
+	for (int i = 0; i < size; i++)
+	{
+		if (format == HEATMAP_U16)
+		{
+			double v = costs[i] * 256.0 + 0.5;
+			unsigned value = (v >= 0xFFFF) ? 0xFFFF : (unsigned)v;
+			data.push_back((unsigned char)value);
+			data.push_back((unsigned char)(value >> 8));
+		}
+		else
+		{
+			unsigned value;
+			memcpy(&value, &costs[i], 4);
+			for (int k = 0; k < 4; k++)
+				data.push_back((unsigned char)(value >> (k * 8)));
+		}
+	}
+
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+	size_t written = data.empty() ? 0 : fwrite(&data[0], 1, data.size(), f);
+	fclose(f);
+	return written == data.size();
+}
+
+// PNG
+
+struct CrcTable
+{
+	unsigned Entries[256];
+};
+
+static unsigned crc32(const unsigned char* data, size_t size, unsigned crc)
+{
+	// built once on first use, thread-safe as batch workers may save PNGs at once
+	static const CrcTable table = []()
+	{
+		CrcTable t;
+		for (unsigned n = 0; n < 256; n++)
+		{
+			unsigned c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			t.Entries[n] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table.Entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void putBE32(std::vector<unsigned char>& out, unsigned value)
+{
+	for (int k = 3; k >= 0; k--)
+		out.push_back((unsigned char)(value >> (k * 8)));
+}
+
+static void putChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+	putBE32(out, (unsigned)data.size());
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	putBE32(out, crc32(&out[start], out.size() - start, 0));
+}
+
+// Black - red - yellow - white
+static void heatColor(float bits, unsigned char* rgb)
+{
+	float v = bits / 16 * 3;
+	for (int c = 0; c < 3; c++)
+	{
+		float x = v - c;
+		rgb[c] = (unsigned char)((x <= 0) ? 0 : (x >= 1) ? 255 : x * 255 + 0.5f);
+	}
+}
+
+bool SaveHeatmapPng(const char* path, const float* costs)
+{
+	const int width = 256;
+	const int height = 192 * 2;
+
+	// scanlines with filter byte 0
+	std::vector<unsigned char> image(height * (1 + width * 3));
+	for (int y = 0; y < height; y++)
+	{
+		unsigned char* row = &image[y * (1 + width * 3)];
+		row[0] = 0;
+		for (int x = 0; x < width; x++)
+		{
+			int offset;
+			if (y < 192)
+				offset = (y & 0xC0) << 5 | (y & 7) << 8 | (y & 0x38) << 2 | x >> 3; // screen address of pixel
+			else
+				offset = 6144 + ((y - 192) >> 3) * 32 + (x >> 3);
+			heatColor(costs[offset], &row[1 + x * 3]);
+		}
+	}
+
+	// zlib stream of stored deflate blocks
+	std::vector<unsigned char> z;
+	z.push_back(0x78);
+	z.push_back(0x01);
+	unsigned a = 1, b = 0;
+	for (size_t pos = 0; pos < image.size(); )
+	{
+		size_t n = image.size() - pos;
+		if (n > 0xFFFF) n = 0xFFFF;
+		z.push_back((pos + n == image.size()) ? 1 : 0);
+		z.push_back((unsigned char)n);
+		z.push_back((unsigned char)(n >> 8));
+		z.push_back((unsigned char)~n);
+		z.push_back((unsigned char)(~n >> 8));
+		for (size_t i = 0; i < n; i++)
+		{
+			a = (a + image[pos + i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		z.insert(z.end(), image.begin() + pos, image.begin() + pos + n);
+		pos += n;
+	}
+	putBE32(z, b << 16 | a);
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<unsigned char> png(signature, signature + 8);
+	std::vector<unsigned char> header;
+	putBE32(header, width);
+	putBE32(header, height);
+	header.push_back(8); // bit depth
+	header.push_back(2); // RGB
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+	putChunk(png, "IHDR", header);
+	putChunk(png, "IDAT", z);
+	putChunk(png, "IEND", std::vector<unsigned char>());
+
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+	size_t written = fwrite(&png[0], 1, png.size(), f);
+	fclose(f);
+	return written == png.size();
+}
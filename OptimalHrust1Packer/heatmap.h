@@ -0,0 +1,23 @@
+#pragma once
+
+// Bits of compressed output spent on each input byte (--heatmap).
+// Compress_Emit spreads the bits of every op evenly over the bytes it produces;
+// header, end marker and padding belong to no byte.
+
+enum HEATMAP_FORMAT
+{
+	HEATMAP_NONE,
+	HEATMAP_F32, // little endian float per byte, in bits
+	HEATMAP_U16  // little endian uint16 per byte, in 1/256 bits (8.8 fixed point)
+};
+
+// Writes 'costs' of 'size' bytes as a raw array
+bool SaveHeatmap(const char* path, const float* costs, int size, HEATMAP_FORMAT format);
+
+// Size of a ZX Spectrum screen: 6144 bytes of bitmap and 768 of attributes
+const int ZX_SCREEN_SIZE = 6912;
+
+// Writes costs of a ZX screen file as a PNG picture in screen geometry: bitmap bytes on
+// top (each as 8x1 pixels at its place on screen), attributes below (each as 8x8 cell).
+// Colors go from black (0 bits) through red and yellow to white (16 bits and more).
+bool SaveHeatmapPng(const char* path, const float* costs);
@@ -0,0 +1,116 @@
+#include "parse.h"
+#include <stdio.h>
+#include <string.h>
+
+bool SaveParse(const char* path, const Backref* ops, int count, int inputSize)
+{
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+	fprintf(f, "hrust1 %d\n", inputSize);
+	int D = 2;
+	for (int i = 0; i < count; i++)
+	{
+		const Backref& op = ops[i];
+		if (op.Count == -1)
+			fprintf(f, "lit\n");
+		else if (op.Count < 0)
+			fprintf(f, "lit %d\n", -op.Count);
+		else if (op.IsRIR)
+			fprintf(f, "rir %d\n", op.Dist);
+		else if (op.Count >= 3 && op.D != D)
+		{
+			fprintf(f, "ref %d %d %d\n", op.Count, op.Dist, op.D);
+			D = op.D;
+		}
+		else
+			fprintf(f, "ref %d %d\n", op.Count, op.Dist);
+	}
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+bool LoadParse(const char* path, int* inputSize, std::vector<Backref>& ops, std::vector<int>& lines, std::string& error)
+{
+	ops.clear();
+	lines.clear();
+	FILE* f = fopen(path, "r");
+	if (!f)
+	{
+		error = "cannot open file";
+		return false;
+	}
+
+	const char* e = NULL;
+	bool header = false;
+	int D = 2;
+	int line = 0;
+	char text[256];
+	while (!e && fgets(text, sizeof(text), f))
+	{
+		line++;
+		char* comment = strchr(text, ';');
+		if (comment) *comment = 0;
+
+		char word[16];
+		int a, b, c;
+		char extra;
+		int n = sscanf(text, "%15s %d %d %d %c", word, &a, &b, &c, &extra);
+		if (n <= 0)
+			continue; // empty line
+
+		if (!header)
+		{
+			if (strcmp(word, "hrust1") != 0 || n != 2)
+				e = "expected 'hrust1 <input size>' (parse of another format?)";
+			else if (a < 0 || a > MAX_INPUT_SIZE)
+				e = "bad input size";
+			*inputSize = a;
+			header = true;
+			continue;
+		}
+
+		Backref op(false, 0, 0, D);
+		if (strcmp(word, "lit") == 0 && n == 1)
+			op.Count = -1;
+		else if (strcmp(word, "lit") == 0 && n == 2 && a >= 2 && a <= 42)
+			op.Count = short(-a);
+		else if (strcmp(word, "ref") == 0 && (n == 3 || n == 4) && a >= 1 && a <= 0xEFF && b < 0 && b >= -MAX_INPUT_SIZE)
+		{
+			op.Count = short(a);
+			op.Dist = b;
+			if (n == 4)
+			{
+				if (c < 2 || c > 8)
+				{
+					e = "D must be 2..8";
+					break;
+				}
+				D = c;
+			}
+			op.D = byte(D);
+		}
+		else if (strcmp(word, "rir") == 0 && n == 2 && a < 0 && a >= -79)
+			op = Backref(true, 3, a, D);
+		else
+		{
+			e = "bad op";
+			break;
+		}
+		ops.push_back(op);
+		lines.push_back(line);
+	}
+	if (!e && ferror(f))
+		e = "read error";
+	else if (!e && !header)
+		e = "file is empty";
+	fclose(f);
+
+	if (e)
+	{
+		char prefix[32];
+		sprintf(prefix, "line %d: ", line);
+		error = std::string(line > 0 ? prefix : "") + e;
+		return false;
+	}
+	return true;
+}
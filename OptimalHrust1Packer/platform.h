@@ -0,0 +1,24 @@
+
+#pragma once
+
+// The packer was written against Windows.h, which supplies 'byte', 'WORD',
+// 'min' and 'ARRAYSIZE'. Elsewhere we define the same few things ourselves.
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+#else
+
+#include <string.h>
+#include <stdlib.h>
+
+typedef unsigned char byte;
+typedef unsigned short WORD;
+
+#define ARRAYSIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+template <typename T>
+inline T min(T a, T b) { return (a < b) ? a : b; }
+
+#endif
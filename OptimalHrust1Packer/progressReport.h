@@ -1,12 +1,104 @@
 
 #pragma once
 
-class ProgressReport
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+// Receives progress notifications from ProgressTracker.
+// Calls are serialized by the tracker, so implementations need no locking of their own.
+class ProgressCallback
+{
+public:
+	virtual ~ProgressCallback() {};
+
+	// fraction is 0..1 of estimated work; etaSeconds is negative while unknown
+	virtual void OnProgress(double fraction, double etaSeconds) = 0;
+};
+
+// Prints "progress: NN%" to stdout, overwriting the same console line
+class ConsoleProgress : public ProgressCallback
 {
 	bool printed;
+	std::mutex lock;
+
+public:
+	FILE* Out; // stdout by default
+
+	ConsoleProgress();
+	virtual void OnProgress(double fraction, double etaSeconds);
+	void Done(); // finishes progress line
+	void Clear(); // erases progress line, so that other messages can be printed
+};
+
+// Can be set from any thread (e.g. Ctrl+C handler) to stop compression early
+class CancellationToken
+{
+	std::atomic<bool> cancelled;
+
+public:
+	CancellationToken() : cancelled(false) {};
+	void Cancel() { cancelled.store(true); };
+	bool IsCancelled() const { return cancelled.load(std::memory_order_relaxed); };
+};
+
+// Thread-safe sum of work done by any number of concurrent compressions.
+// Work is measured in abstract units supplied by ProgressReport.
+class ProgressTracker
+{
+	ProgressCallback* callback;
+	std::atomic<long long> totalWork;
+	std::atomic<long long> doneWork;
+	std::chrono::steady_clock::time_point startTime;
+	std::mutex callbackLock;
+
+public:
+	ProgressTracker(ProgressCallback* callback);
+
+	void AddWork(long long work); // all of it before any is advanced, or the fraction goes back
+	void Advance(long long work);
+
+	double GetFraction();
+	double GetEtaSeconds(); // negative if nothing is done yet
+};
+
+// Per-compression progress state. Kept free of virtuals and non-trivial members
+// because it lives inside Compressor, which is zero-initialized with memset.
+class ProgressReport
+{
+	int inputSize;
+	long long reportedWork; // by the current DP pass
+	long long plannedWork;  // of the current file
+	long long spentWork;
 
 public:
+	ProgressTracker* Tracker;           // may be NULL
+	CancellationToken* Cancellation;    // may be NULL
+
 	ProgressReport();
-	void Report(int total, int done);
+
+	// Called before a file is compressed, with the estimate of all its DP passes that
+	// was added to the tracker before any file started. Reports never exceed it.
+	void Plan(long long work);
+
+	// Called before each DP pass. DP goes backward from inputSize-1 down to 1.
+	void Start(int inputSize);
+
+	// Called by DP after position 'pos' is solved
+	void Report(int pos);
+
+	// Adds whatever remains of the pass estimate, e.g. after early exit
 	void Done();
+
+	// Adds whatever remains of the file estimate, e.g. when it took fewer passes or failed
+	void Finish();
+
+	bool IsCancelled() const { return Cancellation && Cancellation->IsCancelled(); };
+
+	// Estimated work for solving positions from inputSize-1 down to pos (inclusive).
+	// Position q is taken to cost inputSize + q: inputSize for match finding, and q for
+	// the distances in reach of it. Work per position so shrinks linearly towards the
+	// beginning of the file, where progress speeds up.
+	static long long EstimateWork(int inputSize, int pos);
 };
@@ -0,0 +1,200 @@
+#include "similarity.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// The 8 bytes of a chunk are its key, so equal keys are equal chunks. Each next key
+// is rolled from the previous one by shifting in one byte.
+typedef unsigned long long ChunkKey;
+
+const int SHARD_BITS = 8; // index is split into shards by key hash, built in parallel
+const int SHARD_COUNT = 1 << SHARD_BITS;
+
+struct IndexEntry
+{
+	ChunkKey Key;
+	int File;
+
+	bool operator<(const IndexEntry& e) const { return Key < e.Key || (Key == e.Key && File < e.File); };
+};
+
+// What the index needs of each file
+struct ChunkedFile
+{
+	std::vector<ChunkKey> Keys;   // of the chunk at each position
+	std::vector<ChunkKey> Unique; // distinct keys, ascending by shard then key
+	std::vector<int> NewBefore;   // NewBefore[i]: bytes before i not within chunks repeated in the file
+};
+
+static int getShard(ChunkKey key)
+{
+	return (int)((key * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS));
+}
+
+static bool shardLess(ChunkKey a, ChunkKey b)
+{
+	int sa = getShard(a), sb = getShard(b);
+	return sa < sb || (sa == sb && a < b);
+}
+
+// Runs 'work(i)' for i in 0..count-1 on 'threadCount' threads
+template <typename Work>
+static void parallelFor(int count, int threadCount, const Work& work)
+{
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < std::min(threadCount, count); t++)
+		threads.push_back(std::thread([&next, count, &work]()
+		{
+			for (int i; (i = next++) < count; )
+				work(i);
+		}));
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+
+static void chunkFile(const std::vector<unsigned char>& data, ChunkedFile& file, int& selfShared)
+{
+	int size = (int)data.size();
+	int count = std::max(size - SIMILARITY_CHUNK + 1, 0);
+	file.Keys.resize(count);
+	ChunkKey key = 0;
+	for (int i = 0; i < size; i++)
+	{
+		key = (key << 8) | data[i];
+		if (i >= SIMILARITY_CHUNK - 1)
+			file.Keys[i - (SIMILARITY_CHUNK - 1)] = key;
+	}
+
+	// chunks seen before: sort positions by key, all but the first of equal keys are repeats
+	std::vector<int> order(count);
+	for (int p = 0; p < count; p++)
+		order[p] = p;
+	std::sort(order.begin(), order.end(), [&file](int a, int b)
+	{
+		return file.Keys[a] < file.Keys[b] || (file.Keys[a] == file.Keys[b] && a < b);
+	});
+	std::vector<bool> repeated(size, false);
+	file.Unique.clear();
+	for (int k = 0; k < count; k++)
+	{
+		int p = order[k];
+		if (k > 0 && file.Keys[order[k - 1]] == file.Keys[p])
+			std::fill(repeated.begin() + p, repeated.begin() + p + SIMILARITY_CHUNK, true);
+		else
+			file.Unique.push_back(file.Keys[p]);
+	}
+	std::sort(file.Unique.begin(), file.Unique.end(), shardLess);
+
+	file.NewBefore.resize(size + 1);
+	file.NewBefore[0] = 0;
+	selfShared = 0;
+	for (int i = 0; i < size; i++)
+	{
+		file.NewBefore[i + 1] = file.NewBefore[i] + (repeated[i] ? 0 : 1);
+		selfShared += repeated[i] ? 1 : 0;
+	}
+}
+
+void AnalyzeSimilarity(const std::vector<std::vector<unsigned char> >& files, int threadCount, std::vector<FileSimilarity>& result)
+{
+	int fileCount = (int)files.size();
+	std::vector<ChunkedFile> chunked(fileCount);
+	result.assign(fileCount, FileSimilarity());
+	parallelFor(fileCount, threadCount, [&](int f)
+	{
+		result[f].Size = (int)files[f].size();
+		chunkFile(files[f], chunked[f], result[f].SelfShared);
+	});
+
+	// every shard takes its part of distinct keys of each file
+	std::vector<std::vector<IndexEntry> > index(SHARD_COUNT);
+	parallelFor(SHARD_COUNT, threadCount, [&](int s)
+	{
+		std::vector<IndexEntry>& shard = index[s];
+		for (int f = 0; f < fileCount; f++)
+		{
+			const std::vector<ChunkKey>& unique = chunked[f].Unique;
+			std::vector<ChunkKey>::const_iterator it = std::lower_bound(unique.begin(), unique.end(), s,
+				[](ChunkKey key, int shard) { return getShard(key) < shard; });
+			for (; it != unique.end() && getShard(*it) == s; ++it)
+			{
+				IndexEntry e = { *it, f };
+				shard.push_back(e);
+			}
+		}
+		std::sort(shard.begin(), shard.end());
+	});
+
+	// Each chunk of a file covers its bytes in every other file that has it. Chunks come
+	// in position order, so bytes covered by previous ones end before coveredEnd, and
+	// covered bytes with no gap between them are taken as one backref.
+	parallelFor(fileCount, threadCount, [&](int a)
+	{
+		const ChunkedFile& file = chunked[a];
+		std::vector<int> coveredEnd(fileCount, -1), shared(fileCount, 0), gained(fileCount, 0), runs(fileCount, 0);
+		std::vector<bool> runGained(fileCount, false); // if the current run of covered bytes has any new ones
+		std::vector<int> touched;
+		int count = (int)file.Keys.size();
+		for (int p = 0, q; p < count; p = q + 1)
+		{
+			// the same chunk at positions p..q (a run of one byte value) covers bytes once
+			ChunkKey key = file.Keys[p];
+			for (q = p; q + 1 < count && file.Keys[q + 1] == key; q++) {}
+			const std::vector<IndexEntry>& shard = index[getShard(key)];
+			IndexEntry first = { key, 0 };
+			for (std::vector<IndexEntry>::const_iterator it = std::lower_bound(shard.begin(), shard.end(), first);
+				it != shard.end() && it->Key == key; ++it)
+			{
+				int b = it->File;
+				if (b == a)
+					continue;
+				int end = coveredEnd[b];
+				if (end < 0)
+					touched.push_back(b);
+				if (p > end)
+					runGained[b] = false;
+				int from = std::max(p, end);
+				int to = q + SIMILARITY_CHUNK;
+				int gain = file.NewBefore[to] - file.NewBefore[from];
+				if (gain > 0 && !runGained[b])
+				{
+					// one more backref to the other file
+					runs[b]++;
+					runGained[b] = true;
+				}
+				shared[b] += to - from;
+				gained[b] += gain;
+				coveredEnd[b] = to;
+			}
+		}
+
+		std::vector<SimilarityPair>& pairs = result[a].Pairs;
+		for (size_t t = 0; t < touched.size(); t++)
+		{
+			int b = touched[t];
+			SimilarityPair pair;
+			pair.File = b;
+			pair.Shared = shared[b];
+			pair.Savings = std::max(gained[b] - runs[b] * HISTORY_BACKREF_SIZE, 0);
+			pairs.push_back(pair);
+		}
+		std::sort(pairs.begin(), pairs.end(), [](const SimilarityPair& x, const SimilarityPair& y)
+		{
+			return x.Savings > y.Savings || (x.Savings == y.Savings && (x.Shared > y.Shared || (x.Shared == y.Shared && x.File < y.File)));
+		});
+	});
+}
+
+double GetPairSimilarity(const std::vector<FileSimilarity>& result, int a, int b)
+{
+	int size = result[a].Size + result[b].Size;
+	if (size == 0)
+		return 0;
+	int shared = 0;
+	for (int i = 0; i < 2; i++, std::swap(a, b))
+		for (size_t k = 0; k < result[a].Pairs.size(); k++)
+			if (result[a].Pairs[k].File == b)
+				shared += result[a].Pairs[k].Shared;
+	return (double)shared / size;
+}
@@ -6,11 +6,90 @@ Published under the MIT License
 
 
 #include "compress.h"
-#include <Windows.h>
+#include "platform.h"
+#include <thread>
+#include <condition_variable>
 
 // "hr21" + word + word
 #define HEADER_SIZE 8
 
+// Depacking time model of OBJECTIVE_DEPACK_TIME: T-states of every control bit (with the
+// jumps of dispatch), data byte read from input and byte produced (LDIR). Fitted to
+// the inline depacker of Benchmark/depackers.cpp, within 10% on usual data.
+#define DEPACK_BIT_T 50
+#define DEPACK_BYTE_T 25
+#define DEPACK_COPY_T 21
+
+static int getDepackTime(int controlBits, int dataBytes, int produced)
+{
+	return controlBits * DEPACK_BIT_T + dataBytes * DEPACK_BYTE_T + produced * DEPACK_COPY_T;
+}
+
+// Run fast path (see OptimalCompressor::runPeriod). Periods up to 8 mean distances
+// down to -8, where encoded length of a backref depends only on count class.
+#define RUN_MAX_PERIOD 8
+#define RUN_DIRECT_CNT 15 // counts evaluated one by one, longer ones use runWindows
+static const int runWindowCnt[2][2] = { { 16, 255 }, { 256, 0xFFF } };
+
+const char* const OpKindNames[OP_KIND_COUNT] =
+{
+	"header",
+	"literal",
+	"literal_run",
+	"ref1_dist8",
+	"ref2_dist256",
+	"long_dist256",
+	"long_dist768",
+	"long_dist1792",
+	"long_dist3840",
+	"long_dist7680",
+	"long_far",
+	"end",
+	"padding"
+};
+
+ParseConstraints::ParseConstraints()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+static int countOnes(int value)
+{
+	int n = 0;
+	for (; value; value &= value - 1)
+		n++;
+	return n;
+}
+
+int GetTapeLoadTime(const byte* data, int size)
+{
+	int time = size * 8;
+	for (int i = 0; i < size; i++)
+		time += countOnes(data[i]);
+	return time;
+}
+
+OpStats::OpStats()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+void OpStats::AddOp(OP_KIND kind, int count, int dist)
+{
+	if (Count[kind]++ == 0)
+	{
+		MinCount[kind] = MaxCount[kind] = count;
+		MinDist[kind] = MaxDist[kind] = dist;
+	}
+	else
+	{
+		if (count < MinCount[kind]) MinCount[kind] = count;
+		if (count > MaxCount[kind]) MaxCount[kind] = count;
+		if (dist < MinDist[kind]) MinDist[kind] = dist;
+		if (dist > MaxDist[kind]) MaxDist[kind] = dist;
+	}
+}
+
 Compressor::Compressor()
 {
 	memset(this, 0, sizeof(*this));
@@ -19,6 +98,7 @@ Compressor::Compressor()
 // Try compress and fallback to Store method if necessary
 void Compressor::CompressAuto()
 {
+	InvalidParse = false;
 	if (InputSize < 6 + 1)
 	{
 		// compression impossible, use Store method
@@ -26,9 +106,43 @@ void Compressor::CompressAuto()
 	}
 	else
 	{
+		if (Parse && CheckParse(NULL, NULL) < 0)
+		{
+			OutputSize = 0;
+			InvalidParse = true;
+			return;
+		}
+
 		int storedSize = GetStoredPackedSize();
+		PhaseTimer preprocessTimer(Timing, PHASE_DP);
 		Compress_Preprocess();
-		if (
+		preprocessTimer.Stop();
+		if (Timing)
+			Timing->SplitMatchFromDp();
+
+		if (compressedSize < 0)
+		{
+			// stopped by CancellationToken
+			OutputSize = 0;
+			Cancelled = true;
+			return;
+		}
+
+		PhaseTimer emitTimer(Timing, PHASE_EMIT);
+		if (Objective == OBJECTIVE_TAPE_TIME && compressedSize <= 0xFFFF)
+		{
+			// keep whichever loads faster
+			CompressStore();
+			int storedTime = GetTapeLoadTime(Output, OutputSize);
+			Compress_Emit();
+			Stored = (storedTime <= GetTapeLoadTime(Output, OutputSize));
+			if (Stored)
+			{
+				if (Stats) *Stats = OpStats();
+				CompressStore();
+			}
+		}
+		else if (
 			storedSize <= compressedSize || //   
 			compressedSize > 0xFFFF			//   
 			)
@@ -41,6 +155,7 @@ void Compressor::CompressAuto()
 			Compress_Emit();
 			Stored = false;
 		}
+		emitTimer.Stop();
 
 		ProgressReport.Done();
 	}
@@ -64,6 +179,7 @@ void Compressor::CompressStore()
 	memmove(&Output[8], Input, InputSize);
 	
 	OutputSize = InputSize + HEADER_SIZE;
+	DepackTime = getDepackTime(0, 0, InputSize);
 };
 
 void Compressor::Compress_Preprocess()
@@ -74,9 +190,20 @@ void Compressor::Compress_Preprocess()
 		throw;
 	}
 
-	optimalCompressor.ProgressReport = &this->ProgressReport;
-	optimalCompressor.Init(Input, InputSize - 6); // last 6 bytes are never compressed
-	int packedBitsCount = optimalCompressor.Preprocess();
+	int packedBitsCount;
+	if (Parse)
+	{
+		packedBitsCount = CheckParse(NULL, NULL); // already checked by CompressAuto
+	}
+	else
+	{
+		packedBitsCount = Solve(Constraints);
+		if (packedBitsCount < 0)
+		{
+			compressedSize = -1; // cancelled
+			return;
+		}
+	}
 	
 	packedBitsCount += 6 + 8; // end of stream literal
 
@@ -86,9 +213,95 @@ void Compressor::Compress_Preprocess()
 		(packedBitsCount + 7) / 8;
 };
 
+int Compressor::Solve(const ParseConstraints& constraints)
+{
+	optimalCompressor.ProgressReport = &this->ProgressReport;
+	optimalCompressor.Timing = Timing;
+	optimalCompressor.MatchThreads = MatchThreads;
+	optimalCompressor.Constraints = constraints;
+	optimalCompressor.Objective = Objective;
+	optimalCompressor.BitTime = BitTime;
+	optimalCompressor.Init(Input, InputSize - 6); // last 6 bytes are never compressed
+	return optimalCompressor.Preprocess();
+}
+
+int Compressor::CheckParse(const char** error, int* badOp)
+{
+	const char* e = NULL;
+	int endpos = InputSize - 6;
+	int pos = 1;
+	int bits = 8; // first byte simply copied
+	int i;
+	for (i = 0; i < ParseSize && !e; i++)
+	{
+		Backref op = Parse[i];
+		int cnt = op.Count < 0 ? -op.Count : op.Count;
+		if (op.Count == 0)
+			e = "count is 0";
+		else if (pos + cnt > endpos)
+			e = "op goes past the end of input (last 6 bytes are stored)";
+		else if (op.Count == -1)
+			bits += 1 + 8;
+		else if (op.Count < -1)
+		{
+			if (cnt < 12 || cnt > 42 || cnt % 2 != 0)
+				e = "literal run must be 12..42 bytes, even";
+			else
+				bits += 6 + 4 + cnt * 8;
+		}
+		else if (op.Dist >= 0 || pos + op.Dist < 0)
+			e = "distance points outside of input";
+		else
+		{
+			int len = op.Count > 0xFFF ? -1 : op.GetEncodedLen();
+			if (len < 0 || len >= 0x0FFFFFFF)
+				e = op.Count > 2 ? "count above 0xFFF" : "distance too far for count";
+			else if (memcmp(Input + pos, Input + pos + op.Dist, cnt) != 0)
+				e = "backref doesn't match input";
+			else
+				bits += len;
+		}
+		pos += cnt;
+	}
+
+	if (!e && pos != endpos)
+	{
+		e = "ops end before the end of input";
+		i++;
+	}
+	if (e)
+	{
+		if (error) *error = e;
+		if (badOp) *badOp = i - 1;
+		return -1;
+	}
+	return bits;
+}
+
+int Compressor::GetParse(Backref* ops)
+{
+	if (InputSize < 6 + 1)
+		return 0;
+	if (Parse)
+	{
+		memmove(ops, Parse, ParseSize * sizeof(Backref));
+		return ParseSize;
+	}
+
+	int count = 0;
+	for (int pos = 1; pos < InputSize - 6; )
+	{
+		Backref op = optimalCompressor.GetOptimalOp(pos);
+		ops[count++] = op;
+		pos += op.Count < 0 ? -op.Count : op.Count;
+	}
+	return count;
+}
+
 void Compressor::emitByte(int byte_) 
 {
 	*outputPtr++ = (byte)byte_;
+	if (Stats) Stats->DataBytes[opKind]++;
 };
 
 void Compressor::emitBit(int bit) 
@@ -106,12 +319,14 @@ void Compressor::emitBit(int bit)
 	
 	*controlBytePtr = (*controlBytePtr) * 2 + (bit & 1);
 	controlBitsCnt++;
+	if (Stats) Stats->ControlBits[opKind]++;
 };
 
 void Compressor::finalizeBitFlow()
 {
 	if (controlBitsCnt > 0)
 	{
+		opKind = OP_PADDING;
 		while(controlBitsCnt < 8)
 			emitBit(0);
 	}
@@ -218,6 +433,34 @@ void Compressor::emitLongDist(int dist)
     emitByte(dist & 0xFF);
 };
 
+// Bits emitted so far, not counting unused bits of the current control byte
+int Compressor::getEmittedBits()
+{
+	return int(outputPtr - Output) * 8 - ((8 - controlBitsCnt) & 7);
+}
+
+// Spreads 'bits' of an op evenly over 'cnt' bytes it produces from 'pos'
+void Compressor::setByteCosts(int pos, int cnt, int bits)
+{
+	for (int i = 0; i < cnt; i++)
+		ByteCosts[pos + i] = float(bits) / cnt;
+}
+
+OP_KIND Compressor::getOpKind(const Backref& op)
+{
+	if (op.Count == -1) return OP_LITERAL;
+	if (op.Count < -1) return OP_LITERAL_RUN;
+	if (op.Count == 1) return OP_REF1;
+	if (op.Count == 2) return OP_REF2;
+	int H = op.Dist >> 8;
+	if (H == -1) return OP_LONG_256;
+	if (H >= -3) return OP_LONG_768;
+	if (H >= -7) return OP_LONG_1792;
+	if (H >= -15) return OP_LONG_3840;
+	if (H >= -30) return OP_LONG_7680;
+	return OP_LONG_FAR;
+}
+
 // Builds final compressed block using precalculations 
 // made by Compress_Preprocess routine
 void Compressor::Compress_Emit() {
@@ -230,9 +473,11 @@ void Compressor::Compress_Emit() {
 
 	outputPtr = Output;
 	controlBitsCnt = 0;
+	if (Stats) *Stats = OpStats();
 
 	// Header
 
+	opKind = OP_HEADER;
 	int packedSize = compressedSize - HEADER_SIZE;
 	emitByte('h');
 	emitByte('r');
@@ -253,13 +498,27 @@ void Compressor::Compress_Emit() {
 	int endpos = InputSize - 6; // omit last 6 bytes
     int pos = 0;
 
+	opKind = OP_LITERAL;
 	emitByte(Input[pos++]);	// first byte is simply copied
+	DepackTime = 0;
+	if (Stats) Stats->AddOp(OP_LITERAL, 1, 0);
+	if (ByteCosts)
+	{
+		// first and last 6 bytes are stored as is
+		setByteCosts(0, 1, 8);
+		setByteCosts(endpos, 6, 6 * 8);
+	}
 
+	int parseIndex = 0;
     while (pos != endpos)
     {
         if (pos > endpos) throw; // something is wrong
 	
-		Backref cmd = optimalCompressor.GetOptimalOp(pos);
+		Backref cmd = Parse ? Parse[parseIndex++] : optimalCompressor.GetOptimalOp(pos);
+		int opPos = pos;
+		int opBits = getEmittedBits();
+		opKind = getOpKind(cmd);
+		if (Stats) Stats->AddOp(opKind, cmd.Count < 0 ? -cmd.Count : cmd.Count, cmd.Count < 0 ? 0 : -cmd.Dist);
 
         if (cmd.Count == 0)
         {
@@ -316,10 +575,20 @@ void Compressor::Compress_Emit() {
             }
             pos += cmd.Count;
         }
+
+		if (cmd.Count == -1)
+			DepackTime += getDepackTime(1, 1, 1);
+		else if (cmd.Count < -1)
+			DepackTime += getDepackTime(6 + 4, 0, -cmd.Count);
+		else
+			DepackTime += cmd.GetDepackTime();
+		if (ByteCosts) setByteCosts(opPos, pos - opPos, getEmittedBits() - opBits);
 	}
 
     // end of stream marker
 
+	opKind = OP_END;
+	if (Stats) Stats->Count[OP_END]++;
     emitBit(0);
     emitBit(1);
     emitBit(1);
@@ -343,6 +612,129 @@ void Compressor::Compress_Emit() {
 }
 
 
+////////////////////////////////////////////////////////////
+///////////         MatchPipeline           ////////////////
+////////////////////////////////////////////////////////////
+
+// Worker threads find matches for positions from the end towards the start, ahead of DP,
+// into a ring of MatchSteps. A worker waits while its slot holds a position DP hasn't used yet.
+class MatchPipeline
+{
+	OptimalCompressor* owner;
+	int ringSize;
+	MatchSteps* ring;
+	int* ringPos;      // position each slot is filled for, 0 if none
+	int nextPos;       // next position to hand out to a worker
+	int releasedPos;   // DP is done with this and all higher positions
+	bool stop;
+	std::mutex lock;
+	std::condition_variable slotReleased;
+	std::condition_variable slotFilled;
+	std::vector<std::thread> workers;
+	WorkCounters* workCounters; // of the DP thread; NULL if not profiled
+	WorkCounters workerCounters; // sum of all workers, added to workCounters when they are done
+
+	void Work();
+
+public:
+	MatchPipeline(OptimalCompressor* owner, int threads);
+	~MatchPipeline(); // stops and joins workers
+
+	// Matches of 'pos', waits until they are found. Positions must be requested in DP order.
+	const MatchSteps& Get(int pos);
+
+	// DP is done with matches of 'pos', its slot can be reused
+	void Release(int pos);
+};
+
+MatchPipeline::MatchPipeline(OptimalCompressor* owner, int threads)
+	: owner(owner), stop(false), workCounters(NULL)
+{
+	ringSize = threads * 4;
+	ring = new MatchSteps[ringSize];
+	ringPos = new int[ringSize];
+	for (int i = 0; i < ringSize; i++)
+		ringPos[i] = 0;
+	nextPos = owner->inputSize - 1;
+	releasedPos = owner->inputSize;
+#ifdef OHC_PROFILE
+	workCounters = CurrentWorkCounters;
+#endif
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&MatchPipeline::Work, this));
+}
+
+MatchPipeline::~MatchPipeline()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stop = true;
+	}
+	slotReleased.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+#ifdef OHC_PROFILE
+	if (workCounters)
+		for (int i = 0; i < WORK_COUNTER_COUNT; i++)
+			workCounters->Values[i] += workerCounters.Values[i];
+#endif
+	delete[] ringPos;
+	delete[] ring;
+}
+
+void MatchPipeline::Work()
+{
+	int* matchLen = new int[MAX_INPUT_SIZE];
+#ifdef OHC_PROFILE
+	WorkCounters counters;
+	CurrentWorkCounters = workCounters ? &counters : NULL;
+#endif
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (!stop && nextPos >= 1)
+	{
+		int pos = nextPos--;
+		// the slot was used by pos + ringSize
+		while (!stop && releasedPos > pos + ringSize)
+			slotReleased.wait(guard);
+		if (stop)
+			break;
+
+		guard.unlock();
+		MatchSteps& steps = ring[pos % ringSize];
+		owner->findMatches(pos, matchLen, steps);
+		guard.lock();
+
+		ringPos[pos % ringSize] = pos;
+		slotFilled.notify_all();
+	}
+
+#ifdef OHC_PROFILE
+	for (int i = 0; i < WORK_COUNTER_COUNT; i++)
+		workerCounters.Values[i] += counters.Values[i];
+#endif
+	guard.unlock();
+	delete[] matchLen;
+}
+
+const MatchSteps& MatchPipeline::Get(int pos)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (ringPos[pos % ringSize] != pos)
+		slotFilled.wait(guard);
+	return ring[pos % ringSize];
+}
+
+void MatchPipeline::Release(int pos)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		releasedPos = pos;
+	}
+	slotReleased.notify_all();
+}
+
+
 ////////////////////////////////////////////////////////////
 ///////////       OptimalCompressor         ////////////////
 ////////////////////////////////////////////////////////////
@@ -364,88 +756,424 @@ Backref OptimalCompressor::GetOptimalOp(int pos)
 
 int OptimalCompressor::Preprocess()
 {
+	small = (inputSize <= SMALL_INPUT_SIZE);
+	maxDist = Constraints.MaxDist ? Constraints.MaxDist : MAX_INPUT_SIZE;
+	maxCount = Constraints.MaxCount ? min(Constraints.MaxCount, 0xFFF) : 0xFFF;
+	tape = (Objective == OBJECTIVE_TAPE_TIME);
+	depack = (Objective == OBJECTIVE_DEPACK_TIME);
+	copyCost = depack ? DEPACK_COPY_T : 0;
+
 	memmove(input + inputSize, input, inputSize);
 	inputOffset = inputSize;
+	fill_runPeriod();
+	runWindowsPos = 0;
 
 	// solve optimization problem using Dynamic Programming.
 	// DP base param is the position in input file.
 
 	cost[inputSize] = 0;
 
-    for (int pos = inputSize - 1; pos >= 1; pos--)
-    {
-		if ((pos & 0x3FF) == 0)
+	if (ProgressReport)
+		ProgressReport->Start(inputSize);
+
+	if (small)
+	{
+		if (!solveSmall())
+			return -1;
+	}
+	else
+	{
+		MatchPipeline* pipeline = (MatchThreads > 1) ? new MatchPipeline(this, MatchThreads) : NULL;
+
+		for (int pos = inputSize - 1; pos >= 1; pos--)
 		{
 			if (ProgressReport)
-				ProgressReport->Report(inputSize, inputSize - pos);
+			{
+				if (ProgressReport->IsCancelled())
+				{
+					delete pipeline;
+					return -1;
+				}
+				if ((pos & 0x3FF) == 0)
+					ProgressReport->Report(pos);
+			}
+
+			if (pipeline)
+			{
+				PhaseTimer matchTimer(Timing, PHASE_MATCH); // time spent waiting for matches
+				const MatchSteps& steps = pipeline->Get(pos);
+				matchTimer.Stop();
+				solvePosition(pos, steps);
+				pipeline->Release(pos);
+			}
+			else
+				solvePosition(pos);
 		}
 
-        int result;
+		delete pipeline;
+	}
 
-        // try copy 1 byte
+	// return compressed size in bits
 
-        result = 1 + 8 + cost[pos + 1];
-		Backref resultOp(-1, 0);
+	if (Objective != OBJECTIVE_SIZE)
+		return getSolutionBits();
+	return 
+		8 + // first byte simply copied
+		cost[1];
+};
 
-        // try copy 12, 14..42 bytes
+// DP loop of Preprocess() for small inputs. input[q..] matches input[pos..] for one byte
+// more than input[q + 1..] matches input[pos + 1..] if input[q] == input[pos], none otherwise,
+// so every position updates the row of match lengths in one pass instead of Z-function.
+// Match finding is too short here to time apart from DP, so it is all PHASE_DP.
+// Returns false if cancelled.
+bool OptimalCompressor::solveSmall()
+{
+	WORD len[SMALL_INPUT_SIZE + 1]; // len[q]: how many bytes from q match bytes from pos, q < pos
+	for (int q = 0; q <= inputSize; q++)
+		len[q] = 0;
 
-        for (int i = 0; i < 16; i++)
-        {
-            int cnt = i * 2 + 12;
-            if (pos + cnt > inputSize) {
-				break;
-			}
-            int t = 6 + 4 + cnt * 8 + cost[pos + cnt];
-            if (t < result) {
-				result = t; resultOp = Backref(-cnt, 0); 
-			}
-        }
+	for (int pos = inputSize - 1; pos >= 1; pos--)
+	{
+		if (ProgressReport)
+		{
+			if (ProgressReport->IsCancelled())
+				return false;
+			if ((pos & 0x3FF) == 0)
+				ProgressReport->Report(pos);
+		}
+
+		byte c = input[pos];
+		for (int q = 0; q < pos; q++)
+			len[q] = (input[q] == c) ? len[q + 1] + 1 : 0;
+		PROFILE_COUNT(WORK_Z_COMPARES, pos);
+
+		// as fill_matchLen_periodic
+		int period = runPeriod[pos];
+		for (int k = 1; k < period; k++)
+			if (len[pos - k] > RUN_DIRECT_CNT)
+				period = 0;
+		collectMatches(pos, period, len, inputSize - pos, matchSteps);
+
+		solvePosition(pos, matchSteps);
+	}
+	return true;
+}
+
+// Compressed size in bits of the optimal parse, when cost is not size
+int OptimalCompressor::getSolutionBits()
+{
+	int bits = 8; // first byte simply copied
+	for (int pos = 1; pos < inputSize; )
+	{
+		Backref op = solution[pos];
+		if (op.Count < 0)
+		{
+			int cnt = -op.Count;
+			bits += (cnt == 1) ? 1 + 8 : 6 + 4 + cnt * 8;
+			pos += cnt;
+		}
+		else
+		{
+			bits += op.GetEncodedLen();
+			pos += op.Count;
+		}
+	}
+	return bits;
+}
+
+// Cost of backref under Objective
+inline int OptimalCompressor::getBackrefCost(Backref& br)
+{
+	int len = br.GetEncodedLen();
+	if (tape)
+		return len + br.GetEncodedOnes();
+	if (depack && len < 0x0FFFFFFF) // not impossible
+		return len * BitTime + br.GetDepackTime();
+	return len;
+}
+
+// Costs of copying 1 byte and 12, 14..42 bytes (runCost, 16 entries) at 'pos'.
+// Runs beyond input end are left out.
+void OptimalCompressor::getLiteralCosts(int pos, int* literalCost, int* runCost)
+{
+	*literalCost = 1 + 8;
+	if (depack)
+		*literalCost = (1 + 8) * BitTime + getDepackTime(1, 1, 1);
+	int ones = 0;
+	if (tape)
+	{
+		*literalCost += 1 + countOnes(input[pos]);
+		for (int i = 0; i < 12 - 2 && pos + i < inputSize; i++)
+			ones += countOnes(input[pos + i]);
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		int cnt = i * 2 + 12;
+		if (pos + cnt > inputSize)
+			break;
+		runCost[i] = 6 + 4 + cnt * 8;
+		if (depack)
+			runCost[i] = runCost[i] * BitTime + getDepackTime(6 + 4, 0, cnt); // bytes are copied by LDIR
+		if (tape)
+		{
+			ones += countOnes(input[pos + cnt - 2]) + countOnes(input[pos + cnt - 1]);
+			runCost[i] += 2 + countOnes(i) + ones; // 011000, count
+		}
+	}
+}
+
+// Finds matches and optimal op for position 'pos'.
+// All positions after 'pos' must be solved already.
+void OptimalCompressor::solvePosition(int pos)
+{
+	PhaseTimer matchTimer(Timing, PHASE_MATCH);
+	findMatches(pos, matchLen, matchSteps);
+	matchTimer.Stop();
+
+	solvePosition(pos, matchSteps);
+};
+
+// Finds backref candidates for position 'pos'. Depends only on input, so it can
+// run on any thread, ahead of DP. 'matchLen' is scratch space.
+void OptimalCompressor::findMatches(int pos, int* matchLen, MatchSteps& steps)
+{
+	int period = runPeriod[pos];
+	if (period && !fill_matchLen_periodic(pos, period, matchLen))
+		period = 0;
+	if (!period)
+		fill_matchLen(pos, matchLen);
+	collectMatches(pos, period, matchLen, 0, steps);
+};
+
+// Turns match lengths at each distance (matchLen[inputSize - distance - base]) into backref
+// candidates. With 'period', lengths are needed up to that distance only.
+template <typename Index>
+void OptimalCompressor::collectMatches(int pos, int period, const Index* matchLen, int base, MatchSteps& steps)
+{
+	steps.Period = period;
+
+	// backref loop takes the nearest distance for every count
+	int maxCnt = min(min(period ? RUN_DIRECT_CNT : 0xFFF, maxCount), inputSize - pos);
+	int minDist = -min(pos, maxDist);
+	int cnt = 0;
+	steps.Count = 0;
+	for (int dist = -1; dist >= minDist && cnt < maxCnt; dist--)
+	{
+		//if (dist < -0xFFFF) break;
+		int matchCnt = matchLen[dist + inputSize - base];
+		if (matchCnt > cnt)
+		{
+			cnt = min(matchCnt, maxCnt);
+			steps.Dist[steps.Count] = (WORD)-dist;
+			steps.Cnt[steps.Count] = (WORD)cnt;
+			steps.Count++;
+		}
+	}
+};
+
+static const int encodedCntLen[16] = { -1, -1, -1, 3, 5, 5, 7, 7, 7, 9, 9, 9, 11, 11, 11, 11 };
+static const byte encodedDistLen[] = {
+	23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
+	15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,	// H = -30..-16
+	14,14,14,14,14,14,14,14,						// H = -15..-8
+	13,13,13,13,									// H = -7..-4
+	12,12,											// H = -3..-2
+	9												// H = -1
+};
+
+// Finds optimal op for position 'pos' given its matches.
+// All positions after 'pos' must be solved already.
+void OptimalCompressor::solvePosition(int pos, const MatchSteps& steps)
+{
+	if (small && !tape && !depack)
+		solveKernel<true>(pos, steps);
+	else
+		solveKernel<false>(pos, steps);
+}
+
+// solvePosition() for inputs of any size and objective, or for small ones packed for size.
+// Distances of small inputs fall in three classes (H = -1, -3..-2 and -4), whose bits are
+// taken once per match step, and backref sizes are added up by count without GetEncodedLen.
+template <bool SMALL>
+void OptimalCompressor::solveKernel(int pos, const MatchSteps& steps)
+{
+    int result;
+	int literalCost, runCost[16];
+	getLiteralCosts(pos, &literalCost, runCost);
 
-        // try backreferences
+    // try copy 1 byte
 
+    result = literalCost + cost[pos + 1];
+	Backref resultOp(-1, 0);
+	PROFILE_COUNT(WORK_POSITIONS, 1);
+
+    // try copy 12, 14..42 bytes
+
+    for (int i = 0; i < 16 && !Constraints.NoLiteralRuns; i++)
+    {
+        int cnt = i * 2 + 12;
+        if (pos + cnt > inputSize) {
+			break;
+		}
+        int t = runCost[i] + cost[pos + cnt];
+		PROFILE_COUNT(WORK_LITERAL_CANDIDATES, 1);
+        if (t < result) {
+			result = t; resultOp = Backref(-cnt, 0); 
+		}
+    }
+
+    // try backreferences
+
+    {
+        int cnt = 0;
+        for (int i = 0; i < steps.Count; i++)
         {
-			fill_matchLen(pos);
-            int cnt = 0;
-            int nextPos = pos;
-            for (int dist = -1; dist >= -pos; dist--)
+            int dist = -steps.Dist[i];
+            int matchCnt = steps.Cnt[i]; // already limited by input end and backref cnt limit
+			int distBits = !SMALL ? 0 : (dist >= -256) ? 9 : (dist >= -768) ? 12 : 13; // as encodedDistLen
+
+            while (cnt + 1 <= matchCnt)
             {
-				//if (dist < -0xFFFF) break;
-                int matchCnt = matchLen[dist + inputSize];
-
-                while (cnt + 1 <= matchCnt)
-                {
-                    if (nextPos >= inputSize) {
-						goto break_dist_loop;
-					}
-                    if (cnt >= 0xFFF) { // backref cnt limit
-						goto break_dist_loop;
-					}
-                    cnt++;
-                    nextPos++;
-
-                    Backref br(cnt, dist);
-                    int t = br.GetEncodedLen() + cost[pos + cnt];
-                    if (t < result) {
-						result = t; resultOp = br; 
-					}
-                }
+                cnt++;
+
+				int t;
+				if (SMALL)
+				{
+					if (cnt <= 2 && dist < (cnt == 1 ? -8 : -256))
+						continue; // impossible, as count 1 and 2 need a nearer distance
+					int len = (cnt == 1) ? 6 : (cnt == 2) ? 3 + 8 :
+						((cnt < 16) ? encodedCntLen[cnt] : (cnt < 256) ? 6 + 8 : 6 + 8 + 8) + distBits;
+					t = len + cost[pos + cnt];
+				}
+				else
+				{
+					Backref br(cnt, dist);
+					t = getBackrefCost(br) + cost[pos + cnt];
+				}
+				PROFILE_COUNT(WORK_BACKREF_CANDIDATES, 1);
+                if (t < result) {
+					result = t; resultOp = Backref(cnt, dist); 
+				}
             }
-			break_dist_loop: ;
         }
 
-        cost[pos] = result;
-        solution[pos] = resultOp;
+		if (steps.Period)
+			solveRunBackrefs(pos, steps.Period, result, resultOp);
     }
 
-	// return compressed size in bits
-
-	return 
-		8 + // first byte simply copied
-		cost[1];
+    cost[pos] = result;
+    solution[pos] = resultOp;
 };
 
+// For every position finds the smallest period of data starting there, which lasts
+// at least as far as the longest possible backref reaches.
+void OptimalCompressor::fill_runPeriod()
+{
+	int run[RUN_MAX_PERIOD + 1]; // run[p]: how many bytes from pos repeat ones at pos-p
+	for (int p = 1; p <= RUN_MAX_PERIOD; p++)
+		run[p] = 0;
+
+	for (int pos = inputSize - 1; pos >= 1; pos--)
+	{
+		int maxCnt = min(maxCount, inputSize - pos);
+		runPeriod[pos] = 0;
+		for (int p = RUN_MAX_PERIOD; p >= 1; p--)
+		{
+			run[p] = (p <= pos && input[pos] == input[pos - p]) ? run[p] + 1 : 0;
+			if (run[p] >= maxCnt && p <= maxDist)
+				runPeriod[pos] = (byte)p;
+		}
+	}
+}
+
+// fill_matchLen for position with runPeriod. Only distances -1..-period are filled,
+// because backref loop reaches its count limit at -period.
+// Returns false if a shorter distance has match longer than RUN_DIRECT_CNT,
+// then the position must be solved the usual way.
+bool OptimalCompressor::fill_matchLen_periodic(int pos, int period, int* matchLen)
+{
+	for (int k = 1; k < period; k++)
+	{
+		// data differs from period k before the farthest backref end (runPeriod guarantees it)
+		int len = 0;
+		while (input[pos - k + len] == input[pos + len])
+		{
+			len++;
+			PROFILE_COUNT(WORK_Z_COMPARES, 1);
+			if (len > RUN_DIRECT_CNT)
+				return false;
+		}
+		PROFILE_COUNT(WORK_Z_COMPARES, 1);
+		matchLen[inputSize - k] = len;
+	}
+	matchLen[inputSize - period] = inputSize; // longer than any backref
+	return true;
+}
+
+// Moves runWindows to cover counts from runWindowCnt at position 'pos'.
+// Consecutive positions slide windows by one, otherwise they are rebuilt.
+void OptimalCompressor::slideRunWindows(int pos)
+{
+	bool rebuild = (runWindowsPos != pos + 1);
+	runWindowsPos = pos;
+
+	for (int w = 0; w < 2; w++)
+	{
+		RunWindow& win = runWindows[w];
+		int lo = pos + runWindowCnt[w][0];
+		int hi = min(pos + min(runWindowCnt[w][1], maxCount), inputSize); // empty if lo > hi
+		int from = lo;
+		if (rebuild)
+		{
+			win.Head = win.Tail = 0;
+			from = hi;
+		}
+		// newly added positions are the lowest; worse or equal costs behind them are dropped.
+		// Near the end lo may be past hi, then nothing is added.
+		for (int q = min(from, hi); q >= lo; q--)
+		{
+			int key = cost[q] + copyCost * q;
+			while (win.Tail != win.Head)
+			{
+				int last = win.Pos[(win.Tail - 1) & 0xFFF];
+				if (cost[last] + copyCost * last < key)
+					break;
+				win.Tail--;
+			}
+			win.Pos[win.Tail++ & 0xFFF] = (WORD)q;
+		}
+		while (win.Tail != win.Head && win.Pos[win.Head & 0xFFF] > hi)
+			win.Head++;
+	}
+}
+
+// Backrefs longer than RUN_DIRECT_CNT at position with runPeriod, all at distance -period.
+// Gives the same op as the backref loop: the first best candidate wins, and only if strictly better.
+// Under OBJECTIVE_TAPE_TIME 1 bits of the count make candidates of a window differ
+// by a few bits more than cost after them, so the window minimum may be that far from best.
+void OptimalCompressor::solveRunBackrefs(int pos, int period, int& result, Backref& resultOp)
+{
+	slideRunWindows(pos);
+
+	for (int w = 0; w < 2; w++)
+	{
+		RunWindow& win = runWindows[w];
+		if (win.Tail == win.Head)
+			break; // window is beyond input end, and so is the next one
+
+		int q = win.Pos[win.Head & 0xFFF];
+		Backref br(q - pos, -period);
+		int t = getBackrefCost(br) + cost[q];
+		PROFILE_COUNT(WORK_BACKREF_CANDIDATES, 1);
+		if (t < result) {
+			result = t; resultOp = br;
+		}
+	}
+}
+
 // Finds longest match for every possible reference distance
-void OptimalCompressor::fill_matchLen(int pos)
+void OptimalCompressor::fill_matchLen(int pos, int* matchLen)
 {
     if (pos >= inputSize) throw;
 
@@ -469,7 +1197,9 @@ void OptimalCompressor::fill_matchLen(int pos)
         while (i + zi < n && s[i + zi] == s[zi])
         {
             zi++;
+			PROFILE_COUNT(WORK_Z_COMPARES, 1);
         }
+		PROFILE_COUNT(WORK_Z_COMPARES, (i + zi < n) ? 1 : 0); // the failed one
 
         if (i + zi - 1 > r)
         {
@@ -483,35 +1213,62 @@ void OptimalCompressor::fill_matchLen(int pos)
     // z[0] is undefined
 }
 
-static const int encodedCntLen[16] = { -1, -1, -1, 3, 5, 5, 7, 7, 7, 9, 9, 9, 11, 11, 11, 11 };
-static const byte encodedDistLen[] = {
-	23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,
-	15,15,15,15,15,15,15,15,15,15,15,15,15,15,15,	// H = -30..-16
-	14,14,14,14,14,14,14,14,						// H = -15..-8
-	13,13,13,13,									// H = -7..-4
-	12,12,											// H = -3..-2
-	9												// H = -1
-};
-
 int Backref::GetEncodedLen()
 {
     //if (Count <= 0) throw;
     //if (Dist >= 0) throw;
 
 	#define infinity 0x0FFFFFFF
-	#define impossible infinity
+	#define impossible (PROFILE_COUNT(WORK_ENCODED_IMPOSSIBLE, 1), infinity)
 
-    if (Count == 1) return (Dist >= -8) ? 6 : impossible;
-    if (Count == 2) return (Dist >= -256) ? 3 + 8 : impossible;
+    if (Count == 1) return PROFILE_COUNT(WORK_ENCODED_COUNT1, 1), (Dist >= -8) ? 6 : impossible;
+    if (Count == 2) return PROFILE_COUNT(WORK_ENCODED_COUNT2, 1), (Dist >= -256) ? 3 + 8 : impossible;
 
 	//if (Dist < -0xFFFF) throw;
 	int distBits = encodedDistLen[(Dist >> 8) + 256];  // 9...23
 
-	if (Count < 16) return encodedCntLen[Count] + distBits;
-    if (Count < 256) return (6 + 8) + distBits;
-    if (Count < 0x1000) return (6 + 8 + 8) + distBits;
+	if (Count < 16) return PROFILE_COUNT(WORK_ENCODED_SHORT_COUNT, 1), encodedCntLen[Count] + distBits;
+    if (Count < 256) return PROFILE_COUNT(WORK_ENCODED_MEDIUM_COUNT, 1), (6 + 8) + distBits;
+    if (Count < 0x1000) return PROFILE_COUNT(WORK_ENCODED_LONG_COUNT, 1), (6 + 8 + 8) + distBits;
     return impossible;
 
 	#undef impossible
 };
 
+// Follows Compressor::Compress_Emit()
+int Backref::GetEncodedOnes()
+{
+    if (Count == 1) return countOnes(Dist & 7); // 000
+    if (Count == 2) return 1 + countOnes(Dist & 0xFF); // 001, byte
+
+    int cntOnes;
+    if (Count == 3) cntOnes = 1; // 0 10
+    else if (Count < 16)
+    {
+        cntOnes = 0;
+        for (int cnt = Count; cnt >= 0; cnt -= 3)
+            cntOnes += countOnes(min(cnt, 3));
+    }
+    else cntOnes = 3 + countOnes(Count); // 0 11001, one or two bytes
+
+    int H = Dist >> 8;
+    int distOnes = countOnes(Dist & 0xFF);
+    if (H == -1) distOnes += 1; // 1
+    else if (H >= -3) distOnes += 2 + (~H & 1); // 011
+    else if (H >= -7) distOnes += 1 + countOnes((H + 3) & 3); // 010
+    else if (H >= -15) distOnes += 1 + countOnes((H + 7) & 7); // 001
+    else if (H >= -30) distOnes += countOnes((H + 15) & 15); // 000
+    else distOnes += countOnes(H & 0xFF); // 000 0000
+
+    return cntOnes + distOnes;
+};
+
+int Backref::GetDepackTime()
+{
+    int bytes; // data bytes of the encoding
+    if (Count == 1) bytes = 0;
+    else if (Count == 2) bytes = 1;
+    else bytes = (Count >= 256 ? 2 : Count >= 16 ? 1 : 0) + ((Dist >> 8) < -30 ? 2 : 1);
+    return getDepackTime(GetEncodedLen() - bytes * 8, bytes, Count);
+};
+
@@ -0,0 +1,565 @@
+
+#include "decompress.h"
+
+#define HEADER_SIZE 8
+
+// Control bits come in bytes, most significant bit first. Compressor reserves a control
+// byte when it emits the first bit of it, so the next one is read only when a bit is needed.
+inline int Decompressor::getBit()
+{
+	if (controlBitsCnt == 0)
+	{
+		if (inputPtr == inputEnd)
+		{
+			overrun = true;
+			return 0;
+		}
+		controlByte = unsigned(*inputPtr++) << 24;
+		controlBitsCnt = 8;
+	}
+	int bit = controlByte >> 31;
+	controlByte <<= 1;
+	controlBitsCnt--;
+	return bit;
+}
+
+inline int Decompressor::getBits(int n)
+{
+	int r = 0;
+	while (n > controlBitsCnt)
+	{
+		// take what is left and load next control byte
+		if (controlBitsCnt > 0)
+		{
+			r = (r << controlBitsCnt) | int(controlByte >> (32 - controlBitsCnt));
+			n -= controlBitsCnt;
+		}
+		if (inputPtr == inputEnd)
+		{
+			overrun = true;
+			return 0;
+		}
+		controlByte = unsigned(*inputPtr++) << 24;
+		controlBitsCnt = 8;
+	}
+	r = (r << n) | int(controlByte >> (32 - n));
+	controlByte <<= n;
+	controlBitsCnt -= n;
+	return r;
+}
+
+inline int Decompressor::getByte()
+{
+	if (inputPtr == inputEnd)
+	{
+		overrun = true;
+		return 0;
+	}
+	return *inputPtr++;
+}
+
+void CopyBackref(byte* dst, int dist, int cnt)
+{
+	const byte* src = dst + dist;
+	if (cnt <= 3)
+	{
+		// most backrefs are short
+		for (int i = 0; i < cnt; i++) dst[i] = src[i];
+	}
+	else if (-dist >= cnt)
+	{
+		memcpy(dst, src, cnt);
+	}
+	else if (dist == -1)
+	{
+		memset(dst, *src, cnt);
+	}
+	else
+	{
+		// Copied part repeats the period, so each block may be as long as everything
+		// copied so far and never overlaps its source
+		int done = 0;
+		while (done < cnt)
+		{
+			int n = min(-dist + done, cnt - done);
+			memcpy(dst + done, src, n);
+			done += n;
+		}
+	}
+}
+
+DECOMPRESS_RESULT Decompressor::Decompress(const byte* input, int inputSize, byte* output, int* outputSize)
+{
+	*outputSize = 0;
+
+	// Header
+
+	if (inputSize < HEADER_SIZE || input[0] != 'h' || input[1] != 'r' || input[2] != '2')
+		return DECOMPRESS_BAD_HEADER;
+	int unpackedSize = input[4] | input[5] << 8;
+	int packedSize = input[6] | input[7] << 8;
+
+	if (input[3] == '1' + 0x80)
+	{
+		// Store method
+		if (packedSize != unpackedSize || HEADER_SIZE + unpackedSize > inputSize)
+			return DECOMPRESS_BAD_HEADER;
+		memcpy(output, &input[HEADER_SIZE], unpackedSize);
+		*outputSize = unpackedSize;
+		return DECOMPRESSED_OK;
+	}
+
+	if (input[3] != '1' || unpackedSize < 6 + 1 || packedSize < 6 + 1 + 1 || HEADER_SIZE + packedSize > inputSize)
+		return DECOMPRESS_BAD_HEADER;
+
+	// last 6 bytes are stored as is
+	memcpy(&output[unpackedSize - 6], &input[HEADER_SIZE], 6);
+
+	inputPtr = &input[HEADER_SIZE + 6];
+	inputEnd = &input[HEADER_SIZE + packedSize];
+	overrun = false;
+	controlBitsCnt = 0;
+
+	byte* outputPtr = output;
+	byte* outputEnd = &output[unpackedSize - 6];
+
+	*outputPtr++ = (byte)getByte(); // first byte is simply copied
+
+	while (true)
+	{
+		if (overrun)
+			return DECOMPRESS_CORRUPT;
+
+		if (getBit())
+		{
+			// copy 1 byte
+			if (outputPtr == outputEnd) return DECOMPRESS_CORRUPT;
+			*outputPtr++ = (byte)getByte();
+			continue;
+		}
+
+		int cnt;
+		int dist;
+
+		if (!getBit())
+		{
+			if (!getBit())
+			{
+				cnt = 1;
+				dist = getBits(3) - 8;
+			}
+			else
+			{
+				cnt = 2;
+				dist = getByte() - 256;
+			}
+		}
+		else
+		{
+			// count 3..0xFFF or one of special codes
+			if (!getBit())
+			{
+				cnt = 3;
+			}
+			else
+			{
+				int t = getBits(2);
+				if (t != 0)
+				{
+					// 4..15
+					cnt = 3 + t;
+					for (int i = 2; i < 5 && t == 3; i++)
+					{
+						t = getBits(2);
+						cnt += t;
+					}
+				}
+				else if (getBit())
+				{
+					int h = getByte();
+					if (h == 0)
+					{
+						break; // end of stream marker
+					}
+					cnt = (h >= 16) ? h : (h << 8 | getByte());
+				}
+				else
+				{
+					// copy 12..42 bytes
+					cnt = getBits(4) * 2 + 12;
+					if (cnt > outputEnd - outputPtr || cnt > inputEnd - inputPtr)
+						return DECOMPRESS_CORRUPT;
+					memcpy(outputPtr, inputPtr, cnt);
+					outputPtr += cnt;
+					inputPtr += cnt;
+					continue;
+				}
+			}
+
+			int H;
+			if (getBit())
+			{
+				H = -1;
+			}
+			else
+			{
+				int c = getBits(2);
+				if (c == 3)
+				{
+					H = getBit() - 3;
+				}
+				else if (c == 2)
+				{
+					H = getBits(2) - 7;
+				}
+				else if (c == 1)
+				{
+					H = getBits(3) - 15;
+				}
+				else
+				{
+					int v = getBits(4);
+					H = (v != 0) ? v - 31 : getByte() - 256;
+				}
+			}
+			dist = H * 256 + getByte();
+		}
+
+		if (overrun || cnt > outputEnd - outputPtr || -dist > outputPtr - output)
+			return DECOMPRESS_CORRUPT;
+
+		CopyBackref(outputPtr, dist, cnt);
+		outputPtr += cnt;
+	}
+
+	if (overrun || outputPtr != outputEnd || inputPtr != inputEnd)
+		return DECOMPRESS_CORRUPT;
+
+	*outputSize = unpackedSize;
+	return DECOMPRESSED_OK;
+}
+
+// StreamDecompressor
+
+// Bit reader is the same as Decompressor's
+inline int StreamDecompressor::getBit()
+{
+	if (controlBitsCnt == 0)
+	{
+		if (inputPtr == inputEnd)
+		{
+			overrun = true;
+			return 0;
+		}
+		controlByte = unsigned(*inputPtr++) << 24;
+		controlBitsCnt = 8;
+	}
+	int bit = controlByte >> 31;
+	controlByte <<= 1;
+	controlBitsCnt--;
+	return bit;
+}
+
+inline int StreamDecompressor::getBits(int n)
+{
+	int r = 0;
+	while (n > controlBitsCnt)
+	{
+		if (controlBitsCnt > 0)
+		{
+			r = (r << controlBitsCnt) | int(controlByte >> (32 - controlBitsCnt));
+			n -= controlBitsCnt;
+		}
+		if (inputPtr == inputEnd)
+		{
+			overrun = true;
+			return 0;
+		}
+		controlByte = unsigned(*inputPtr++) << 24;
+		controlBitsCnt = 8;
+	}
+	r = (r << n) | int(controlByte >> (32 - n));
+	controlByte <<= n;
+	controlBitsCnt -= n;
+	return r;
+}
+
+inline int StreamDecompressor::getByte()
+{
+	if (inputPtr == inputEnd)
+	{
+		overrun = true;
+		return 0;
+	}
+	return *inputPtr++;
+}
+
+StreamDecompressor::StreamDecompressor(byte* window, int windowSize)
+	: window(window), windowSize(windowSize), unpackedSize(0), finished(false), result(DECOMPRESS_BAD_HEADER)
+{
+}
+
+DECOMPRESS_RESULT StreamDecompressor::Start(const byte* input, int inputSize)
+{
+	unpackedSize = 0;
+	finished = false;
+	result = DECOMPRESS_BAD_HEADER;
+
+	if (inputSize < HEADER_SIZE || input[0] != 'h' || input[1] != 'r' || input[2] != '2')
+		return result;
+	int size = input[4] | input[5] << 8;
+	int packedSize = input[6] | input[7] << 8;
+
+	this->input = input;
+	overrun = false;
+	controlBitsCnt = 0;
+	windowPos = 0;
+	decodedSize = 0;
+	stepCnt = stepIdx = 0;
+
+	if (input[3] == '1' + 0x80)
+	{
+		// Store method: the whole block is one step
+		if (packedSize != size || HEADER_SIZE + size > inputSize)
+			return result;
+		inputPtr = &input[HEADER_SIZE];
+		inputEnd = &input[HEADER_SIZE + size];
+		ended = true;
+		setSteps(0, size);
+	}
+	else
+	{
+		if (input[3] != '1' || size < 6 + 1 || packedSize < 6 + 1 + 1 || HEADER_SIZE + packedSize > inputSize)
+			return result;
+		inputPtr = &input[HEADER_SIZE + 6];
+		inputEnd = &input[HEADER_SIZE + packedSize];
+		ended = false;
+		setSteps(0, 1); // first byte is simply copied
+	}
+
+	unpackedSize = size;
+	result = DECOMPRESSED_OK;
+	return result;
+}
+
+inline void StreamDecompressor::setSteps(int dist, int cnt)
+{
+	steps[0].Dist = dist;
+	steps[0].Cnt = cnt;
+	stepCnt = 1;
+	stepIdx = 0;
+	decodedSize += cnt;
+}
+
+// Same as a pass of Decompressor's loop, except that bytes go to steps
+void StreamDecompressor::decodeOp()
+{
+	if (ended)
+	{
+		finished = true;
+		return;
+	}
+
+	int outputLeft = unpackedSize - 6 - decodedSize;
+
+	if (getBit())
+	{
+		// copy 1 byte
+		if (overrun || outputLeft == 0 || inputPtr == inputEnd)
+		{
+			result = DECOMPRESS_CORRUPT;
+			return;
+		}
+		setSteps(0, 1);
+		return;
+	}
+
+	int cnt;
+	int dist;
+
+	if (!getBit())
+	{
+		if (!getBit())
+		{
+			cnt = 1;
+			dist = getBits(3) - 8;
+		}
+		else
+		{
+			cnt = 2;
+			dist = getByte() - 256;
+		}
+	}
+	else
+	{
+		if (!getBit())
+		{
+			cnt = 3;
+		}
+		else
+		{
+			int t = getBits(2);
+			if (t != 0)
+			{
+				cnt = 3 + t;
+				for (int i = 2; i < 5 && t == 3; i++)
+				{
+					t = getBits(2);
+					cnt += t;
+				}
+			}
+			else if (getBit())
+			{
+				int h = getByte();
+				if (h == 0)
+				{
+					// end of stream marker; last 6 bytes come from header
+					if (overrun || outputLeft != 0 || inputPtr != inputEnd)
+					{
+						result = DECOMPRESS_CORRUPT;
+						return;
+					}
+					ended = true;
+					inputPtr = &input[HEADER_SIZE];
+					inputEnd = &input[HEADER_SIZE + 6];
+					setSteps(0, 6);
+					return;
+				}
+				cnt = (h >= 16) ? h : (h << 8 | getByte());
+			}
+			else
+			{
+				// copy 12..42 bytes
+				cnt = getBits(4) * 2 + 12;
+				if (overrun || cnt > outputLeft || cnt > inputEnd - inputPtr)
+				{
+					result = DECOMPRESS_CORRUPT;
+					return;
+				}
+				setSteps(0, cnt);
+				return;
+			}
+		}
+
+		int H;
+		if (getBit())
+		{
+			H = -1;
+		}
+		else
+		{
+			int c = getBits(2);
+			if (c == 3)
+			{
+				H = getBit() - 3;
+			}
+			else if (c == 2)
+			{
+				H = getBits(2) - 7;
+			}
+			else if (c == 1)
+			{
+				H = getBits(3) - 15;
+			}
+			else
+			{
+				int v = getBits(4);
+				H = (v != 0) ? v - 31 : getByte() - 256;
+			}
+		}
+		dist = H * 256 + getByte();
+	}
+
+	if (overrun || cnt > outputLeft || -dist > decodedSize)
+	{
+		result = DECOMPRESS_CORRUPT;
+		return;
+	}
+	if (-dist > windowSize)
+	{
+		result = DECOMPRESS_WINDOW_TOO_SMALL;
+		return;
+	}
+	setSteps(dist, cnt);
+}
+
+// Takes 'cnt' bytes from input to 'output' and window
+inline void StreamDecompressor::putLiterals(byte* output, int cnt)
+{
+	if (cnt <= 3 && windowPos + cnt < windowSize)
+	{
+		// most literals are single bytes
+		for (int i = 0; i < cnt; i++) output[i] = window[windowPos + i] = inputPtr[i];
+		inputPtr += cnt;
+		windowPos += cnt;
+		return;
+	}
+	memcpy(output, inputPtr, cnt);
+	while (cnt > 0)
+	{
+		int n = min(cnt, windowSize - windowPos);
+		memcpy(&window[windowPos], inputPtr, n);
+		inputPtr += n;
+		cnt -= n;
+		windowPos += n;
+		if (windowPos == windowSize) windowPos = 0;
+	}
+}
+
+// Copies 'cnt' bytes from 'dist' back in window to window and 'output'
+inline void StreamDecompressor::putBackref(byte* output, int dist, int cnt)
+{
+	if (cnt <= 3 && windowPos + dist >= 0 && windowPos + cnt < windowSize)
+	{
+		// most backrefs are short
+		byte* dst = &window[windowPos];
+		for (int i = 0; i < cnt; i++) output[i] = dst[i] = dst[i + dist];
+		windowPos += cnt;
+		return;
+	}
+	while (cnt > 0)
+	{
+		int src = windowPos + dist;
+		int n;
+		if (src >= 0)
+		{
+			n = min(cnt, windowSize - windowPos);
+			CopyBackref(&window[windowPos], dist, n);
+		}
+		else
+		{
+			// source wraps: copy up to the end of the ring, all of it is older than this block
+			src += windowSize;
+			n = min(cnt, min(windowSize - src, windowSize - windowPos));
+			memmove(&window[windowPos], &window[src], n);
+		}
+		memcpy(output, &window[windowPos], n);
+		output += n;
+		cnt -= n;
+		windowPos += n;
+		if (windowPos == windowSize) windowPos = 0;
+	}
+}
+
+int StreamDecompressor::Read(byte* output, int size)
+{
+	int done = 0;
+	while (done < size && result == DECOMPRESSED_OK && !finished)
+	{
+		if (stepIdx == stepCnt)
+		{
+			decodeOp();
+			continue;
+		}
+		Step& step = steps[stepIdx];
+		int n = min(step.Cnt, size - done);
+		if (step.Dist == 0)
+			putLiterals(&output[done], n);
+		else
+			putBackref(&output[done], step.Dist, n);
+		done += n;
+		step.Cnt -= n;
+		if (step.Cnt == 0) stepIdx++;
+	}
+	return done;
+}
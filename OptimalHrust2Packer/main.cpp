@@ -1,122 +1,1344 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <Windows.h>
+#include <math.h>
+#include "platform.h"
 #include "compress.h"
-#include <time.h>
+#include "decompress.h"
+#include "heatmap.h"
+#include "parse.h"
+#include "similarity.h"
+#include "snapshot.h"
+#include "../Benchmark/depackers.h"
+#include <signal.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
-Compressor compressor;
+Compressor compressor; // single file mode; batch workers allocate their own
+ConsoleProgress consoleProgress;
+CancellationToken cancellation;
+
+// Human-readable messages go to stderr when stdout is used for JSON stats
+FILE* messages = stdout;
+std::mutex messagesLock;
+
+enum STATS_MODE
+{
+	STATS_NONE,
+	STATS_TEXT,
+	STATS_JSON
+};
+
+struct Options
+{
+	bool Batch;
+	bool Snapshot;      // input is a .sna/.z80 snapshot, its regions are packed as batch jobs
+	bool Similarity;    // report content shared by input files instead of packing them
+	int Jobs;           // batch worker threads
+	int Threads;        // match finding threads per file, 0 = default
+	STATS_MODE Stats;
+	const char* TracePath; // NULL if no trace requested
+	bool Profile;
+	bool Verify;         // unpack output in memory and compare with input
+	HEATMAP_FORMAT Heatmap; // save bits spent on each input byte to <output>.heat
+	bool HeatmapPng;     // same as picture <output>.png, for ZX screens
+	const char* ParseOut; // save chosen ops to this parse file, "" for <output>.parse, NULL if not asked
+	const char* ParseIn;  // emit ops from this parse file instead of solving DP, "" for <output>.parse
+	const char* DepackerOut; // save Z80 depacker made for the output to this file, "" for <output>.asm, NULL if not asked
+	ParseConstraints Constraints; // limits on ops of the parse
+	bool ConstraintCost; // also solve DP without each constraint and report its size
+	bool Tape;           // minimize ROM tape load time instead of size
+	bool Sectors;        // minimize depacking time within the sectors of output packed for size
+	std::vector<const char*> Paths;
+};
+
+// Size of optimal parse under some of the constraints, measured by --constraint-cost
+struct ConstraintCost
+{
+	std::string Name;
+	ParseConstraints Constraints;
+	int Bits; // -1 if not solved
+
+	ConstraintCost(const std::string& name, const ParseConstraints& constraints)
+		: Name(name), Constraints(constraints), Bits(-1) {};
+};
+
+// One file to compress and everything measured while doing it
+struct FileJob
+{
+	std::string InputPath;
+	std::string OutputPath;
+	bool InMemory;            // --snapshot: compress Data and keep output in Packed, no files read or written
+	std::vector<byte> Data;
+	std::vector<byte> Packed;
+	int Worker;     // batch worker which processed the file
+	int InputSize;
+	int OutputSize;
+	int Result;     // process exit code for this file, 0 = OK
+	long long PlannedWork; // progress estimate of all its DP passes (see PlanProgress)
+	PhaseTimes Times;
+	OpStats Ops;    // empty if the file was not compressed or stats were not asked for
+	std::vector<ConstraintCost> ConstraintCosts; // empty if not asked for or not measured
+	int TapeTime;               // --tape: load time of output (see GetTapeLoadTime), 0 if not measured
+	int SizeOptimalTapeTime;    // and of output packed for size, 0 if not measured
+	int SizeOptimalOutputSize;
+	int Sectors;                // --sectors: 256-byte sectors output takes, 0 if not packed that way
+	int BitTime;                // Compressor::BitTime it was packed with, 0 if packed for size
+	int DepackTime;             // estimated depacking time (Compressor::DepackTime)
+	int SizeOptimalDepackTime;  // and of output packed for size
+#ifdef OHC_PROFILE
+	WorkCounters Work;
+#endif
+
+	FileJob() : InMemory(false), Worker(0), InputSize(0), OutputSize(0), Result(0), PlannedWork(0), TapeTime(0), SizeOptimalTapeTime(0), SizeOptimalOutputSize(0),
+		Sectors(0), BitTime(0), DepackTime(0), SizeOptimalDepackTime(0) {};
+};
+
+void OnInterrupt(int)
+{
+	// let DP loop notice it and return
+	cancellation.Cancel();
+}
 
 void PrintVersion()
 {
-	printf("\n");
-	printf("Optimal Hrust 2.1 compressor, ");
-	#ifdef _WIN64
-		printf("x64\n");
+	fprintf(messages, "\n");
+	fprintf(messages, "Optimal Hrust 2.1 compressor, ");
+	#if defined(_WIN64) || defined(__LP64__)
+		fprintf(messages, "x64\n");
 	#else
-		printf("x86\n");
+		fprintf(messages, "x86\n");
 	#endif
-	printf("version 2015.03.10\n");
-	printf("by Eugene Larchenko (https://gitlab.com/eugene77)\n");
-	printf("\n");
+	fprintf(messages, "version 2015.03.10\n");
+	fprintf(messages, "by Eugene Larchenko (https://gitlab.com/eugene77)\n");
+	fprintf(messages, "\n");
 }
 
 void PrintUsage()
 {
-	printf("Usage:\n");
-	printf("oh2c.exe <input> [<output>]\n");
-	printf("\n");
+	fprintf(messages, "Usage:\n");
+	fprintf(messages, "oh2c.exe [options] <input> [<output>]\n");
+	fprintf(messages, "oh2c.exe [options] --batch <input>...   (writes <input>.hr21 for each input)\n");
+	fprintf(messages, "oh2c.exe [options] --snapshot <input.sna|z80> [<output>]\n");
+	fprintf(messages, "                   (writes packed blocks to <output> and load map to <output>.map)\n");
+	fprintf(messages, "oh2c.exe [options] --similarity <input>...\n");
+	fprintf(messages, "                   (reports which files share content, packs nothing)\n");
+	fprintf(messages, "\n");
+	fprintf(messages, "Options:\n");
+	fprintf(messages, "  --stats          print time spent in each phase and bits taken by each kind of op\n");
+	fprintf(messages, "  --stats=json     same as JSON on stdout (messages go to stderr)\n");
+	fprintf(messages, "  --trace=<file>   save Chrome trace (chrome://tracing, Perfetto)\n");
+	fprintf(messages, "  --profile        print work and hardware counters (OHC_PROFILE builds only)\n");
+	fprintf(messages, "  --verify         unpack compressed data in memory and compare with input\n");
+	fprintf(messages, "  --heatmap[=f32|u16]  save bits spent on each input byte to <output>.heat\n");
+	fprintf(messages, "                   (float, or uint16 in 1/256 bits)\n");
+	fprintf(messages, "  --heatmap-png    save the same as <output>.png for 6912-byte ZX screens\n");
+	fprintf(messages, "  --save-parse[=<file>]  save chosen ops as text (default: <output>.parse)\n");
+	fprintf(messages, "  --load-parse[=<file>]  emit ops from a saved parse instead of searching\n");
+	fprintf(messages, "                   (default: <output>.parse)\n");
+	fprintf(messages, "  --depacker[=<file>]  save Z80 depacker made for the paths the output takes\n");
+	fprintf(messages, "                   (default: <output>.asm); --verify also runs it in an emulator\n");
+	fprintf(messages, "  --no-literal-runs  don't use runs of 12..42 literal bytes\n");
+	fprintf(messages, "  --max-dist=<n>   don't refer further than n bytes back\n");
+	fprintf(messages, "  --max-count=<n>  don't copy more than n bytes by one backref\n");
+	fprintf(messages, "  --constraint-cost  report how many bits each of the above constraints costs\n");
+	fprintf(messages, "  --tape           minimize ROM tape load time (1 bits load twice as long as 0 bits)\n");
+	fprintf(messages, "                   instead of size, and compare it with output packed for size\n");
+	fprintf(messages, "  --sectors        minimize Z80 depacking time within as many 256-byte sectors\n");
+	fprintf(messages, "                   as output packed for size takes (about 8 compressions)\n");
+	fprintf(messages, "  --jobs=<n>, -j<n>  batch worker threads (default: number of CPUs)\n");
+	fprintf(messages, "  --threads=<n>    match finding threads per file (default: number of CPUs,\n");
+	fprintf(messages, "                   1 in batch mode); output doesn't depend on it\n");
+	fprintf(messages, "\n");
 }
 
-int main(int argc, const char* argv[])
+bool ParseOptions(int argc, const char* argv[], Options& options)
 {
-	PrintVersion();
+	options.Batch = false;
+	options.Snapshot = false;
+	options.Similarity = false;
+	options.Jobs = (int)std::thread::hardware_concurrency();
+	options.Stats = STATS_NONE;
+	options.TracePath = NULL;
+	options.Profile = false;
+	options.Verify = false;
+	options.Heatmap = HEATMAP_NONE;
+	options.HeatmapPng = false;
+	options.ParseOut = NULL;
+	options.ParseIn = NULL;
+	options.DepackerOut = NULL;
+	options.ConstraintCost = false;
+	options.Tape = false;
+	options.Sectors = false;
+	options.Threads = 0;
 
-	if (argc < 2 || argc > 3)
+	for (int i = 1; i < argc; i++)
 	{
-		PrintUsage();
-		return 1;
+		const char* a = argv[i];
+		if (strcmp(a, "--batch") == 0) options.Batch = true;
+		else if (strcmp(a, "--snapshot") == 0) options.Snapshot = true;
+		else if (strcmp(a, "--similarity") == 0) options.Similarity = true;
+		else if (strcmp(a, "--stats") == 0) options.Stats = STATS_TEXT;
+		else if (strcmp(a, "--stats=json") == 0) options.Stats = STATS_JSON;
+		else if (strncmp(a, "--trace=", 8) == 0 && a[8]) options.TracePath = a + 8;
+		else if (strcmp(a, "--profile") == 0) options.Profile = true;
+		else if (strcmp(a, "--verify") == 0) options.Verify = true;
+		else if (strcmp(a, "--heatmap") == 0 || strcmp(a, "--heatmap=f32") == 0) options.Heatmap = HEATMAP_F32;
+		else if (strcmp(a, "--heatmap=u16") == 0) options.Heatmap = HEATMAP_U16;
+		else if (strcmp(a, "--heatmap-png") == 0) options.HeatmapPng = true;
+		else if (strcmp(a, "--save-parse") == 0) options.ParseOut = "";
+		else if (strncmp(a, "--save-parse=", 13) == 0 && a[13]) options.ParseOut = a + 13;
+		else if (strcmp(a, "--load-parse") == 0) options.ParseIn = "";
+		else if (strncmp(a, "--load-parse=", 13) == 0 && a[13]) options.ParseIn = a + 13;
+		else if (strcmp(a, "--depacker") == 0) options.DepackerOut = "";
+		else if (strncmp(a, "--depacker=", 11) == 0 && a[11]) options.DepackerOut = a + 11;
+		else if (strcmp(a, "--no-literal-runs") == 0) options.Constraints.NoLiteralRuns = true;
+		else if (strncmp(a, "--max-dist=", 11) == 0) options.Constraints.MaxDist = atoi(a + 11);
+		else if (strncmp(a, "--max-count=", 12) == 0) options.Constraints.MaxCount = atoi(a + 12);
+		else if (strcmp(a, "--constraint-cost") == 0) options.ConstraintCost = true;
+		else if (strcmp(a, "--tape") == 0) options.Tape = true;
+		else if (strcmp(a, "--sectors") == 0) options.Sectors = true;
+		else if (strncmp(a, "--threads=", 10) == 0) options.Threads = atoi(a + 10);
+		else if (strncmp(a, "--jobs=", 7) == 0) options.Jobs = atoi(a + 7);
+		else if (strncmp(a, "-j", 2) == 0 && a[2]) options.Jobs = atoi(a + 2);
+		else if (a[0] == '-' && a[1] == '-') return false;
+		else options.Paths.push_back(a);
 	}
 
-	const char* inputPath = argv[1];
-	
-	char outputPath[1000];
-	const char* s = (argc >= 3) ? argv[2] : argv[1];
-	size_t sl = strlen(s);
-	if (sl + 10 > ARRAYSIZE(outputPath))
+	if (options.Jobs < 1) options.Jobs = 1;
+	if (options.Threads < 1) options.Threads = (options.Batch || options.Snapshot) ? 1 : (int)std::thread::hardware_concurrency();
+	if (options.Threads < 1) options.Threads = 1;
+	const ParseConstraints& c = options.Constraints;
+	if (c.MaxDist < 0 || c.MaxCount < 0)
+		return false;
+	if (options.Tape && options.Sectors)
+		return false;
+	if (options.Batch && options.Snapshot)
+		return false;
+	if (options.Similarity)
+		return !options.Batch && !options.Snapshot && options.Paths.size() >= 1;
+	if (options.Batch || options.Snapshot)
 	{
-		printf("Path is too long\n");
-		return 2;
+		// batch files and snapshot regions can only use their own <output>.parse and <output>.asm
+		if ((options.ParseOut && *options.ParseOut) || (options.ParseIn && *options.ParseIn) ||
+			(options.DepackerOut && *options.DepackerOut))
+			return false;
+		if (options.Snapshot)
+			return options.Paths.size() >= 1 && options.Paths.size() <= 2;
+		return options.Paths.size() >= 1;
 	}
-	strcpy(outputPath, s);
-	if (argc < 3)
+	else
+		return options.Paths.size() >= 1 && options.Paths.size() <= 2;
+}
+
+// Prints error of one file. In batch mode each message is one line prefixed with file name.
+void PrintFileError(const FileJob& job, bool verbose, const char* text)
+{
+	std::lock_guard<std::mutex> guard(messagesLock);
+	if (verbose)
 	{
-		strcat(outputPath, ".hr21");
+		fprintf(messages, "%s\n", text);
 	}
+	else
+	{
+		consoleProgress.Clear();
+		std::string line = text;
+		for (size_t i = 0; i < line.size(); i++)
+			if (line[i] == '\n') line[i] = ' ';
+		fprintf(messages, "%s: %s\n", job.InputPath.c_str(), line.c_str());
+	}
+}
 
+// Unpacks compressed data in memory and compares it with input
+bool VerifyOutput(const Compressor& compressor)
+{
+	Decompressor decompressor;
+	std::vector<byte> unpacked(MAX_UNPACKED_SIZE);
+	int unpackedSize;
+	DECOMPRESS_RESULT r = decompressor.Decompress(compressor.Output, compressor.OutputSize, &unpacked[0], &unpackedSize);
+	return r == DECOMPRESSED_OK &&
+		unpackedSize == compressor.InputSize &&
+		memcmp(&unpacked[0], compressor.Input, unpackedSize) == 0;
+}
 
-	int result = 0;
+// Path of parse file given by --save-parse or --load-parse
+std::string GetParsePath(const FileJob& job, const char* option)
+{
+	return *option ? std::string(option) : job.OutputPath + ".parse";
+}
+
+// Merges ops of several blocks, so that one depacker routine unpacks them all
+void AddOps(OpStats& total, const OpStats& ops)
+{
+	for (int k = 0; k < OP_KIND_COUNT; k++)
+	{
+		if (ops.Count[k] > 0)
+		{
+			bool first = (total.Count[k] == 0);
+			if (first || ops.MinCount[k] < total.MinCount[k]) total.MinCount[k] = ops.MinCount[k];
+			if (first || ops.MaxCount[k] > total.MaxCount[k]) total.MaxCount[k] = ops.MaxCount[k];
+			if (first || ops.MinDist[k] < total.MinDist[k]) total.MinDist[k] = ops.MinDist[k];
+			if (first || ops.MaxDist[k] > total.MaxDist[k]) total.MaxDist[k] = ops.MaxDist[k];
+		}
+		total.Count[k] += ops.Count[k];
+		total.ControlBits[k] += ops.ControlBits[k];
+		total.DataBytes[k] += ops.DataBytes[k];
+	}
+}
 
-	FILE* fIn = fopen(inputPath, "r+b");
-	if (!fIn)
+// --depacker: source of the Z80 routine (Benchmark/depackers.cpp) with the paths of
+// blocks that have 'ops'. Constraints such as --no-rir or --max-dist leave out more code.
+std::string MakeDepacker(const OpStats& ops)
+{
+	std::vector<PackedOps> kinds; // as Packer::GetOps() of ohz80 gives them
+	for (int k = 0; k < OP_KIND_COUNT; k++)
+	{
+		if (ops.Count[k] == 0 || k == OP_HEADER || k == OP_PADDING) continue;
+		PackedOps o = { OpKindNames[k], ops.Count[k], ops.MinCount[k], ops.MaxCount[k], ops.MinDist[k], ops.MaxDist[k] };
+		kinds.push_back(o);
+	}
+	return SpecializeZ80Depacker("hrust2", &kinds).Source;
+}
+
+// Unpacks a block with depacker 'source' in the Z80 emulator of ohz80 and compares it with
+// 'data'. Returns false with 'error' set if it differs. Blocks that don't fit in 64K next
+// to their output are not run, 'tStates' is 0 then.
+bool VerifyDepacker(const std::string& source, const byte* packed, int packedSize, const byte* data, int size,
+	int* codeSize, long long* tStates, std::string& error)
+{
+	*tStates = 0;
+	const char* e = CheckZ80Depacker(source, packed, packedSize, data, size, codeSize, tStates);
+	if (!e || strcmp(e, "doesn't fit in 64K") == 0)
+		return true;
+	error = e;
+	return false;
+}
+
+// Writes depacker source to 'path'
+bool SaveDepacker(const char* path, const std::string& source)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	bool ok = fwrite(source.data(), 1, source.size(), f) == source.size();
+	return fclose(f) == 0 && ok;
+}
+
+// Reads parse file given by --load-parse into 'parse' and makes compressor emit it.
+// Returns false with error printed if the file can't be read or doesn't fit the input.
+bool LoadParseFile(Compressor& compressor, FileJob& job, bool verbose, const Options& options, std::vector<Backref>& parse)
+{
+	std::string parsePath = GetParsePath(job, options.ParseIn);
+	if (verbose) fprintf(messages, "Reading parse: %s\n", parsePath.c_str());
+
+	int inputSize = 0;
+	std::vector<int> lines;
+	std::string error;
+	if (LoadParse(parsePath.c_str(), &inputSize, parse, lines, error))
+	{
+		parse.reserve(1); // Parse must not be NULL even without ops
+		compressor.Parse = parse.data();
+		compressor.ParseSize = (int)parse.size();
+		if (inputSize != compressor.InputSize)
+		{
+			char text[100];
+			sprintf(text, "parse is for input of %d bytes, not %d", inputSize, compressor.InputSize);
+			error = text;
+		}
+		else if (compressor.InputSize >= 6 + 1)
+		{
+			const char* e;
+			int badOp;
+			if (compressor.CheckParse(&e, &badOp) < 0)
+			{
+				char text[32];
+				if (badOp < (int)lines.size())
+					sprintf(text, "line %d: ", lines[badOp]);
+				else
+					sprintf(text, "end of file: ");
+				error = std::string(text) + e;
+			}
+		}
+	}
+	if (error.empty())
+		return true;
+
+	compressor.Parse = NULL;
+	std::string text = "ERROR!\nParse file " + parsePath + ", " + error;
+	PrintFileError(job, verbose, text.c_str());
+	job.Result = 8;
+	return false;
+}
+
+// DP runs of --constraint-cost: no constraints, each given one alone and all of them
+void ListConstraintRuns(const ParseConstraints& given, std::vector<ConstraintCost>& runs)
+{
+	runs.push_back(ConstraintCost("none", ParseConstraints()));
+	ParseConstraints c;
+	char name[40];
+	if (given.NoLiteralRuns)
+	{
+		c = ParseConstraints(); c.NoLiteralRuns = true;
+		runs.push_back(ConstraintCost("--no-literal-runs", c));
+	}
+	if (given.MaxDist)
+	{
+		c = ParseConstraints(); c.MaxDist = given.MaxDist;
+		sprintf(name, "--max-dist=%d", given.MaxDist);
+		runs.push_back(ConstraintCost(name, c));
+	}
+	if (given.MaxCount)
+	{
+		c = ParseConstraints(); c.MaxCount = given.MaxCount;
+		sprintf(name, "--max-count=%d", given.MaxCount);
+		runs.push_back(ConstraintCost(name, c));
+	}
+	if (runs.size() > 2)
+		runs.push_back(ConstraintCost("all", given));
+}
+
+// Solves DP for every run of ListConstraintRuns, so that the cost of every constraint
+// can be reported. Ops of the last run are discarded.
+void MeasureConstraintCosts(Compressor& compressor, FileJob& job, const Options& options)
+{
+	std::vector<ConstraintCost>& runs = job.ConstraintCosts;
+	ListConstraintRuns(options.Constraints, runs);
+
+	// phase times are of the compression itself
+	compressor.Timing = NULL;
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		runs[i].Bits = compressor.Solve(runs[i].Constraints);
+		compressor.ProgressReport.Done();
+		if (runs[i].Bits < 0)
+		{
+			runs.clear(); // cancelled, and so will be the compression
+			break;
+		}
+	}
+	compressor.Timing = &job.Times;
+}
+
+// Compresses for size first, so that --tape can tell how much faster its output loads
+void MeasureSizeOptimal(Compressor& compressor, FileJob& job)
+{
+	OpStats* stats = compressor.Stats;
+	float* byteCosts = compressor.ByteCosts;
+	compressor.Timing = NULL;
+	compressor.Stats = NULL;
+	compressor.ByteCosts = NULL;
+	compressor.Objective = OBJECTIVE_SIZE;
+	compressor.CompressAuto();
+	if (!compressor.Cancelled)
 	{
-		printf("Error opening input file\n");
-		result = 5;
+		job.SizeOptimalOutputSize = compressor.OutputSize;
+		job.SizeOptimalTapeTime = GetTapeLoadTime(compressor.Output, compressor.OutputSize);
+	}
+	compressor.Objective = OBJECTIVE_TAPE_TIME;
+	compressor.Timing = &job.Times;
+	compressor.Stats = stats;
+	compressor.ByteCosts = byteCosts;
+}
+
+double GetTapeSeconds(int time)
+{
+	return time * (double)TAPE_ZERO_BIT_TSTATES / ZX_CPU_CLOCK;
+}
+
+// Load time of output and what it saves against output packed for size
+std::string FormatTapeTime(const FileJob& job)
+{
+	char text[160];
+	int n = sprintf(text, "tape load %.3f s", GetTapeSeconds(job.TapeTime));
+	if (job.SizeOptimalTapeTime > 0)
+		sprintf(text + n, ", packed for size %.3f s (%d bytes), saved %.3f s", GetTapeSeconds(job.SizeOptimalTapeTime),
+			job.SizeOptimalOutputSize, GetTapeSeconds(job.SizeOptimalTapeTime - job.TapeTime));
+	return text;
+}
+
+const int SECTOR_SIZE = 256; // TR-DOS
+const int MAX_BIT_TIME = 1024;
+const int MAX_SECTORS_PASSES = 8; // of CompressToSectors: one for size, the search, the best one again
+
+// --sectors: packs for size, then looks for the fastest to depack output that takes as many
+// sectors. Bits are weighed against depacking time: the fewer T-states a bit is worth,
+// the faster and larger the output. The weight is searched on log scale between 1 and
+// MAX_BIT_TIME, the smallest that fits wins. Leaves compressor with its output, or with
+// the one packed for size if none fits. Each pass is timed in 'passTimes' from scratch.
+void SearchSectors(Compressor& compressor, FileJob& job, PhaseTimes& passTimes)
+{
+	compressor.Objective = OBJECTIVE_SIZE;
+	passTimes = PhaseTimes();
+	compressor.CompressAuto();
+	if (compressor.Cancelled || compressor.Stored) // nothing depacks faster than stored data
+		return;
+	job.SizeOptimalOutputSize = compressor.OutputSize;
+	job.SizeOptimalDepackTime = compressor.DepackTime;
+	int maxSize = (compressor.OutputSize + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+	compressor.Objective = OBJECTIVE_DEPACK_TIME;
+	int tooLarge = 1, fits = 0; // bit times known to give output over maxSize and within it
+	int bitTime = MAX_BIT_TIME;
+	while (true)
+	{
+		compressor.BitTime = bitTime;
+		passTimes = PhaseTimes();
+		compressor.CompressAuto();
+		if (compressor.Cancelled)
+			return;
+		if (compressor.OutputSize <= maxSize)
+			fits = bitTime;
+		else
+			tooLarge = bitTime;
+		if (!fits || fits <= tooLarge * 5 / 4 + 1)
+			break;
+		int next = (int)(sqrt((double)tooLarge * fits) + 0.5);
+		if (next <= tooLarge || next >= fits)
+			break;
+		bitTime = next;
+	}
+
+	if (fits != bitTime)
+	{
+		// the last run is not the best one
+		compressor.Objective = fits ? OBJECTIVE_DEPACK_TIME : OBJECTIVE_SIZE;
+		compressor.BitTime = fits;
+		passTimes = PhaseTimes();
+		compressor.CompressAuto();
+	}
+	job.BitTime = fits;
+}
+
+// --sectors with the times of the pass that made the output only, as DP of each pass
+// would otherwise lose the match time of all passes so far (SplitMatchFromDp)
+void CompressToSectors(Compressor& compressor, FileJob& job)
+{
+	PhaseTimes passTimes;
+	compressor.Timing = &passTimes;
+	SearchSectors(compressor, job, passTimes);
+	compressor.Timing = &job.Times;
+	for (int p = PHASE_MATCH; p <= PHASE_EMIT; p++)
+	{
+		job.Times.Start[p] = passTimes.Start[p];
+		job.Times.Wall[p] = passTimes.Wall[p];
+		job.Times.Cpu[p] = passTimes.Cpu[p];
+#ifdef OHC_PROFILE
+		for (int i = 0; i < HW_COUNTER_COUNT; i++)
+			job.Times.Hw[p][i] = passTimes.Hw[p][i];
+#endif
+	}
+}
+
+// Sectors and depacking time of output and what it saves against output packed for size
+std::string FormatSectors(const FileJob& job)
+{
+	char text[160];
+	int n = sprintf(text, "%d sectors, depacking ~%d T", job.Sectors, job.DepackTime);
+	if (job.SizeOptimalDepackTime > 0)
+		sprintf(text + n, ", packed for size ~%d T (%d bytes), %.1f%% faster", job.SizeOptimalDepackTime, job.SizeOptimalOutputSize,
+			(job.SizeOptimalDepackTime - job.DepackTime) * 100.0 / job.SizeOptimalDepackTime);
+	return text;
+}
+
+// Reads, compresses and writes one file, filling job results.
+// Verbose mode prints the single file mode messages.
+void CompressFile(Compressor& compressor, FileJob& job, bool verbose, const Options& options)
+{
+	const char* inputPath = job.InputPath.c_str();
+	const char* outputPath = job.OutputPath.c_str();
+	compressor.Timing = &job.Times;
+	compressor.Stats = (options.Stats != STATS_NONE || options.DepackerOut) ? &job.Ops : NULL;
+#ifdef OHC_PROFILE
+	CurrentWorkCounters = &job.Work;
+#endif
+
+	PhaseTimer readTimer(&job.Times, PHASE_READ);
+	size_t fsize;
+	if (job.InMemory)
+	{
+		fsize = min(job.Data.size(), (size_t)MAX_INPUT_SIZE + 1);
+		memcpy(compressor.Input, &job.Data[0], fsize);
 	}
 	else
 	{
-		size_t fsize = fread(compressor.Input, 1, MAX_INPUT_SIZE + 1, fIn);
+		FILE* fIn = fopen(inputPath, "r+b");
+		if (!fIn)
+		{
+			PrintFileError(job, verbose, "Error opening input file");
+			job.Result = 5;
+			return;
+		}
+		fsize = fread(compressor.Input, 1, MAX_INPUT_SIZE + 1, fIn);
 		fclose(fIn);
-		if (fsize > MAX_INPUT_SIZE)
+	}
+	readTimer.Stop();
+	if (fsize > MAX_INPUT_SIZE)
+	{
+		char text[100];
+		sprintf(text, "Input file is too large. Max supported file size is %d bytes.", MAX_INPUT_SIZE);
+		PrintFileError(job, verbose, text);
+		job.Result = 3;
+		return;
+	}
+
+	if (verbose) fprintf(messages, "Compressing file: %s\n", inputPath);
+
+	compressor.InputSize = (int)fsize;
+	job.InputSize = (int)fsize;
+
+	std::vector<float> byteCosts(fsize);
+	bool heatmap = (options.Heatmap != HEATMAP_NONE || options.HeatmapPng) && fsize > 0;
+	compressor.ByteCosts = heatmap ? &byteCosts[0] : NULL;
+
+	std::vector<Backref> parse;
+	compressor.Parse = NULL;
+	if (options.ParseIn && !LoadParseFile(compressor, job, verbose, options, parse))
+		return;
+
+	compressor.Constraints = options.Constraints;
+	compressor.Objective = options.Tape ? OBJECTIVE_TAPE_TIME : OBJECTIVE_SIZE;
+	if (options.Tape && !options.ParseIn && compressor.InputSize >= 6 + 1)
+		MeasureSizeOptimal(compressor, job);
+	if (options.ConstraintCost && !options.ParseIn && compressor.InputSize >= 6 + 1)
+		MeasureConstraintCosts(compressor, job, options);
+
+	if (options.Sectors && !options.ParseIn && compressor.InputSize >= 6 + 1)
+		CompressToSectors(compressor, job);
+	else
+		compressor.CompressAuto();
+#ifdef OHC_PROFILE
+	CurrentWorkCounters = NULL;
+#endif
+	if (verbose) consoleProgress.Done();
+
+	if (compressor.Cancelled)
+	{
+		PrintFileError(job, verbose, "Cancelled");
+		job.Result = 6;
+		return;
+	}
+	if (compressor.InvalidParse)
+	{
+		// checked by LoadParseFile already
+		PrintFileError(job, verbose, "ERROR!\nParse file doesn't fit the input.");
+		job.Result = 8;
+		return;
+	}
+
+	job.OutputSize = compressor.OutputSize;
+	if (options.Tape)
+		job.TapeTime = GetTapeLoadTime(compressor.Output, compressor.OutputSize);
+	if (options.Sectors)
+	{
+		job.Sectors = (compressor.OutputSize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		job.DepackTime = compressor.DepackTime;
+	}
+	double duration = job.Times.Wall[PHASE_MATCH] + job.Times.Wall[PHASE_DP] + job.Times.Wall[PHASE_EMIT];
+	double ratio = (double)compressor.OutputSize / compressor.InputSize;
+	//if (ratio > 1) ratio = max(ratio, 1.001);
+	const char* stored = compressor.Stored ? "  (stored!)" : "";
+	if (verbose)
+	{
+		fprintf(messages, "time = %.3f \n", duration);
+		fprintf(messages, "compression: %d / %d = %.3f%s\n", compressor.OutputSize, compressor.InputSize, ratio, stored);
+		if (options.Tape) fprintf(messages, "%s\n", FormatTapeTime(job).c_str());
+		if (options.Sectors) fprintf(messages, "%s\n", FormatSectors(job).c_str());
+	}
+
+	if (heatmap && compressor.Stored)
+	{
+		for (size_t i = 0; i < fsize; i++) byteCosts[i] = 8;
+	}
+
+	if (options.Verify)
+	{
+		if (!VerifyOutput(compressor))
 		{
-			printf("Input file is too large. Max supported file size is %d bytes.\n", MAX_INPUT_SIZE);
-			result = 3;
+			PrintFileError(job, verbose, "ERROR!\nVerification failed: unpacked data differs from input.");
+			job.Result = 7;
+			return;
 		}
-		else
+		if (verbose) fprintf(messages, "Verified\n");
+	}
+
+	// snapshot regions share one routine, made by CompressSnapshot
+	std::string depacker;
+	if (options.DepackerOut && !job.InMemory)
+	{
+		depacker = MakeDepacker(job.Ops);
+		if (options.Verify)
 		{
-			printf("Compressing file: %s\n", inputPath);
+			int codeSize = 0;
+			long long tStates = 0;
+			std::string error;
+			if (!VerifyDepacker(depacker, compressor.Output, compressor.OutputSize, compressor.Input, compressor.InputSize,
+				&codeSize, &tStates, error))
+			{
+				std::string text = "ERROR!\nDepacker verification failed: " + error + ".";
+				PrintFileError(job, verbose, text.c_str());
+				job.Result = 7;
+				return;
+			}
+			if (verbose && tStates > 0)
+				fprintf(messages, "Depacker verified: %d bytes, %lld T-states\n", codeSize, tStates);
+			else if (verbose)
+				fprintf(messages, "Depacker not verified: output and packed data don't fit in 64K together\n");
+		}
+	}
 
-			compressor.InputSize = (int)fsize;
+	if (job.InMemory)
+		job.Packed.assign(compressor.Output, compressor.Output + compressor.OutputSize);
+	else
+	{
+		if (verbose) fprintf(messages, "Writing compressed file: %s\n", outputPath);
+		PhaseTimer writeTimer(&job.Times, PHASE_WRITE);
+		FILE* fOut = fopen(outputPath, "wb");
+		if (!fOut)
+		{
+			PrintFileError(job, verbose, "Error writing output file");
+			job.Result = 5;
+			return;
+		}
+		size_t written = fwrite(compressor.Output, 1, compressor.OutputSize, fOut);
+		fclose(fOut);
+		writeTimer.Stop();
+		if (written != (size_t)compressor.OutputSize)
+		{
+			// delete incomplete compressed file
+			remove(outputPath);
+			PrintFileError(job, verbose, "Error writing output file");
+			job.Result = 5;
+			return;
+		}
+	}
 
-			clock_t t0 = clock();
-			compressor.CompressAuto();
-			clock_t t1 = clock();
-			double duration = (double)(t1 - t0) / CLOCKS_PER_SEC;
-			printf("time = %.3f \n", duration);
+	if (options.Heatmap != HEATMAP_NONE)
+	{
+		std::string heatmapPath = job.OutputPath + ".heat";
+		if (verbose) fprintf(messages, "Writing heatmap: %s\n", heatmapPath.c_str());
+		if (!SaveHeatmap(heatmapPath.c_str(), &byteCosts[0], (int)fsize, options.Heatmap))
+		{
+			PrintFileError(job, verbose, "Error writing heatmap file");
+			job.Result = 5;
+			return;
+		}
+	}
+	if (options.HeatmapPng && fsize == ZX_SCREEN_SIZE)
+	{
+		std::string pngPath = job.OutputPath + ".png";
+		if (verbose) fprintf(messages, "Writing heatmap: %s\n", pngPath.c_str());
+		if (!SaveHeatmapPng(pngPath.c_str(), &byteCosts[0]))
+		{
+			PrintFileError(job, verbose, "Error writing heatmap file");
+			job.Result = 5;
+			return;
+		}
+	}
+	if (options.ParseOut)
+	{
+		std::string parsePath = GetParsePath(job, options.ParseOut);
+		if (verbose) fprintf(messages, "Writing parse: %s\n", parsePath.c_str());
+		std::vector<Backref> ops(MAX_INPUT_SIZE);
+		int count = compressor.GetParse(&ops[0]);
+		if (!SaveParse(parsePath.c_str(), &ops[0], count, compressor.InputSize))
+		{
+			PrintFileError(job, verbose, "Error writing parse file");
+			job.Result = 5;
+			return;
+		}
+	}
+	if (options.DepackerOut && !job.InMemory)
+	{
+		std::string depackerPath = *options.DepackerOut ? std::string(options.DepackerOut) : job.OutputPath + ".asm";
+		if (verbose) fprintf(messages, "Writing depacker: %s\n", depackerPath.c_str());
+		if (!SaveDepacker(depackerPath.c_str(), depacker))
+		{
+			PrintFileError(job, verbose, "Error writing depacker file");
+			job.Result = 5;
+			return;
+		}
+	}
 
-			double ratio = (double)compressor.OutputSize / compressor.InputSize;
-			//if (ratio > 1) ratio = max(ratio, 1.001);
-			char* stored = compressor.Stored ? "  (stored!)" : "";
-			printf("compression: %d / %d = %.3f%s\n", compressor.OutputSize, compressor.InputSize, ratio, stored);
+	job.Result = 0;
+	std::lock_guard<std::mutex> guard(messagesLock);
+	if (verbose)
+		fprintf(messages, "All OK\n");
+	else
+	{
+		consoleProgress.Clear();
+		fprintf(messages, "%s: %d / %d = %.3f%s  time = %.3f%s%s\n", inputPath, compressor.OutputSize, compressor.InputSize, ratio, stored, duration,
+			(options.Tape || options.Sectors) ? "  " : "",
+			options.Tape ? FormatTapeTime(job).c_str() : options.Sectors ? FormatSectors(job).c_str() : "");
+	}
+}
+
+// DP passes one file takes at most with 'options' (see CompressFile)
+int CountDpPasses(const Options& options)
+{
+	if (options.ParseIn)
+		return 0;
+	int passes = options.Tape ? 2 : options.Sectors ? MAX_SECTORS_PASSES : 1;
+	if (options.ConstraintCost)
+	{
+		std::vector<ConstraintCost> runs;
+		ListConstraintRuns(options.Constraints, runs);
+		passes += (int)runs.size();
+	}
+	return passes;
+}
+
+// Size of input without reading it, 0 if it can't be opened
+long long GetInputSize(const FileJob& job)
+{
+	if (job.InMemory)
+		return (long long)job.Data.size();
+	FILE* f = fopen(job.InputPath.c_str(), "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return (size > 0) ? size : 0;
+}
+
+// Adds estimated work of every job to the tracker before any of them starts, so that
+// the total doesn't grow during the batch and progress only goes forward. Each job
+// advances by its own estimate in the end (ProgressReport::Finish), whatever it did.
+void PlanProgress(std::vector<FileJob>& jobs, const Options& options, ProgressTracker* progressTracker)
+{
+	int passes = CountDpPasses(options);
+	long long total = 0;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		long long size = GetInputSize(jobs[i]);
+		jobs[i].PlannedWork = (size >= 6 + 1 && size <= MAX_INPUT_SIZE)
+			? passes * ProgressReport::EstimateWork((int)size - 6, 1) // last 6 bytes are never compressed
+			: 0;
+		total += jobs[i].PlannedWork;
+	}
+	if (progressTracker)
+		progressTracker->AddWork(total);
+}
 
-			printf("Writing compressed file: %s\n", outputPath);
-			FILE* fOut = fopen(outputPath, "wb");
-			if (!fOut)
+// Compresses files on 'workerCount' threads, each with its own Compressor.
+// Progress and cancellation are shared by all workers.
+void CompressBatch(std::vector<FileJob>& jobs, int workerCount, const Options& options, ProgressTracker* progressTracker)
+{
+	PlanProgress(jobs, options, progressTracker);
+	std::atomic<int> nextJob(0);
+	std::vector<std::thread> workers;
+	for (int w = 0; w < workerCount; w++)
+	{
+		workers.push_back(std::thread([&jobs, &nextJob, &options, progressTracker, w]()
+		{
+			Compressor* c = new Compressor();
+			c->MatchThreads = options.Threads;
+			c->ProgressReport.Tracker = progressTracker;
+			c->ProgressReport.Cancellation = &cancellation;
+			for (int i; (i = nextJob++) < (int)jobs.size(); )
 			{
-				printf("Error writing output file\n");
-				result = 5;
+				jobs[i].Worker = w;
+				c->ProgressReport.Plan(jobs[i].PlannedWork);
+				if (cancellation.IsCancelled())
+					jobs[i].Result = 6;
+				else
+					CompressFile(*c, jobs[i], false, options);
+				c->ProgressReport.Finish();
 			}
-			else
+			delete c;
+		}));
+	}
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+}
+
+// --snapshot: packs memory regions of a snapshot on batch workers, then writes their blocks
+// one after another to the output file and the load map to <output>.map. Regions that
+// don't get smaller are stored. Returns process exit code.
+int CompressSnapshot(std::vector<FileJob>& jobs, const Options& options, ProgressTracker* progressTracker)
+{
+	const char* inputPath = options.Paths[0];
+	std::string outputPath = (options.Paths.size() >= 2) ? std::string(options.Paths[1]) : std::string(inputPath) + ".hr21";
+	Snapshot snapshot;
+	std::string error;
+	if (!LoadSnapshot(inputPath, snapshot, error))
+	{
+		fprintf(messages, "Error reading snapshot %s: %s\n", inputPath, error.c_str());
+		return 5;
+	}
+	std::vector<SnapshotRegion> regions;
+	FindRegions(snapshot, regions);
+
+	std::vector<int> regionJobs(regions.size(), -1);
+	int fills = 0;
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		SnapshotRegion& r = regions[i];
+		if (r.Type == REGION_FILL)
+			fills++;
+		else if (r.Size < 6 + 1)
+			r.Type = REGION_STORED;
+		else
+		{
+			char name[32], suffix[32];
+			sprintf(name, ":%d:%04X", r.Bank, r.Address);
+			sprintf(suffix, ".%d.%04X", r.Bank, r.Address);
+			FileJob job;
+			job.InputPath = inputPath + std::string(name);
+			job.OutputPath = outputPath + suffix; // for heatmaps and parses
+			job.InMemory = true;
+			const byte* data = GetRegionData(snapshot, r);
+			job.Data.assign(data, data + r.Size);
+			regionJobs[i] = (int)jobs.size();
+			jobs.push_back(job);
+		}
+	}
+
+	int workerCount = min(options.Jobs, (int)jobs.size());
+	fprintf(messages, "%s snapshot: %d banks, %d regions to pack, %d fill regions, %d threads\n",
+		snapshot.Is128K ? "128K" : "48K", (int)snapshot.Banks.size(), (int)jobs.size(), fills, workerCount);
+	CompressBatch(jobs, workerCount, options, progressTracker);
+	consoleProgress.Done();
+	for (size_t i = 0; i < jobs.size(); i++)
+		if (jobs[i].Result != 0)
+			return jobs[i].Result;
+
+	std::vector<byte> blocks;
+	int packed = 0, stored = 0;
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		SnapshotRegion& r = regions[i];
+		if (r.Type == REGION_FILL)
+			continue;
+		const FileJob* job = (regionJobs[i] >= 0) ? &jobs[regionJobs[i]] : NULL;
+		if (job && job->OutputSize >= r.Size)
+			r.Type = REGION_STORED;
+		const byte* data = (r.Type == REGION_PACKED) ? &job->Packed[0] : GetRegionData(snapshot, r);
+		r.BlockOffset = (int)blocks.size();
+		r.BlockSize = (r.Type == REGION_PACKED) ? job->OutputSize : r.Size;
+		blocks.insert(blocks.end(), data, data + r.BlockSize);
+		if (r.Type == REGION_PACKED)
+			packed++;
+		else
+			stored++;
+	}
+
+	fprintf(messages, "Writing packed blocks: %s\n", outputPath.c_str());
+	FILE* fOut = fopen(outputPath.c_str(), "wb");
+	size_t written = (fOut && !blocks.empty()) ? fwrite(&blocks[0], 1, blocks.size(), fOut) : 0;
+	if (fOut) fclose(fOut);
+	if (!fOut || written != blocks.size())
+	{
+		remove(outputPath.c_str());
+		fprintf(messages, "Error writing output file\n");
+		return 5;
+	}
+	std::string mapPath = outputPath + ".map";
+	fprintf(messages, "Writing load map: %s\n", mapPath.c_str());
+	if (!SaveLoadMap(mapPath.c_str(), snapshot, "hrust2", regions))
+	{
+		fprintf(messages, "Error writing load map\n");
+		return 5;
+	}
+	if (options.DepackerOut)
+	{
+		OpStats ops;
+		for (size_t i = 0; i < regions.size(); i++)
+			if (regions[i].Type == REGION_PACKED)
+				AddOps(ops, jobs[regionJobs[i]].Ops);
+		std::string depacker = MakeDepacker(ops);
+		for (size_t i = 0; i < regions.size() && options.Verify; i++)
+		{
+			const SnapshotRegion& r = regions[i];
+			if (r.Type != REGION_PACKED)
+				continue;
+			const FileJob& job = jobs[regionJobs[i]];
+			int codeSize = 0;
+			long long tStates = 0;
+			std::string error;
+			if (!VerifyDepacker(depacker, &job.Packed[0], job.OutputSize, GetRegionData(snapshot, r), r.Size, &codeSize, &tStates, error))
+			{
+				fprintf(messages, "%s: Depacker verification failed: %s\n", job.InputPath.c_str(), error.c_str());
+				return 7;
+			}
+		}
+		std::string depackerPath = outputPath + ".asm";
+		fprintf(messages, "Writing depacker: %s\n", depackerPath.c_str());
+		if (!SaveDepacker(depackerPath.c_str(), depacker))
+		{
+			fprintf(messages, "Error writing depacker file\n");
+			return 5;
+		}
+	}
+
+	int memorySize = (int)snapshot.Banks.size() * ZX_BANK_SIZE;
+	fprintf(messages, "compression: %d / %d = %.3f  (%d packed, %d stored, %d fill regions)\n",
+		(int)blocks.size(), memorySize, (double)blocks.size() / memorySize, packed, stored, fills);
+	fprintf(messages, "All OK\n");
+	return 0;
+}
+
+// Pairs of files at least this similar (GetPairSimilarity) are listed by --similarity
+const double MIN_REPORTED_SIMILARITY = 0.1;
+
+// --similarity: indexes all inputs on --jobs threads and prints, for each file, how much
+// of it repeats itself and which other file saves most as its history (packed or loaded
+// just before it), then the most similar pairs. Returns process exit code.
+int ReportSimilarity(const Options& options)
+{
+	int fileCount = (int)options.Paths.size();
+	std::vector<std::vector<byte> > files(fileCount);
+	for (int i = 0; i < fileCount; i++)
+	{
+		FILE* f = fopen(options.Paths[i], "rb");
+		if (!f)
+		{
+			fprintf(messages, "%s: Error opening input file\n", options.Paths[i]);
+			return 5;
+		}
+		byte buffer[0x4000];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			files[i].insert(files[i].end(), buffer, buffer + n);
+		fclose(f);
+	}
+
+	int threadCount = min(options.Jobs, fileCount);
+	fprintf(messages, "Analyzing %d files, %d-byte chunks, %d threads\n", fileCount, SIMILARITY_CHUNK, threadCount);
+	std::vector<FileSimilarity> result;
+	AnalyzeSimilarity(files, threadCount, result);
+
+	std::vector<std::pair<double, std::pair<int, int> > > similar;
+	for (int a = 0; a < fileCount; a++)
+		for (size_t k = 0; k < result[a].Pairs.size(); k++)
+		{
+			int b = result[a].Pairs[k].File;
+			double similarity = GetPairSimilarity(result, a, b);
+			if (a < b && similarity >= MIN_REPORTED_SIMILARITY)
+				similar.push_back(std::make_pair(-similarity, std::make_pair(a, b)));
+		}
+	std::sort(similar.begin(), similar.end());
+
+	if (options.Stats == STATS_JSON)
+	{
+		printf("{\"similarity\": {\"chunk\": %d, \"files\": [\n", SIMILARITY_CHUNK);
+		for (int a = 0; a < fileCount; a++)
+		{
+			const FileSimilarity& s = result[a];
+			printf("  {\"input\": \"%s\", \"size\": %d, \"self_shared\": %d, \"history\": [",
+				JsonEscape(options.Paths[a]).c_str(), s.Size, s.SelfShared);
+			for (size_t k = 0; k < s.Pairs.size() && s.Pairs[k].Savings > 0; k++)
+				printf("%s{\"input\": \"%s\", \"shared\": %d, \"savings\": %d}", k ? ", " : "",
+					JsonEscape(options.Paths[s.Pairs[k].File]).c_str(), s.Pairs[k].Shared, s.Pairs[k].Savings);
+			printf("]}%s\n", (a + 1 < fileCount) ? "," : "");
+		}
+		printf("], \"pairs\": [\n");
+		for (size_t i = 0; i < similar.size(); i++)
+			printf("  {\"a\": \"%s\", \"b\": \"%s\", \"similarity\": %.4f}%s\n",
+				JsonEscape(options.Paths[similar[i].second.first]).c_str(), JsonEscape(options.Paths[similar[i].second.second]).c_str(),
+				-similar[i].first, (i + 1 < similar.size()) ? "," : "");
+		printf("]}}\n");
+		return 0;
+	}
+
+	fprintf(messages, "\n");
+	for (int a = 0; a < fileCount; a++)
+	{
+		const FileSimilarity& s = result[a];
+		fprintf(messages, "%s: %d bytes, %.1f%% repeats itself", options.Paths[a], s.Size, s.Size ? 100.0 * s.SelfShared / s.Size : 0.0);
+		if (!s.Pairs.empty() && s.Pairs[0].Savings > 0)
+			fprintf(messages, ", best history %s: %.1f%% shared, saves ~%d bytes\n", options.Paths[s.Pairs[0].File],
+				100.0 * s.Pairs[0].Shared / s.Size, s.Pairs[0].Savings);
+		else
+			fprintf(messages, ", no history saves anything\n");
+	}
+	fprintf(messages, "\nPairs at least %.0f%% similar: %d\n", MIN_REPORTED_SIMILARITY * 100, (int)similar.size());
+	for (size_t i = 0; i < similar.size(); i++)
+		fprintf(messages, "  %5.1f%%  %s  %s\n", -similar[i].first * 100,
+			options.Paths[similar[i].second.first], options.Paths[similar[i].second.second]);
+	return 0;
+}
+
+// Count and bits of each kind of op, and how output splits into control bits and data bytes
+void PrintOpStatsText(const OpStats& ops)
+{
+	long long controlBits = 0, dataBits = 0;
+	for (int k = 0; k < OP_KIND_COUNT; k++)
+	{
+		controlBits += ops.ControlBits[k];
+		dataBits += ops.DataBytes[k] * 8;
+	}
+	long long totalBits = controlBits + dataBits;
+
+	fprintf(messages, "%-14s %8s %12s %10s %10s %7s %10s %12s\n", "op", "count", "control bits", "data bytes", "bits", "share",
+		"bytes", "distance");
+	for (int k = 0; k < OP_KIND_COUNT; k++)
+	{
+		int bits = ops.ControlBits[k] + ops.DataBytes[k] * 8;
+		if (ops.Count[k] == 0 && bits == 0) continue;
+		char counts[24] = "", dists[24] = "";
+		if (ops.MaxCount[k] > 0) sprintf(counts, "%d..%d", ops.MinCount[k], ops.MaxCount[k]);
+		if (ops.MaxDist[k] > 0) sprintf(dists, "%d..%d", ops.MinDist[k], ops.MaxDist[k]);
+		fprintf(messages, "%-14s %8d %12d %10d %10d %6.1f%% %10s %12s\n", OpKindNames[k], ops.Count[k], ops.ControlBits[k], ops.DataBytes[k],
+			bits, bits * 100.0 / totalBits, counts, dists);
+	}
+	fprintf(messages, "control bits %lld (%.1f%%), data bytes %lld (%.1f%%)\n",
+		controlBits, controlBits * 100.0 / totalBits, dataBits / 8, dataBits * 100.0 / totalBits);
+}
+
+// Bits of optimal parse with no constraints, with each one and with all of them
+void PrintConstraintCosts(const std::vector<FileJob>& jobs)
+{
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const std::vector<ConstraintCost>& runs = jobs[i].ConstraintCosts;
+		if (runs.empty()) continue;
+		fprintf(messages, "\n%s:\n", jobs[i].InputPath.c_str());
+		fprintf(messages, "%-20s %10s %10s %10s\n", "constraints", "bits", "cost, bits", "cost, %");
+		for (size_t r = 0; r < runs.size(); r++)
+		{
+			int cost = runs[r].Bits - runs[0].Bits;
+			fprintf(messages, "%-20s %10d %10d %9.2f%%\n", runs[r].Name.c_str(), runs[r].Bits, cost, cost * 100.0 / runs[0].Bits);
+		}
+	}
+}
+
+void PrintStatsText(const std::vector<FileJob>& jobs)
+{
+	fprintf(messages, "\n%-10s %12s %12s\n", "phase", "wall, ms", "cpu, ms");
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const PhaseTimes& t = jobs[i].Times;
+		fprintf(messages, "%s:\n", jobs[i].InputPath.c_str());
+		for (int p = 0; p < PHASE_COUNT; p++)
+			fprintf(messages, "%-10s %12.3f %12.3f\n", PhaseNames[p], t.Wall[p] * 1e3, t.Cpu[p] * 1e3);
+		fprintf(messages, "%-10s %12.3f %12.3f\n", "total", t.GetTotalWall() * 1e3, t.GetTotalCpu() * 1e3);
+	}
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		if (jobs[i].Ops.Count[OP_END] == 0) continue;
+		fprintf(messages, "\n%s:\n", jobs[i].InputPath.c_str());
+		PrintOpStatsText(jobs[i].Ops);
+	}
+}
+
+void PrintStatsJson(const std::vector<FileJob>& jobs)
+{
+	printf("{\"files\": [\n");
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const FileJob& job = jobs[i];
+		const PhaseTimes& t = job.Times;
+		printf("  {\"input\": \"%s\", \"output\": \"%s\", \"input_size\": %d, \"output_size\": %d, \"result\": %d, \"worker\": %d,\n",
+			JsonEscape(job.InputPath.c_str()).c_str(), JsonEscape(job.OutputPath.c_str()).c_str(),
+			job.InputSize, job.OutputSize, job.Result, job.Worker);
+		printf("   \"phases\": {");
+		for (int p = 0; p < PHASE_COUNT; p++)
+			printf("\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}, ", PhaseNames[p], t.Wall[p], t.Cpu[p]);
+		printf("\"total\": {\"wall\": %.6f, \"cpu\": %.6f}}", t.GetTotalWall(), t.GetTotalCpu());
+		if (job.Ops.Count[OP_END] != 0)
+		{
+			printf(",\n   \"ops\": {");
+			for (int k = 0; k < OP_KIND_COUNT; k++)
+				printf("%s\"%s\": {\"count\": %d, \"control_bits\": %d, \"data_bytes\": %d, "
+					"\"min_bytes\": %d, \"max_bytes\": %d, \"min_dist\": %d, \"max_dist\": %d}", k ? ", " : "",
+					OpKindNames[k], job.Ops.Count[k], job.Ops.ControlBits[k], job.Ops.DataBytes[k],
+					job.Ops.MinCount[k], job.Ops.MaxCount[k], job.Ops.MinDist[k], job.Ops.MaxDist[k]);
+			printf("}");
+		}
+		if (!job.ConstraintCosts.empty())
+		{
+			printf(",\n   \"constraint_cost\": [");
+			for (size_t r = 0; r < job.ConstraintCosts.size(); r++)
+				printf("%s{\"constraints\": \"%s\", \"bits\": %d}", r ? ", " : "",
+					job.ConstraintCosts[r].Name.c_str(), job.ConstraintCosts[r].Bits);
+			printf("]");
+		}
+		if (job.TapeTime > 0)
+			printf(",\n   \"tape\": {\"load_time\": %d, \"seconds\": %.6f, \"size_optimal_load_time\": %d, \"size_optimal_output_size\": %d}",
+				job.TapeTime, GetTapeSeconds(job.TapeTime), job.SizeOptimalTapeTime, job.SizeOptimalOutputSize);
+		if (job.Sectors > 0)
+			printf(",\n   \"sectors\": {\"sectors\": %d, \"bit_time\": %d, \"depack_time\": %d, \"size_optimal_depack_time\": %d, \"size_optimal_output_size\": %d}",
+				job.Sectors, job.BitTime, job.DepackTime, job.SizeOptimalDepackTime, job.SizeOptimalOutputSize);
+#ifdef OHC_PROFILE
+		printf(",\n   \"work\": {");
+		for (int c = 0; c < WORK_COUNTER_COUNT; c++)
+			printf("%s\"%s\": %lld", c ? ", " : "", WorkCounterNames[c], job.Work.Values[c]);
+		printf("},\n   \"hw\": {");
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			printf("%s\"%s\": {", p ? ", " : "", PhaseNames[p]);
+			for (int c = 0; c < HW_COUNTER_COUNT; c++)
+				printf("%s\"%s\": %lld", c ? ", " : "", HwCounterNames[c], t.Hw[p][c]);
+			printf("}");
+		}
+		printf("}");
+#endif
+		printf("}%s\n", (i + 1 < jobs.size()) ? "," : "");
+	}
+	printf("]}\n");
+}
+
+#ifdef OHC_PROFILE
+void PrintProfile(const std::vector<FileJob>& jobs)
+{
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		const FileJob& job = jobs[i];
+		fprintf(messages, "\n%s:\n", job.InputPath.c_str());
+		for (int c = 0; c < WORK_COUNTER_COUNT; c++)
+			if (job.Work.Values[c] != 0)
+				fprintf(messages, "  %-22s %14lld\n", WorkCounterNames[c], job.Work.Values[c]);
+
+		if (!HwCounters::ForThisThread().IsAvailable())
+		{
+			fprintf(messages, "  hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+			continue;
+		}
+		fprintf(messages, "  %-22s", "");
+		for (int p = 0; p < PHASE_COUNT; p++)
+			fprintf(messages, " %14s", PhaseNames[p]);
+		fprintf(messages, "\n");
+		for (int c = 0; c < HW_COUNTER_COUNT; c++)
+		{
+			fprintf(messages, "  %-22s", HwCounterNames[c]);
+			for (int p = 0; p < PHASE_COUNT; p++)
 			{
-				size_t written = fwrite(compressor.Output, 1, compressor.OutputSize, fOut);
-				fclose(fOut);
-				if (written != compressor.OutputSize)
-				{
-					// delete incomplete compressed file
-					remove(argv[2]);
-					printf("Error writing output file\n");
-					result = 5;
-				}
+				long long v = job.Times.Hw[p][c];
+				if (v < 0)
+					fprintf(messages, " %14s", "n/a");
 				else
-				{
-					printf("All OK\n");
-					result = 0;
-				}
+					fprintf(messages, " %14lld", v);
 			}
+			fprintf(messages, "\n");
+		}
+		fprintf(messages, "  %-22s", "ipc");
+		for (int p = 0; p < PHASE_COUNT; p++)
+		{
+			long long cycles = job.Times.Hw[p][HW_CYCLES];
+			long long instructions = job.Times.Hw[p][HW_INSTRUCTIONS];
+			if (cycles > 0 && instructions >= 0)
+				fprintf(messages, " %14.2f", (double)instructions / cycles);
+			else
+				fprintf(messages, " %14s", "n/a");
+		}
+		fprintf(messages, "\n");
+	}
+}
+#endif
+
+int main(int argc, const char* argv[])
+{
+	Options options;
+	bool optionsOk = ParseOptions(argc, argv, options);
+	if (options.Stats == STATS_JSON)
+	{
+		messages = stderr;
+		consoleProgress.Out = stderr;
+	}
+
+	PrintVersion();
+
+	if (!optionsOk)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+#ifndef OHC_PROFILE
+	if (options.Profile)
+	{
+		fprintf(messages, "--profile needs a build with OHC_PROFILE defined (cmake -DOHC_PROFILE=ON)\n\n");
+		return 1;
+	}
+#endif
+
+	if (options.Similarity)
+	{
+		int result = ReportSimilarity(options);
+		fprintf(messages, "\n");
+		return result;
+	}
+
+	std::vector<FileJob> jobs;
+	if (options.Batch)
+	{
+		jobs.resize(options.Paths.size());
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			jobs[i].InputPath = options.Paths[i];
+			jobs[i].OutputPath = jobs[i].InputPath + ".hr21";
 		}
 	}
+	else if (!options.Snapshot)
+	{
+		jobs.resize(1);
+		jobs[0].InputPath = options.Paths[0];
+		jobs[0].OutputPath = (options.Paths.size() >= 2) ? std::string(options.Paths[1]) : jobs[0].InputPath + ".hr21";
+	}
+
+	ProgressTracker progressTracker(&consoleProgress);
+	signal(SIGINT, OnInterrupt);
+
+	int result = 0;
+	if (options.Snapshot)
+		result = CompressSnapshot(jobs, options, &progressTracker);
+	else if (!options.Batch)
+	{
+		compressor.ProgressReport.Tracker = &progressTracker;
+		compressor.ProgressReport.Cancellation = &cancellation;
+		compressor.MatchThreads = options.Threads;
+		PlanProgress(jobs, options, &progressTracker);
+		compressor.ProgressReport.Plan(jobs[0].PlannedWork);
+		CompressFile(compressor, jobs[0], true, options);
+		compressor.ProgressReport.Finish();
+	}
+	else
+	{
+		int workerCount = min(options.Jobs, (int)jobs.size());
+		fprintf(messages, "Compressing %d files, %d threads\n", (int)jobs.size(), workerCount);
+		CompressBatch(jobs, workerCount, options, &progressTracker);
+		consoleProgress.Done();
+	}
 
-	printf("\n");
+	for (size_t i = 0; i < jobs.size(); i++)
+		if (jobs[i].Result > result) result = jobs[i].Result;
+
+	if (options.TracePath)
+	{
+		TraceWriter trace;
+		int tracks = (options.Batch || options.Snapshot) ? min(options.Jobs, (int)jobs.size()) : 1;
+		for (int w = 0; w < tracks; w++)
+		{
+			char name[32];
+			sprintf(name, "worker %d", w);
+			trace.SetTrackName(w, name);
+		}
+		for (size_t i = 0; i < jobs.size(); i++)
+			if (jobs[i].InputSize > 0)
+				trace.AddPhases(jobs[i].Worker, jobs[i].InputPath.c_str(), jobs[i].Times);
+		if (!trace.Save(options.TracePath))
+		{
+			fprintf(messages, "Error writing trace file\n");
+			if (result < 5) result = 5;
+		}
+	}
+
+	if (options.ConstraintCost)
+		PrintConstraintCosts(jobs);
+	if (options.Stats == STATS_TEXT)
+		PrintStatsText(jobs);
+	else if (options.Stats == STATS_JSON)
+		PrintStatsJson(jobs);
+#ifdef OHC_PROFILE
+	if (options.Profile)
+		PrintProfile(jobs);
+#endif
+
+	fprintf(messages, "\n");
 	return result;
 };
-
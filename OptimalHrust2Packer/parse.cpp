@@ -0,0 +1,90 @@
+#include "parse.h"
+#include <stdio.h>
+#include <string.h>
+
+bool SaveParse(const char* path, const Backref* ops, int count, int inputSize)
+{
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+	fprintf(f, "hrust2 %d\n", inputSize);
+	for (int i = 0; i < count; i++)
+	{
+		const Backref& op = ops[i];
+		if (op.Count == -1)
+			fprintf(f, "lit\n");
+		else if (op.Count < 0)
+			fprintf(f, "lit %d\n", -op.Count);
+		else
+			fprintf(f, "ref %d %d\n", op.Count, op.Dist);
+	}
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+bool LoadParse(const char* path, int* inputSize, std::vector<Backref>& ops, std::vector<int>& lines, std::string& error)
+{
+	ops.clear();
+	lines.clear();
+	FILE* f = fopen(path, "r");
+	if (!f)
+	{
+		error = "cannot open file";
+		return false;
+	}
+
+	const char* e = NULL;
+	bool header = false;
+	int line = 0;
+	char text[256];
+	while (!e && fgets(text, sizeof(text), f))
+	{
+		line++;
+		char* comment = strchr(text, ';');
+		if (comment) *comment = 0;
+
+		char word[16];
+		int a, b;
+		char extra;
+		int n = sscanf(text, "%15s %d %d %c", word, &a, &b, &extra);
+		if (n <= 0)
+			continue; // empty line
+
+		if (!header)
+		{
+			if (strcmp(word, "hrust2") != 0 || n != 2)
+				e = "expected 'hrust2 <input size>' (parse of another format?)";
+			else if (a < 0 || a > MAX_INPUT_SIZE)
+				e = "bad input size";
+			*inputSize = a;
+			header = true;
+			continue;
+		}
+
+		if (strcmp(word, "lit") == 0 && n == 1)
+			ops.push_back(Backref(-1, 0));
+		else if (strcmp(word, "lit") == 0 && n == 2 && a >= 2 && a <= 42)
+			ops.push_back(Backref(-a, 0));
+		else if (strcmp(word, "ref") == 0 && n == 3 && a >= 1 && a <= 0xFFF && b < 0 && b >= -MAX_INPUT_SIZE)
+			ops.push_back(Backref(a, b));
+		else
+		{
+			e = "bad op";
+			break;
+		}
+		lines.push_back(line);
+	}
+	if (!e && ferror(f))
+		e = "read error";
+	else if (!e && !header)
+		e = "file is empty";
+	fclose(f);
+
+	if (e)
+	{
+		char prefix[32];
+		sprintf(prefix, "line %d: ", line);
+		error = std::string(line > 0 ? prefix : "") + e;
+		return false;
+	}
+	return true;
+}
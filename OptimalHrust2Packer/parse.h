@@ -0,0 +1,21 @@
+#pragma once
+
+#include "compress.h"
+#include <string>
+#include <vector>
+
+// Parse file (--save-parse, --load-parse): ops chosen for input bytes 1..InputSize-6
+// as text, one per line. The first byte and the last 6 are always stored as is.
+//
+//   hrust2 <input size>
+//   lit                     literal byte
+//   lit <n>                 12..42 literal bytes, even
+//   ref <n> <dist>          backref, dist is negative
+//
+// Text after ';' is a comment.
+
+bool SaveParse(const char* path, const Backref* ops, int count, int inputSize);
+
+// Reads ops and the line each of them is on. On error returns false with 'error'
+// naming the line.
+bool LoadParse(const char* path, int* inputSize, std::vector<Backref>& ops, std::vector<int>& lines, std::string& error);
@@ -0,0 +1,101 @@
+
+#include "profile.h"
+#include <string.h>
+
+#if defined(OHC_PROFILE) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* const WorkCounterNames[WORK_COUNTER_COUNT] =
+{
+	"positions",
+	"z_compares",
+	"literal_candidates",
+	"rir_candidates",
+	"backref_candidates",
+	"d_relaxations",
+	"encoded_rir",
+	"encoded_count1",
+	"encoded_count2",
+	"encoded_short_count",
+	"encoded_medium_count",
+	"encoded_long_count",
+	"encoded_impossible",
+};
+
+const char* const HwCounterNames[HW_COUNTER_COUNT] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+WorkCounters::WorkCounters()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+#ifdef OHC_PROFILE
+
+thread_local WorkCounters* CurrentWorkCounters = NULL;
+
+HwCounters::HwCounters()
+{
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+		fds[i] = -1;
+
+#ifdef __linux__
+	static const unsigned long long configs[HW_COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.exclude_kernel = 1; // allowed with default perf_event_paranoid
+		attr.exclude_hv = 1;
+		// this thread only, any CPU
+		fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+}
+
+HwCounters::~HwCounters()
+{
+#ifdef __linux__
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+		if (fds[i] >= 0) close(fds[i]);
+#endif
+}
+
+bool HwCounters::IsAvailable() const
+{
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+		if (fds[i] >= 0) return true;
+	return false;
+}
+
+void HwCounters::Read(long long values[HW_COUNTER_COUNT])
+{
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+	{
+		values[i] = -1;
+#ifdef __linux__
+		long long v;
+		if (fds[i] >= 0 && read(fds[i], &v, sizeof(v)) == sizeof(v))
+			values[i] = v;
+#endif
+	}
+}
+
+HwCounters& HwCounters::ForThisThread()
+{
+	static thread_local HwCounters counters;
+	return counters;
+}
+
+#endif
@@ -0,0 +1,76 @@
+
+#pragma once
+
+// Work and hardware counters for --profile.
+// They exist only in builds with OHC_PROFILE defined (cmake -DOHC_PROFILE=ON);
+// otherwise PROFILE_COUNT expands to nothing and the engine is not touched.
+
+enum WORK_COUNTER
+{
+	WORK_POSITIONS,           // DP positions solved
+	WORK_Z_COMPARES,          // Z-function character comparisons
+	WORK_LITERAL_CANDIDATES,  // literal runs evaluated
+	WORK_RIR_CANDIDATES,      // RIR ops evaluated (Hrust 1)
+	WORK_BACKREF_CANDIDATES,  // (count, dist) transitions evaluated in backref loop
+	WORK_D_RELAXATIONS,       // cost[D] updates tried for each backref and D change (Hrust 1)
+	WORK_ENCODED_RIR,         // GetEncodedLen branches taken
+	WORK_ENCODED_COUNT1,
+	WORK_ENCODED_COUNT2,
+	WORK_ENCODED_SHORT_COUNT, // 3..15
+	WORK_ENCODED_MEDIUM_COUNT, // up to 127 (Hrust 1) or 255 (Hrust 2)
+	WORK_ENCODED_LONG_COUNT,
+	WORK_ENCODED_IMPOSSIBLE,
+	WORK_COUNTER_COUNT
+};
+
+extern const char* const WorkCounterNames[WORK_COUNTER_COUNT];
+
+enum HW_COUNTER
+{
+	HW_CYCLES,
+	HW_INSTRUCTIONS,
+	HW_CACHE_MISSES,
+	HW_BRANCH_MISSES,
+	HW_COUNTER_COUNT
+};
+
+extern const char* const HwCounterNames[HW_COUNTER_COUNT];
+
+struct WorkCounters
+{
+	long long Values[WORK_COUNTER_COUNT];
+
+	WorkCounters();
+};
+
+#ifdef OHC_PROFILE
+
+// Counters of the compression running on this thread, NULL if not profiled
+extern thread_local WorkCounters* CurrentWorkCounters;
+
+// Expression, so that it can be used inside other expressions
+#define PROFILE_COUNT(counter, n) \
+	(CurrentWorkCounters ? (void)(CurrentWorkCounters->Values[counter] += (n)) : (void)0)
+
+// Hardware counters of the calling thread (Linux perf_event_open, user mode only).
+// Counters the kernel or VM doesn't provide read as -1.
+class HwCounters
+{
+	int fds[HW_COUNTER_COUNT];
+
+public:
+	HwCounters();
+	~HwCounters();
+
+	bool IsAvailable() const;
+	void Read(long long values[HW_COUNTER_COUNT]);
+
+	// Counters of the calling thread, opened on first use
+	static HwCounters& ForThisThread();
+};
+
+#else
+
+#define PROFILE_COUNT(counter, n) ((void)0)
+
+#endif
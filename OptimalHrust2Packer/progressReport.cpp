@@ -3,26 +3,152 @@
 #include <memory.h>
 #include <stdio.h>
 
-ProgressReport::ProgressReport()
+////////////////////////////////////////////////////////////
+///////////        ConsoleProgress          ////////////////
+////////////////////////////////////////////////////////////
+
+ConsoleProgress::ConsoleProgress()
 {
-	memset(this, 0, sizeof(*this));
+	printed = false;
+	Out = stdout;
 };
 
-void ProgressReport::Report(int total, int done)
+void ConsoleProgress::OnProgress(double fraction, double etaSeconds)
 {
-	int percents = done * 100 / total;
+	std::lock_guard<std::mutex> guard(lock);
+	int percents = int(fraction * 100);
 	if (printed) {
-		printf("\r"); // move cursor back
+		fprintf(Out, "\r"); // move cursor back
 	}
-	printf("progress: %d%%  ", percents);
+	if (etaSeconds >= 0 && percents < 100)
+		fprintf(Out, "progress: %d%%  ETA %d s    ", percents, int(etaSeconds + 0.5));
+	else
+		fprintf(Out, "progress: %d%%              ", percents);
+	fflush(Out);
 	printed = true;
 };
 
-void ProgressReport::Done()
+void ConsoleProgress::Done()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (printed)
+	{
+		fprintf(Out, "\n");
+		printed = false;
+	}
+};
+
+void ConsoleProgress::Clear()
 {
+	std::lock_guard<std::mutex> guard(lock);
 	if (printed)
 	{
-		Report(1, 1);
-		printf("\n");
+		fprintf(Out, "\r%40s\r", "");
+		printed = false;
+	}
+};
+
+////////////////////////////////////////////////////////////
+///////////        ProgressTracker          ////////////////
+////////////////////////////////////////////////////////////
+
+ProgressTracker::ProgressTracker(ProgressCallback* callback)
+	: callback(callback), totalWork(0), doneWork(0)
+{
+	startTime = std::chrono::steady_clock::now();
+};
+
+void ProgressTracker::AddWork(long long work)
+{
+	totalWork += work;
+};
+
+void ProgressTracker::Advance(long long work)
+{
+	bool all = (doneWork += work) >= totalWork.load();
+
+	// Several compressions may report at once; one notification is enough,
+	// but the one of all work done must not be lost
+	if (!callback)
+		return;
+	if (all)
+		callbackLock.lock();
+	else if (!callbackLock.try_lock())
+		return;
+	callback->OnProgress(GetFraction(), GetEtaSeconds());
+	callbackLock.unlock();
+};
+
+double ProgressTracker::GetFraction()
+{
+	long long total = totalWork.load();
+	long long done = doneWork.load();
+	if (total <= 0) return 0;
+	if (done >= total) return 1;
+	return (double)done / total;
+};
+
+double ProgressTracker::GetEtaSeconds()
+{
+	double fraction = GetFraction();
+	if (fraction <= 0) return -1;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	return elapsed.count() * (1 - fraction) / fraction;
+};
+
+////////////////////////////////////////////////////////////
+///////////         ProgressReport          ////////////////
+////////////////////////////////////////////////////////////
+
+ProgressReport::ProgressReport()
+{
+	memset(this, 0, sizeof(*this));
+};
+
+long long ProgressReport::EstimateWork(int inputSize, int pos)
+{
+	// sum of (inputSize + q) for q = pos..inputSize-1
+	long long n = inputSize;
+	long long cnt = n - pos;
+	if (cnt <= 0) return 0;
+	return cnt * n + (pos + n - 1) * cnt / 2;
+};
+
+void ProgressReport::Plan(long long work)
+{
+	plannedWork = work;
+	spentWork = 0;
+};
+
+void ProgressReport::Start(int inputSize)
+{
+	this->inputSize = inputSize;
+	reportedWork = 0;
+};
+
+void ProgressReport::Report(int pos)
+{
+	if (!Tracker || inputSize == 0) return;
+	long long work = EstimateWork(inputSize, pos);
+	long long step = work - reportedWork;
+	if (step > plannedWork - spentWork)
+		step = plannedWork - spentWork;
+	reportedWork = work;
+	if (step > 0)
+	{
+		spentWork += step;
+		Tracker->Advance(step);
 	}
 };
+
+void ProgressReport::Done()
+{
+	Report(1);
+};
+
+void ProgressReport::Finish()
+{
+	if (Tracker && spentWork < plannedWork)
+		Tracker->Advance(plannedWork - spentWork);
+	spentWork = plannedWork;
+};
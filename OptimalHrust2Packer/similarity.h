@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+// Content shared by files of a batch (--similarity), to plan which files to pack together
+// or load after one another. All files are cut into SIMILARITY_CHUNK-byte chunks at every
+// position and the rolling hashes of the chunks go to one index; a byte of a file is
+// shared with another file if some chunk around it occurs there. Nothing is compressed,
+// so the savings are estimates.
+
+const int SIMILARITY_CHUNK = 8;
+
+// Estimated cost of a backref to history, in bytes: it has to reach past the whole file
+const int HISTORY_BACKREF_SIZE = 3;
+
+struct SimilarityPair
+{
+	int File;    // the other file
+	int Shared;  // bytes of this file shared with the other one
+	int Savings; // estimated bytes saved if the other file is history of this one: shared bytes
+	             // not repeated in this file already, less HISTORY_BACKREF_SIZE for each run of them
+};
+
+struct FileSimilarity
+{
+	int Size;
+	int SelfShared; // bytes within chunks that occur earlier in the file itself
+	std::vector<SimilarityPair> Pairs; // files sharing anything with this one, best history first
+
+	FileSimilarity() : Size(0), SelfShared(0) {};
+};
+
+// Indexes 'files' and compares each of them with all others on 'threadCount' threads
+void AnalyzeSimilarity(const std::vector<std::vector<unsigned char> >& files, int threadCount, std::vector<FileSimilarity>& result);
+
+// Share of bytes of both files that the other one has, 0..1
+double GetPairSimilarity(const std::vector<FileSimilarity>& result, int a, int b);
@@ -0,0 +1,259 @@
+#include "snapshot.h"
+#include <stdio.h>
+#include <string.h>
+
+const int SNA_HEADER_SIZE = 27;
+const int SNA_48K_SIZE = SNA_HEADER_SIZE + 3 * ZX_BANK_SIZE;
+const int SNA_128K_HEADER_SIZE = 4; // PC, port 7FFD, TR-DOS ROM paged
+// the rest of banks follows, 5 of them, or 6 if the paged one is bank 5 or 2 (then saved twice)
+const int SNA_128K_SIZE = SNA_48K_SIZE + SNA_128K_HEADER_SIZE + 5 * ZX_BANK_SIZE;
+const int SNA_128K_FULL_SIZE = SNA_128K_SIZE + ZX_BANK_SIZE;
+
+const int Z80_HEADER_SIZE = 30;
+
+static bool readFile(const char* path, std::vector<unsigned char>& data)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	unsigned char buffer[0x4000];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+static int getBankAddress(int bank)
+{
+	return (bank == 5) ? 0x4000 : (bank == 2) ? 0x8000 : 0xC000;
+}
+
+static void addBank(std::vector<std::vector<unsigned char> >& banks, int bank, const unsigned char* data)
+{
+	banks[bank].assign(data, data + ZX_BANK_SIZE);
+}
+
+static const char* loadSna(const std::vector<unsigned char>& file, bool& is128K, std::vector<std::vector<unsigned char> >& banks)
+{
+	const unsigned char* d = &file[0];
+	int size = (int)file.size();
+	is128K = (size != SNA_48K_SIZE);
+	addBank(banks, 5, d + SNA_HEADER_SIZE);
+	addBank(banks, 2, d + SNA_HEADER_SIZE + ZX_BANK_SIZE);
+	if (!is128K)
+	{
+		addBank(banks, 0, d + SNA_HEADER_SIZE + 2 * ZX_BANK_SIZE);
+		return NULL;
+	}
+
+	int paged = d[SNA_48K_SIZE + 2] & 7;
+	bool twice = (paged == 5 || paged == 2);
+	if (size != (twice ? SNA_128K_FULL_SIZE : SNA_128K_SIZE))
+		return "128K .sna size doesn't match the paged bank";
+	addBank(banks, paged, d + SNA_HEADER_SIZE + 2 * ZX_BANK_SIZE);
+	const unsigned char* next = d + SNA_48K_SIZE + SNA_128K_HEADER_SIZE;
+	for (int bank = 0; bank < 8; bank++)
+	{
+		if (bank == 5 || bank == 2 || bank == paged)
+			continue;
+		addBank(banks, bank, next);
+		next += ZX_BANK_SIZE;
+	}
+	return NULL;
+}
+
+// Unpacks .z80 memory block: "ED ED n b" is n bytes b, anything else is as is.
+// Returns false if it's not exactly 'dstSize' bytes.
+static bool unpackZ80(const unsigned char* src, int srcSize, unsigned char* dst, int dstSize)
+{
+	int i = 0, o = 0;
+	while (i < srcSize && o < dstSize)
+	{
+		if (i + 3 < srcSize && src[i] == 0xED && src[i + 1] == 0xED)
+		{
+			int n = src[i + 2];
+			if (o + n > dstSize) return false;
+			memset(dst + o, src[i + 3], n);
+			o += n;
+			i += 4;
+		}
+		else
+			dst[o++] = src[i++];
+	}
+	return o == dstSize;
+}
+
+static const char* loadZ80(const std::vector<unsigned char>& file, bool& is128K, std::vector<std::vector<unsigned char> >& banks)
+{
+	const unsigned char* d = &file[0];
+	int size = (int)file.size();
+	if (size < Z80_HEADER_SIZE)
+		return "file is too small for a snapshot";
+
+	if (d[6] != 0 || d[7] != 0)
+	{
+		// version 1: 48K of memory after the header
+		is128K = false;
+		bool compressed = (d[12] != 0xFF) && (d[12] & 0x20);
+		std::vector<unsigned char> memory(3 * ZX_BANK_SIZE);
+		if (compressed)
+		{
+			if (!unpackZ80(d + Z80_HEADER_SIZE, size - Z80_HEADER_SIZE, &memory[0], (int)memory.size()))
+				return "bad compressed memory in .z80";
+		}
+		else if (size < Z80_HEADER_SIZE + (int)memory.size())
+			return ".z80 file is truncated";
+		else
+			memcpy(&memory[0], d + Z80_HEADER_SIZE, memory.size());
+		addBank(banks, 5, &memory[0]);
+		addBank(banks, 2, &memory[ZX_BANK_SIZE]);
+		addBank(banks, 0, &memory[2 * ZX_BANK_SIZE]);
+		return NULL;
+	}
+
+	// versions 2 and 3: extra header, then pages of 3-byte header and data
+	if (size < Z80_HEADER_SIZE + 2)
+		return ".z80 file is truncated";
+	int extraSize = d[30] | (d[31] << 8);
+	if (extraSize != 23 && extraSize != 54 && extraSize != 55)
+		return "unknown .z80 version";
+	if (size < Z80_HEADER_SIZE + 2 + extraSize)
+		return ".z80 file is truncated";
+	int mode = d[34];
+	if (extraSize == 23)
+	{
+		if (mode == 0 || mode == 1) is128K = false;
+		else if (mode == 3 || mode == 4) is128K = true;
+		else return "unsupported machine in .z80";
+	}
+	else
+	{
+		if (mode == 0 || mode == 1 || mode == 3) is128K = false;
+		else if ((mode >= 4 && mode <= 7) || mode == 9 || mode == 12 || mode == 13) is128K = true;
+		else return "unsupported machine in .z80";
+	}
+
+	int pos = Z80_HEADER_SIZE + 2 + extraSize;
+	while (pos + 3 <= size)
+	{
+		int length = d[pos] | (d[pos + 1] << 8);
+		int page = d[pos + 2];
+		pos += 3;
+		int dataSize = (length == 0xFFFF) ? ZX_BANK_SIZE : length;
+		if (pos + dataSize > size)
+			return ".z80 file is truncated";
+
+		// ROM pages and those of other machines are skipped
+		int bank = -1;
+		if (is128K && page >= 3 && page <= 10) bank = page - 3;
+		else if (!is128K && page == 8) bank = 5;
+		else if (!is128K && page == 4) bank = 2;
+		else if (!is128K && page == 5) bank = 0;
+		if (bank >= 0)
+		{
+			banks[bank].resize(ZX_BANK_SIZE);
+			if (length == 0xFFFF)
+				memcpy(&banks[bank][0], d + pos, ZX_BANK_SIZE);
+			else if (!unpackZ80(d + pos, length, &banks[bank][0], ZX_BANK_SIZE))
+				return "bad compressed memory page in .z80";
+		}
+		pos += dataSize;
+	}
+	return NULL;
+}
+
+bool LoadSnapshot(const char* path, Snapshot& snapshot, std::string& error)
+{
+	std::vector<unsigned char> file;
+	if (!readFile(path, file))
+	{
+		error = "cannot read file";
+		return false;
+	}
+
+	std::vector<std::vector<unsigned char> > banks(8);
+	bool is128K = false;
+	int size = (int)file.size();
+	const char* e = (size == SNA_48K_SIZE || size == SNA_128K_SIZE || size == SNA_128K_FULL_SIZE)
+		? loadSna(file, is128K, banks)
+		: loadZ80(file, is128K, banks);
+	if (e)
+	{
+		error = e;
+		return false;
+	}
+
+	snapshot.Is128K = is128K;
+	snapshot.Banks.clear();
+	static const int order[8] = { 5, 2, 0, 1, 3, 4, 6, 7 };
+	for (int i = 0; i < (is128K ? 8 : 3); i++)
+	{
+		int bank = order[i];
+		if (banks[bank].empty())
+		{
+			error = "memory bank is missing";
+			return false;
+		}
+		SnapshotBank b;
+		b.Bank = bank;
+		b.Address = getBankAddress(bank);
+		b.Data.swap(banks[bank]);
+		snapshot.Banks.push_back(b);
+	}
+	return true;
+}
+
+void FindRegions(const Snapshot& snapshot, std::vector<SnapshotRegion>& regions)
+{
+	regions.clear();
+	for (size_t b = 0; b < snapshot.Banks.size(); b++)
+	{
+		const SnapshotBank& bank = snapshot.Banks[b];
+		const unsigned char* d = &bank.Data[0];
+		int start = 0; // of data not in fill regions yet
+		for (int i = 0; i < ZX_BANK_SIZE; )
+		{
+			int end = i + 1;
+			while (end < ZX_BANK_SIZE && d[end] == d[i])
+				end++;
+			if (end - i >= MIN_FILL_SIZE)
+			{
+				if (i > start)
+					regions.push_back(SnapshotRegion(REGION_PACKED, bank.Bank, bank.Address + start, i - start, 0));
+				regions.push_back(SnapshotRegion(REGION_FILL, bank.Bank, bank.Address + i, end - i, d[i]));
+				start = end;
+			}
+			i = end;
+		}
+		if (start < ZX_BANK_SIZE)
+			regions.push_back(SnapshotRegion(REGION_PACKED, bank.Bank, bank.Address + start, ZX_BANK_SIZE - start, 0));
+	}
+}
+
+bool SaveLoadMap(const char* path, const Snapshot& snapshot, const char* format, const std::vector<SnapshotRegion>& regions)
+{
+	FILE* f = fopen(path, "w");
+	if (!f) return false;
+	fprintf(f, "snapshot %s %s\n", snapshot.Is128K ? "128k" : "48k", format);
+	fprintf(f, "; type   bank address size offset size\n");
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		const SnapshotRegion& r = regions[i];
+		if (r.Type == REGION_FILL)
+			fprintf(f, "fill     %d  %04X  %04X  %02X\n", r.Bank, r.Address, r.Size, r.Value);
+		else
+			fprintf(f, "%s   %d  %04X  %04X  %05X  %04X\n", (r.Type == REGION_PACKED) ? "packed" : "stored",
+				r.Bank, r.Address, r.Size, r.BlockOffset, r.BlockSize);
+	}
+	bool ok = !ferror(f);
+	return fclose(f) == 0 && ok;
+}
+
+const unsigned char* GetRegionData(const Snapshot& snapshot, const SnapshotRegion& region)
+{
+	for (size_t b = 0; b < snapshot.Banks.size(); b++)
+		if (snapshot.Banks[b].Bank == region.Bank)
+			return &snapshot.Banks[b].Data[region.Address - snapshot.Banks[b].Address];
+	return NULL;
+}
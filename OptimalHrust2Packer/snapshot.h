@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// ZX Spectrum snapshots (--snapshot): 48K and 128K .sna, .z80 versions 1..3.
+// Memory is kept as 16K banks numbered as on 128K machines; a 48K machine has
+// banks 5, 2 and 0 at 0x4000, 0x8000 and 0xC000. Registers are not read.
+
+const int ZX_BANK_SIZE = 0x4000;
+
+struct SnapshotBank
+{
+	int Bank;    // 0..7
+	int Address; // where the bank is seen: 0x4000, 0x8000, or 0xC000 (paged banks of 128K too)
+	std::vector<unsigned char> Data; // ZX_BANK_SIZE bytes
+};
+
+struct Snapshot
+{
+	bool Is128K;
+	std::vector<SnapshotBank> Banks; // in ascending bank order after 5 and 2
+};
+
+// Reads .sna (told by size) or .z80 (any other size). On error returns false with 'error' set.
+bool LoadSnapshot(const char* path, Snapshot& snapshot, std::string& error);
+
+enum REGION_TYPE
+{
+	REGION_PACKED, // packed block
+	REGION_STORED, // stored as is, packing didn't make it smaller
+	REGION_FILL    // bytes of one value, nothing in blocks file
+};
+
+// Part of a bank and where it went in the blocks file
+struct SnapshotRegion
+{
+	REGION_TYPE Type;
+	int Bank;
+	int Address;
+	int Size;
+	int Value;       // REGION_FILL: byte value
+	int BlockOffset; // REGION_PACKED, REGION_STORED: offset of its block in blocks file
+	int BlockSize;
+
+	SnapshotRegion(REGION_TYPE type, int bank, int address, int size, int value)
+		: Type(type), Bank(bank), Address(address), Size(size), Value(value), BlockOffset(0), BlockSize(0) {};
+};
+
+// Runs of one byte value at least this long become fill regions
+const int MIN_FILL_SIZE = 256;
+
+// Splits every bank into fill regions and packed regions between them
+void FindRegions(const Snapshot& snapshot, std::vector<SnapshotRegion>& regions);
+
+// Load map (<output>.map): regions in bank order as text, one per line, numbers in hex.
+//
+//   snapshot 48k|128k <format>
+//   packed <bank> <address> <size> <block offset> <block size>
+//   stored <bank> <address> <size> <block offset> <block size>
+//   fill <bank> <address> <size> <value>
+//
+// Text after ';' is a comment.
+bool SaveLoadMap(const char* path, const Snapshot& snapshot, const char* format, const std::vector<SnapshotRegion>& regions);
+
+// First byte of a packed or stored region in its bank
+const unsigned char* GetRegionData(const Snapshot& snapshot, const SnapshotRegion& region);
@@ -0,0 +1,186 @@
+
+#include "timing.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+const char* const PhaseNames[PHASE_COUNT] = { "read", "match", "dp", "emit", "write" };
+
+static const std::chrono::steady_clock::time_point programStart = std::chrono::steady_clock::now();
+
+double GetWallSeconds()
+{
+	std::chrono::duration<double> t = std::chrono::steady_clock::now() - programStart;
+	return t.count();
+}
+
+double GetThreadCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7; // 100 ns units
+#else
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+////////////////////////////////////////////////////////////
+///////////           PhaseTimes            ////////////////
+////////////////////////////////////////////////////////////
+
+PhaseTimes::PhaseTimes()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+double PhaseTimes::GetTotalWall() const
+{
+	double sum = 0;
+	for (int i = 0; i < PHASE_COUNT; i++) sum += Wall[i];
+	return sum;
+}
+
+double PhaseTimes::GetTotalCpu() const
+{
+	double sum = 0;
+	for (int i = 0; i < PHASE_COUNT; i++) sum += Cpu[i];
+	return sum;
+}
+
+void PhaseTimes::SplitMatchFromDp()
+{
+	Start[PHASE_MATCH] = Start[PHASE_DP];
+	Wall[PHASE_DP] -= Wall[PHASE_MATCH];
+	if (Wall[PHASE_DP] < 0) Wall[PHASE_DP] = 0;
+	Cpu[PHASE_DP] -= Cpu[PHASE_MATCH];
+	if (Cpu[PHASE_DP] < 0) Cpu[PHASE_DP] = 0;
+#ifdef OHC_PROFILE
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+		if (Hw[PHASE_DP][i] >= 0 && Hw[PHASE_MATCH][i] >= 0)
+			Hw[PHASE_DP][i] -= Hw[PHASE_MATCH][i];
+#endif
+}
+
+PhaseTimer::PhaseTimer(PhaseTimes* times, PHASE phase)
+	: times(times), phase(phase)
+{
+	if (times)
+	{
+		wall0 = GetWallSeconds();
+		cpu0 = GetThreadCpuSeconds();
+#ifdef OHC_PROFILE
+		HwCounters::ForThisThread().Read(hw0);
+#endif
+	}
+}
+
+void PhaseTimer::Stop()
+{
+	if (!times) return;
+	times->Start[phase] = wall0;
+	times->Wall[phase] += GetWallSeconds() - wall0;
+	times->Cpu[phase] += GetThreadCpuSeconds() - cpu0;
+#ifdef OHC_PROFILE
+	long long hw[HW_COUNTER_COUNT];
+	HwCounters::ForThisThread().Read(hw);
+	for (int i = 0; i < HW_COUNTER_COUNT; i++)
+	{
+		long long& total = times->Hw[phase][i];
+		if (hw[i] < 0 || hw0[i] < 0)
+			total = -1;
+		else if (total >= 0)
+			total += hw[i] - hw0[i];
+	}
+#endif
+	times = NULL; // stop only once
+}
+
+////////////////////////////////////////////////////////////
+///////////           TraceWriter           ////////////////
+////////////////////////////////////////////////////////////
+
+std::string JsonEscape(const char* s)
+{
+	std::string r;
+	for (; *s; s++)
+	{
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') { r += '\\'; r += (char)c; }
+		else if (c < 0x20) { char buf[8]; sprintf(buf, "\\u%04x", c); r += buf; }
+		else r += (char)c;
+	}
+	return r;
+}
+
+void TraceWriter::SetTrackName(int track, const char* name)
+{
+	char buf[256];
+	sprintf(buf, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+		track, JsonEscape(name).c_str());
+	std::lock_guard<std::mutex> guard(lock);
+	events.push_back(buf);
+}
+
+void TraceWriter::AddEvent(int track, const char* name, double start, double duration, const char* args)
+{
+	// timestamps are in microseconds
+	std::string e = "{\"name\": \"" + JsonEscape(name) + "\", \"ph\": \"X\", \"pid\": 1";
+	char buf[128];
+	sprintf(buf, ", \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f", track, start * 1e6, duration * 1e6);
+	e += buf;
+	if (args)
+	{
+		e += ", \"args\": {";
+		e += args;
+		e += "}";
+	}
+	e += "}";
+
+	std::lock_guard<std::mutex> guard(lock);
+	events.push_back(e);
+}
+
+void TraceWriter::AddPhases(int track, const char* fileName, const PhaseTimes& times)
+{
+	double end = times.Start[PHASE_WRITE] + times.Wall[PHASE_WRITE];
+	char args[256];
+	sprintf(args, "\"wall_s\": %.6f, \"cpu_s\": %.6f", times.GetTotalWall(), times.GetTotalCpu());
+	AddEvent(track, fileName, times.Start[PHASE_READ], end - times.Start[PHASE_READ], args);
+
+	AddEvent(track, PhaseNames[PHASE_READ], times.Start[PHASE_READ], times.Wall[PHASE_READ], NULL);
+
+	// match finding runs inside DP loop, so they are shown as one event
+	sprintf(args, "\"match_s\": %.6f, \"dp_s\": %.6f", times.Wall[PHASE_MATCH], times.Wall[PHASE_DP]);
+	AddEvent(track, "match + dp", times.Start[PHASE_MATCH], times.Wall[PHASE_MATCH] + times.Wall[PHASE_DP], args);
+
+	AddEvent(track, PhaseNames[PHASE_EMIT], times.Start[PHASE_EMIT], times.Wall[PHASE_EMIT], NULL);
+	AddEvent(track, PhaseNames[PHASE_WRITE], times.Start[PHASE_WRITE], times.Wall[PHASE_WRITE], NULL);
+}
+
+bool TraceWriter::Save(const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f) return false;
+
+	std::lock_guard<std::mutex> guard(lock);
+	fprintf(f, "{\"traceEvents\": [\n");
+	for (size_t i = 0; i < events.size(); i++)
+		fprintf(f, "%s%s\n", events[i].c_str(), (i + 1 < events.size()) ? "," : "");
+	fprintf(f, "], \"displayTimeUnit\": \"ms\"}\n");
+
+	bool ok = (ferror(f) == 0);
+	fclose(f);
+	return ok;
+}
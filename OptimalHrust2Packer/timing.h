@@ -0,0 +1,86 @@
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include "profile.h"
+
+enum PHASE
+{
+	PHASE_READ,
+	PHASE_MATCH, // fill_matchLen, interleaved with DP
+	PHASE_DP,    // rest of Preprocess
+	PHASE_EMIT,
+	PHASE_WRITE,
+	PHASE_COUNT
+};
+
+extern const char* const PhaseNames[PHASE_COUNT];
+
+// Monotonic high-resolution wall clock, seconds since program start
+double GetWallSeconds();
+
+// CPU time consumed by the calling thread, seconds
+double GetThreadCpuSeconds();
+
+// Wall and CPU time spent in each phase while packing one file.
+// Match finding and DP are interleaved per position; fill_matchLen calls are
+// timed one by one and subtracted from the whole Preprocess time.
+struct PhaseTimes
+{
+	double Start[PHASE_COUNT]; // GetWallSeconds() when phase began
+	double Wall[PHASE_COUNT];
+	double Cpu[PHASE_COUNT];
+#ifdef OHC_PROFILE
+	long long Hw[PHASE_COUNT][HW_COUNTER_COUNT]; // -1 if counter is unavailable
+#endif
+
+	PhaseTimes();
+
+	double GetTotalWall() const;
+	double GetTotalCpu() const;
+
+	// Preprocess is measured as PHASE_DP while fill_matchLen accumulates PHASE_MATCH
+	// on its own; this moves match finding out of DP.
+	void SplitMatchFromDp();
+};
+
+// Measures one phase from construction to Stop(), adding to what the phase already has.
+// Does nothing if 'times' is NULL.
+class PhaseTimer
+{
+	PhaseTimes* times;
+	PHASE phase;
+	double wall0;
+	double cpu0;
+#ifdef OHC_PROFILE
+	long long hw0[HW_COUNTER_COUNT];
+#endif
+
+public:
+	PhaseTimer(PhaseTimes* times, PHASE phase);
+	void Stop();
+};
+
+// Collects Chrome trace events ("Trace Event Format", viewable in chrome://tracing
+// or Perfetto). Safe to use from several threads; 'track' becomes the thread id.
+class TraceWriter
+{
+	std::mutex lock;
+	std::vector<std::string> events;
+
+public:
+	void SetTrackName(int track, const char* name);
+
+	// 'args' is a JSON object body without braces, or NULL
+	void AddEvent(int track, const char* name, double start, double duration, const char* args);
+
+	// All phases of one file as separate events, wrapped into one event named 'fileName'
+	void AddPhases(int track, const char* fileName, const PhaseTimes& times);
+
+	bool Save(const char* path);
+};
+
+// Escapes string for use inside JSON quotes
+std::string JsonEscape(const char* s);
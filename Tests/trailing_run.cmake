@@ -0,0 +1,16 @@
+# Packs 65535-byte inputs of text ending in a run of 300 and 5535 bytes
+# with PACKER --verify; fails if any of them doesn't pack or unpack back.
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+foreach(tail 300 5535)
+	math(EXPR textSize "65535 - ${tail}")
+	string(RANDOM LENGTH ${textSize} ALPHABET "abcdefghij ." RANDOM_SEED ${tail} text)
+	string(RANDOM LENGTH ${tail} ALPHABET "A" run)
+	set(input ${WORK_DIR}/trailing_run_${tail}.bin)
+	file(WRITE ${input} "${text}${run}")
+	execute_process(COMMAND ${PACKER} --verify ${input} ${input}.out
+		RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "${input}: ${PACKER} exited with ${result}\n${output}")
+	endif()
+endforeach()